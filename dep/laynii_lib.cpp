@@ -26,6 +26,47 @@ void log_nifti_descriptives(nifti_image* nii) {
     cout << "    Datatype = " << nii->datatype << "\n" << endl;
 }
 
+void set_nr_threads(int nr_threads) {
+    // Parallel loops only run on more than one thread when asked for
+    if (nr_threads < 1) {
+        nr_threads = 1;
+    }
+    znz_set_nthreads(nr_threads);  // Compression of .nii.gz outputs
+#ifdef _OPENMP
+    omp_set_num_threads(nr_threads);
+    cout << "  Nr. threads = " << nr_threads << endl;
+#else
+    if (nr_threads > 1) {
+        cout << "  Compiled without OpenMP, using a single thread." << endl;
+    }
+#endif
+}
+
+// Default of every program, also the ones without a -threads option: a
+// single thread, unless OMP_NUM_THREADS asks for more.
+static int default_nr_threads(void) {
+    const char* env = getenv("OMP_NUM_THREADS");
+    int nr_threads = (env != NULL) ? atoi(env) : 1;
+    if (nr_threads < 1) {
+        nr_threads = 1;
+    }
+    znz_set_nthreads(nr_threads);
+#ifdef _OPENMP
+    omp_set_num_threads(nr_threads);
+#endif
+    return nr_threads;
+}
+static const int nr_threads_at_start = default_nr_threads();
+
+bool is_main_thread(void) {
+    // Used to print progress only once from within parallel loops
+#ifdef _OPENMP
+    return omp_get_thread_num() == 0;
+#else
+    return true;
+#endif
+}
+
 // ============================================================================
 // Statistics functions
 // ============================================================================
@@ -139,30 +180,9 @@ float gaus(float distance, float sigma) {
 // Utility functions
 // ============================================================================
 
-void save_output_nifti(const string path, const string tag,  nifti_image* nii,
-                       const bool log, const bool use_outpath) {
-    ///////////////////////////////////////////////////////////////////////////
-    // Note:
-    // - 1st argument is the string of the output file name
-    //       if there is no explicit output path given, this will be the file
-    //       name of the main input data
-    //       if there is an explicit output file name given, this wil be the
-    //       user-defined name following the -output
-    //       (inluding the path and including the file extension)
-    // - 2nd argument is the output file name tag, that will be added to the
-    //       above argument, this field is ignored, when the flag "use_outpath"
-    //       (last argument) is selected.
-    // - 3rd argument is the pointer to the data set that is supposed to be
-    //       written
-    // - 4th argument states if, during the exectution of the program an the
-    //   writing process should be logged
-    //       this argument is optional with the default: TRUE
-    // - 5th argument states if the output tag (second argument) should be
-    //   ignored or not. This argument is optional the default: FALSE
-    //
-    // example: save_output_nifti(fout, "VASO_LN", nii_boco_vaso, true, use_outpath);
-    ///////////////////////////////////////////////////////////////////////////
-
+static string output_path(const string path, const string tag,
+                          const bool use_outpath) {
+    // Output file name as described in save_output_nifti
     string path_out;
 
     if (use_outpath) {
@@ -202,6 +222,44 @@ void save_output_nifti(const string path, const string tag,  nifti_image* nii,
         path_out = dir + sep + basename + "_" + tag + ext;
     }
 
+    return path_out;
+}
+
+string output_path_txt(const string path, const string tag) {
+    // Same naming as save_output_nifti, with a '.txt' extension
+    string path_out = output_path(path, tag, false);
+    size_t pos_sep = path_out.find_last_of("/\\");
+    size_t pos_ext = path_out.find_first_of('.',
+        pos_sep == string::npos ? 0 : pos_sep + 1);
+    return path_out.substr(0, pos_ext) + ".txt";
+}
+
+void save_output_nifti(const string path, const string tag,  nifti_image* nii,
+                       const bool log, const bool use_outpath) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Note:
+    // - 1st argument is the string of the output file name
+    //       if there is no explicit output path given, this will be the file
+    //       name of the main input data
+    //       if there is an explicit output file name given, this wil be the
+    //       user-defined name following the -output
+    //       (inluding the path and including the file extension)
+    // - 2nd argument is the output file name tag, that will be added to the
+    //       above argument, this field is ignored, when the flag "use_outpath"
+    //       (last argument) is selected.
+    // - 3rd argument is the pointer to the data set that is supposed to be
+    //       written
+    // - 4th argument states if, during the exectution of the program an the
+    //   writing process should be logged
+    //       this argument is optional with the default: TRUE
+    // - 5th argument states if the output tag (second argument) should be
+    //   ignored or not. This argument is optional the default: FALSE
+    //
+    // example: save_output_nifti(fout, "VASO_LN", nii_boco_vaso, true, use_outpath);
+    ///////////////////////////////////////////////////////////////////////////
+
+    string path_out = output_path(path, tag, use_outpath);
+
     // Save nifti
     nifti_set_filenames(nii, path_out.c_str(), 1, 1);
     nifti_image_write(nii);
@@ -210,252 +268,193 @@ void save_output_nifti(const string path, const string tag,  nifti_image* nii,
     }
 }
 
-nifti_image* copy_nifti_as_float32(nifti_image* nii) {
+znzFile open_output_nifti(const string path, const string tag, nifti_image* nii,
+                          const bool log, const bool use_outpath) {
     ///////////////////////////////////////////////////////////////////////////
-    // NOTE(Renzo): Fixing potential problems with different input datatypes //
-    // here, I am loading them in their native datatype and cast them        //
-    // to the datatype I like best.                                          //
+    // Same arguments as save_output_nifti, but only the header of nii is
+    // written. Image data is then appended volume by volume with
+    // write_output_volume and the file is finished with close_output_nifti.
+    // This way outputs of 4D programs never need to be held in memory.
+    // nii->data is not used and can be NULL.
     ///////////////////////////////////////////////////////////////////////////
+    string path_out = output_path(path, tag, use_outpath);
 
-    // NOTE(for future reference): Rick's comments:
-    // nifti_copy_nim_info(). It will return with data == NULL.
-    // If you need the data allocated, memory use would not change once you do
-    // so. There is also nifti_make_new_nim()
-    // nifti_image* nifti_make_new_nim(const int64_t dims[],
-    //                                 int datatype, int data_fill)
+    nifti_set_filenames(nii, path_out.c_str(), 1, 1);
+    znzFile fp = nifti_image_write_hdr_img(nii, 2, "wb");  // Leave file open
+    if (znz_isnull(fp)) {
+        fprintf(stderr, "** failed to open '%s' for writing\n", path_out.c_str());
+    } else if (log) {
+        log_output(path_out.c_str());
+    }
+    return fp;
+}
 
-    nifti_image* nii_new = nifti_copy_nim_info(nii);
-    nii_new->datatype = NIFTI_TYPE_FLOAT32;
-    nii_new->nbyper = sizeof(float);
-    nii_new->data = calloc(nii_new->nvox, nii_new->nbyper);
-    float* nii_new_data = static_cast<float*>(nii_new->data);
-    int nr_voxels = nii_new->nvox;
+void write_output_volume(znzFile fp, const float* data, int64_t nr_voxels) {
+    int64_t nr_bytes = nr_voxels * static_cast<int64_t>(sizeof(float));
+    if (znz_isnull(fp)) return;
+    if (nifti_write_buffer(fp, data, nr_bytes) != nr_bytes) {
+        fprintf(stderr, "** failed to write output volume\n");
+    }
+}
 
-    // NOTE(Faruk): See nifti1.h for notes on data types
-    // ------------------------------------------------------------------------
-    if (nii->datatype == 2) {  // NIFTI_TYPE_UINT8
-        uint8_t* nii_data = static_cast<uint8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 512) {  // NIFTI_TYPE_UINT16
-        uint16_t* nii_data = static_cast<uint16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 768) {  // NIFTI_TYPE_UINT32
-        uint32_t* nii_data = static_cast<uint32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1280) {  // NIFTI_TYPE_UINT64
-        uint64_t* nii_data = static_cast<uint64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 256) {  // NIFTI_TYPE_INT8
-        int8_t* nii_data = static_cast<int8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 4) {  // NIFTI_TYPE_INT16
-        int16_t* nii_data = static_cast<int16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 8) {  // NIFTI_TYPE_INT32
-        int32_t* nii_data = static_cast<int32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1024) {  // NIFTI_TYPE_INT64
-        int64_t* nii_data = static_cast<int64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 16) {  // NIFTI_TYPE_FLOAT32
-        float* nii_data = static_cast<float*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 64) {  // NIFTI_TYPE_FLOAT64
-        double* nii_data = static_cast<double*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<float>(*(nii_data + i));
-        }
-    } else {
-        cout << "Warning! Unrecognized nifti data type!" << endl;
+void close_output_nifti(znzFile fp) {
+    if (!znz_isnull(fp)) {
+        znzclose(fp);
     }
+}
 
-    // Replace nans with zeros
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nii_new_data + i)!= *(nii_new_data + i)) {
-            *(nii_new_data + i) = 0;
+// ============================================================================
+// Data type conversion
+// ============================================================================
+// NOTE(Renzo): Fixing potential problems with different input datatypes
+// here, I am loading them in their native datatype and cast them to the
+// datatype I like best.
+//
+// NOTE(for future reference): Rick's comments:
+// nifti_copy_nim_info(). It will return with data == NULL.
+// If you need the data allocated, memory use would not change once you do
+// so. There is also nifti_make_new_nim()
+// nifti_image* nifti_make_new_nim(const int64_t dims[],
+//                                 int datatype, int data_fill)
+//
+// All conversions below go through convert_values, which casts, optionally
+// applies scl_slope/scl_inter and replaces NaNs with zeros in one pass.
+
+template <typename T_in, typename T_out>
+static void convert_values(const void* data, int64_t start, int64_t count,
+                           T_out* out, double slope, double inter) {
+    const T_in* in = static_cast<const T_in*>(data) + start;
+    if (slope != 0) {
+        // Scaling is done in float for float outputs, in double otherwise
+        typedef typename std::conditional<std::is_same<T_out, float>::value,
+                                          float, double>::type T_calc;
+        const T_calc s = static_cast<T_calc>(slope);
+        const T_calc b = static_cast<T_calc>(inter);
+        for (int64_t i = 0; i < count; ++i) {
+            T_calc v = static_cast<T_calc>(*(in + i)) * s + b;
+            *(out + i) = (v != v) ? 0 : static_cast<T_out>(v);
+        }
+    } else {
+        for (int64_t i = 0; i < count; ++i) {
+            T_in v = *(in + i);
+            *(out + i) = (v != v) ? 0 : static_cast<T_out>(v);
         }
     }
-
-    return nii_new;
 }
 
-nifti_image* copy_nifti_as_double(nifti_image* nii) {
-    ///////////////////////////////////////////////////////////////////////////
-    // NOTE(Renzo): Fixing potential problems with different input datatypes //
-    // here, I am loading them in their native datatype and cast them        //
-    // to the datatype I like best.                                          //
-    ///////////////////////////////////////////////////////////////////////////
+template <typename T_out>
+static bool convert_nifti_values(const nifti_image* nii, int64_t start,
+                                 int64_t count, T_out* out, bool scale) {
+    // Returns false for unrecognized data types (out is not written)
+    double slope = 0, inter = 0;
+    if (scale && nii->scl_slope != 0
+        && !(nii->scl_slope == 1 && nii->scl_inter == 0)) {
+        slope = nii->scl_slope;
+        inter = nii->scl_inter;
+    }
 
-    // NOTE(for future reference): Rick's comments:
-    // nifti_copy_nim_info(). It will return with data == NULL.
-    // If you need the data allocated, memory use would not change once you do
-    // so. There is also nifti_make_new_nim()
-    // nifti_image* nifti_make_new_nim(const int64_t dims[],
-    //                                 int datatype, int data_fill)
+    // NOTE(Faruk): See nifti1.h for notes on data types
+    switch (nii->datatype) {
+        case NIFTI_TYPE_UINT8:
+            convert_values<uint8_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_UINT16:
+            convert_values<uint16_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_UINT32:
+            convert_values<uint32_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_UINT64:
+            convert_values<uint64_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_INT8:
+            convert_values<int8_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_INT16:
+            convert_values<int16_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_INT32:
+            convert_values<int32_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_INT64:
+            convert_values<int64_t>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_FLOAT32:
+            convert_values<float>(nii->data, start, count, out, slope, inter);
+            break;
+        case NIFTI_TYPE_FLOAT64:
+            convert_values<double>(nii->data, start, count, out, slope, inter);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
 
+template <typename T_out>
+static nifti_image* copy_nifti_as(nifti_image* nii, int datatype, bool scale) {
     nifti_image* nii_new = nifti_copy_nim_info(nii);
-    nii_new->datatype = NIFTI_TYPE_FLOAT32;
-    nii_new->nbyper = sizeof(double);
-    nii_new->data = calloc(nii_new->nvox, nii_new->nbyper);
-    double* nii_new_data = static_cast<double*>(nii_new->data);
+    nii_new->datatype = datatype;
+    nii_new->nbyper = sizeof(T_out);
+    nii_new->data = malloc(nii_new->nvox * nii_new->nbyper);
+    T_out* nii_new_data = static_cast<T_out*>(nii_new->data);
 
-    // NOTE(Faruk): See nifti1.h for notes on data types
-    // ------------------------------------------------------------------------
-    if (nii->datatype == 2) {  // NIFTI_TYPE_UINT8
-        uint8_t* nii_data = static_cast<uint8_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 512) {  // NIFTI_TYPE_UINT16
-        uint16_t* nii_data = static_cast<uint16_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 768) {  // NIFTI_TYPE_UINT32
-        uint32_t* nii_data = static_cast<uint32_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1280) {  // NIFTI_TYPE_UINT64
-        uint64_t* nii_data = static_cast<uint64_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 256) {  // NIFTI_TYPE_INT8
-        int8_t* nii_data = static_cast<int8_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 4) {  // NIFTI_TYPE_INT16
-        int16_t* nii_data = static_cast<int16_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 8) {  // NIFTI_TYPE_INT32
-        int32_t* nii_data = static_cast<int32_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1024) {  // NIFTI_TYPE_INT64
-        int64_t* nii_data = static_cast<int64_t*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 16) {  // NIFTI_TYPE_FLOAT32
-        float* nii_data = static_cast<float*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 64) {  // NIFTI_TYPE_FLOAT64
-        double* nii_data = static_cast<double*>(nii->data);
-        for (int i = 0; i < nii_new->nvox; ++i) {
-            *(nii_new_data + i) = static_cast<double>(*(nii_data + i));
-        }
-    } else {
+    if (!convert_nifti_values(nii, 0, nii_new->nvox, nii_new_data, scale)) {
         cout << "Warning! Unrecognized nifti data type!" << endl;
+        memset(nii_new->data, 0, nii_new->nvox * nii_new->nbyper);
+    } else if (scale && nii->scl_slope != 0) {
+        // Scaling is in the data now
+        nii_new->scl_slope = 1;
+        nii_new->scl_inter = 0;
     }
+    return nii_new;
+}
 
-    // Replace nans with zeros
-    for (int i = 0; i < nii->nvox; ++i) {
-        if (*(nii_new_data + i)!= *(nii_new_data + i)) {
-            *(nii_new_data + i) = 0;
+template <typename T_out>
+static void convert_nifti_in_place(nifti_image* nii, int datatype) {
+    if (nii->datatype == datatype) {
+        // Same type: only replace NaNs (no-op for integers), no new memory
+        T_out* nii_data = static_cast<T_out*>(nii->data);
+        for (int64_t i = 0; i < nii->nvox; ++i) {
+            if (*(nii_data + i) != *(nii_data + i)) {
+                *(nii_data + i) = 0;
+            }
         }
+        return;
+    }
+    T_out* nii_new_data = static_cast<T_out*>(malloc(nii->nvox * sizeof(T_out)));
+    if (!convert_nifti_values(nii, 0, nii->nvox, nii_new_data, false)) {
+        cout << "Warning! Unrecognized nifti data type!" << endl;
+        memset(nii_new_data, 0, nii->nvox * sizeof(T_out));
     }
+    nifti_image_unload(nii);  // Also handles memory mapped data
+    nii->data = nii_new_data;
+    nii->datatype = datatype;
+    nii->nbyper = sizeof(T_out);
+}
 
-    return nii_new;
+nifti_image* copy_nifti_as_float32(nifti_image* nii, bool scale) {
+    return copy_nifti_as<float>(nii, NIFTI_TYPE_FLOAT32, scale);
 }
 
-nifti_image* copy_nifti_as_int32(nifti_image* nii) {
-    nifti_image* nii_new = nifti_copy_nim_info(nii);
-    nii_new->datatype = NIFTI_TYPE_INT32;
-    nii_new->nbyper = sizeof(int32_t);
-    nii_new->data = calloc(nii_new->nvox, nii_new->nbyper);
-    int nr_voxels = nii_new->nvox;
+nifti_image* copy_nifti_as_double(nifti_image* nii, bool scale) {
+    return copy_nifti_as<double>(nii, NIFTI_TYPE_FLOAT64, scale);
+}
 
-    int32_t* nii_new_data = static_cast<int32_t*>(nii_new->data);
+nifti_image* copy_nifti_as_int32(nifti_image* nii, bool scale) {
+    return copy_nifti_as<int32_t>(nii, NIFTI_TYPE_INT32, scale);
+}
 
-    // NOTE(Faruk): See nifti1.h for notes on data types
-    // ------------------------------------------------------------------------
-    if (nii->datatype == 2) {  // NIFTI_TYPE_UINT8
-        uint8_t* nii_data = static_cast<uint8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 512) {  // NIFTI_TYPE_UINT16
-        uint16_t* nii_data = static_cast<uint16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 768) {  // NIFTI_TYPE_UINT32
-        uint32_t* nii_data = static_cast<uint32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1280) {  // NIFTI_TYPE_UINT64
-        uint64_t* nii_data = static_cast<uint64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 256) {  // NIFTI_TYPE_INT8
-        int8_t* nii_data = static_cast<int8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 4) {  // NIFTI_TYPE_INT16
-        int16_t* nii_data = static_cast<int16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 8) {  // NIFTI_TYPE_INT32
-        int32_t* nii_data = static_cast<int32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1024) {  // NIFTI_TYPE_INT64
-        int64_t* nii_data = static_cast<int64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 16) {  // NIFTI_TYPE_FLOAT32
-        float* nii_data = static_cast<float*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 64) {  // NIFTI_TYPE_FLOAT64
-        double* nii_data = static_cast<double*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int32_t>(*(nii_data + i));
-        }
-    } else {
-        cout << "Warning! Unrecognized nifti data type!" << endl;
-    }
+nifti_image* copy_nifti_as_int16(nifti_image* nii, bool scale) {
+    return copy_nifti_as<int16_t>(nii, NIFTI_TYPE_INT16, scale);
+}
 
-    // Replace nans with zeros
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nii_new_data + i)!=*(nii_new_data + i)) {
-            *(nii_new_data + i) = 0;
-        }
+template <typename T>
+static void scale_to_short(const void* data, int64_t count, short* out) {
+    const T* in = static_cast<const T*>(data);
+    for (int64_t i = 0; i < count; ++i) {
+        *(out + i) = (short)((double) (*(in + i) * 1000));
     }
-
-    return nii_new;
 }
 
 nifti_image* copy_nifti_as_float16(nifti_image* nii) {
@@ -465,151 +464,147 @@ nifti_image* copy_nifti_as_float16(nifti_image* nii) {
     nii_new->datatype = NIFTI_TYPE_INT16;
     nii_new->nbyper = sizeof(short);
     nii_new->data = calloc(nii_new->nvox, nii_new->nbyper);
-    int nr_voxels = nii_new->nvox;
+    int64_t nr_voxels = nii_new->nvox;
 
     short *nii_new_data = static_cast<short*>(nii_new->data);
 
-    // NOTE(Faruk): See nifti1.h for notes on data types
-    // ------------------------------------------------------------------------
-    if (nii->datatype == 2) {  // NIFTI_TYPE_UINT8
-        uint8_t* nii_data = static_cast<uint8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 512) {  // NIFTI_TYPE_UINT16
-        uint16_t* nii_data = static_cast<uint16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 768) {  // NIFTI_TYPE_UINT32
-        uint32_t* nii_data = static_cast<uint32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 1280) {  // NIFTI_TYPE_UINT64
-        uint64_t* nii_data = static_cast<uint64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 256) {  // NIFTI_TYPE_INT8
-        int8_t* nii_data = static_cast<int8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 4) {  // NIFTI_TYPE_INT16
-        int16_t* nii_data = static_cast<int16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 8) {  // NIFTI_TYPE_INT32
-        int32_t* nii_data = static_cast<int32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 1024) {  // NIFTI_TYPE_INT64
-        int64_t* nii_data = static_cast<int64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 16) {  // NIFTI_TYPE_FLOAT32
-        float* nii_data = static_cast<float*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else if (nii->datatype == 64) {  // NIFTI_TYPE_FLOAT64
-        double* nii_data = static_cast<double*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = (short)((double) (*(nii_data + i) * 1000));
-        }
-    } else {
-        cout << "Warning! Unrecognized nifti data type!" << endl;
+    switch (nii->datatype) {
+        case NIFTI_TYPE_UINT8:
+            scale_to_short<uint8_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_UINT16:
+            scale_to_short<uint16_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_UINT32:
+            scale_to_short<uint32_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_UINT64:
+            scale_to_short<uint64_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_INT8:
+            scale_to_short<int8_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_INT16:
+            scale_to_short<int16_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_INT32:
+            scale_to_short<int32_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_INT64:
+            scale_to_short<int64_t>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_FLOAT32:
+            scale_to_short<float>(nii->data, nr_voxels, nii_new_data); break;
+        case NIFTI_TYPE_FLOAT64:
+            scale_to_short<double>(nii->data, nr_voxels, nii_new_data); break;
+        default:
+            cout << "Warning! Unrecognized nifti data type!" << endl;
     }
     nii_new->scl_slope = nii->scl_slope / 1000.;
-    // Replace nans with zeros
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nii_new_data + i)!=*(nii_new_data + i)) {
-            *(nii_new_data + i) = 0;
-        }
-    }
 
     return nii_new;
 }
 
-nifti_image* copy_nifti_as_int16(nifti_image* nii) {
-    nifti_image* nii_new = nifti_copy_nim_info(nii);
-    nii_new->datatype = NIFTI_TYPE_INT16;
-    nii_new->nbyper = sizeof(int16_t);
-    nii_new->data = calloc(nii_new->nvox, nii_new->nbyper);
-    int nr_voxels = nii_new->nvox;
+void convert_nifti_to_float32(nifti_image* nii) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Same as copy_nifti_as_float32, but converts nii itself. Use this when
+    // the input data is not needed in its original type anymore. When nii is
+    // already float32 no memory is allocated.
+    ///////////////////////////////////////////////////////////////////////////
+    convert_nifti_in_place<float>(nii, NIFTI_TYPE_FLOAT32);
+}
 
-    int16_t* nii_new_data = static_cast<int16_t*>(nii_new->data);
+void convert_nifti_to_int32(nifti_image* nii) {
+    convert_nifti_in_place<int32_t>(nii, NIFTI_TYPE_INT32);
+}
 
-    // NOTE(Faruk): See nifti1.h for notes on data types
-    // ------------------------------------------------------------------------
-    if (nii->datatype == 2) {  // NIFTI_TYPE_UINT8
-        uint8_t* nii_data = static_cast<uint8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 512) {  // NIFTI_TYPE_UINT16
-        uint16_t* nii_data = static_cast<uint16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 768) {  // NIFTI_TYPE_UINT32
-        uint32_t* nii_data = static_cast<uint32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1280) {  // NIFTI_TYPE_UINT64
-        uint64_t* nii_data = static_cast<uint64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 256) {  // NIFTI_TYPE_INT8
-        int8_t* nii_data = static_cast<int8_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 4) {  // NIFTI_TYPE_INT16
-        int16_t* nii_data = static_cast<int16_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 8) {  // NIFTI_TYPE_INT32
-        int32_t* nii_data = static_cast<int32_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 1024) {  // NIFTI_TYPE_INT64
-        int64_t* nii_data = static_cast<int64_t*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 16) {  // NIFTI_TYPE_FLOAT32
-        float* nii_data = static_cast<float*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
-        }
-    } else if (nii->datatype == 64) {  // NIFTI_TYPE_FLOAT64
-        double* nii_data = static_cast<double*>(nii->data);
-        for (int i = 0; i < nr_voxels; ++i) {
-            *(nii_new_data + i) = static_cast<int16_t>(*(nii_data + i));
+void copy_volume_as_float32(nifti_image* nii, int64_t t, float* out) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Convert a single volume (time point t) to float32 into out, which must
+    // hold nx * ny * nz values. Same as copy_nifti_as_float32 (including the
+    // NaN replacement) but for one volume. When nii is read with
+    // nifti_image_read_mmap() only the pages of this volume are read.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nr_voxels = nii->nx * nii->ny * nii->nz;
+
+    if (!convert_nifti_values(nii, nr_voxels * t, nr_voxels, out, false)) {
+        cout << "Warning! Unrecognized nifti data type!" << endl;
+        for (int64_t i = 0; i < nr_voxels; ++i) {
+            *(out + i) = 0;
         }
-    } else {
+    }
+}
+
+// ============================================================================
+// Voxel-major layout
+// ============================================================================
+// NIfTI time series are stored volume after volume, so the time series of
+// one voxel is strided by a full volume. Per voxel time series algorithms
+// read them from a voxel-major copy instead: out[v * nt + t]. Both functions
+// below work in tiles so that reads and writes stay within cache lines.
+static const int64_t TRANSPOSE_TILE = 64;
+
+void copy_voxels_as_float32(nifti_image* nii, int64_t start, int64_t count,
+                            float* out) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Convert the time series of voxels start to start + count - 1 to float32
+    // into out, voxel-major (count * nt values). start = 0 and count = nx *
+    // ny * nz gives the whole image. Same values as copy_nifti_as_float32.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nr_voxels = nii->nx * nii->ny * nii->nz;
+    const int64_t nt = nii->nvox / nr_voxels;
+    const int64_t nr_blocks = (count + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+
+    float probe;
+    if (!convert_nifti_values(nii, 0, 0, &probe, false)) {
         cout << "Warning! Unrecognized nifti data type!" << endl;
+        fill(out, out + count * nt, 0.f);
+        return;
     }
 
-    // Replace nans with zeros
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nii_new_data + i)!= *(nii_new_data + i)) {
-            *(nii_new_data + i) = 0;
+    #pragma omp parallel
+    {
+        // A tile of time points for a block of voxels, time-major
+        vector<float> tile(TRANSPOSE_TILE * TRANSPOSE_TILE);
+
+        #pragma omp for
+        for (int64_t b = 0; b < nr_blocks; ++b) {
+            const int64_t v0 = b * TRANSPOSE_TILE;
+            const int64_t nv = min(TRANSPOSE_TILE, count - v0);
+            for (int64_t t0 = 0; t0 < nt; t0 += TRANSPOSE_TILE) {
+                const int64_t ntile = min(TRANSPOSE_TILE, nt - t0);
+                for (int64_t t = 0; t < ntile; ++t) {
+                    convert_nifti_values(nii, nr_voxels * (t0 + t) + start + v0,
+                                         nv, &tile[t * TRANSPOSE_TILE], false);
+                }
+                for (int64_t v = 0; v < nv; ++v) {
+                    float* ts = out + (v0 + v) * nt + t0;
+                    for (int64_t t = 0; t < ntile; ++t) {
+                        *(ts + t) = tile[t * TRANSPOSE_TILE + v];
+                    }
+                }
+            }
         }
     }
-
-    return nii_new;
 }
 
+void transpose_blocked(const float* in, float* out, const int64_t nr_rows,
+                       const int64_t nr_cols) {
+    ///////////////////////////////////////////////////////////////////////////
+    // out[c * nr_rows + r] = in[r * nr_cols + c], tile by tile. With nr_rows
+    // = nt and nr_cols = nr_voxels this turns a volume-major float image into
+    // voxel-major, with the two swapped it turns it back.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nr_row_tiles = (nr_rows + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+    const int64_t nr_col_tiles = (nr_cols + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+
+    #pragma omp parallel for collapse(2)
+    for (int64_t rt = 0; rt < nr_row_tiles; ++rt) {
+        for (int64_t ct = 0; ct < nr_col_tiles; ++ct) {
+            const int64_t r0 = rt * TRANSPOSE_TILE;
+            const int64_t c0 = ct * TRANSPOSE_TILE;
+            const int64_t r1 = min(r0 + TRANSPOSE_TILE, nr_rows);
+            const int64_t c1 = min(c0 + TRANSPOSE_TILE, nr_cols);
+            for (int64_t c = c0; c < c1; ++c) {
+                for (int64_t r = r0; r < r1; ++r) {
+                    *(out + c * nr_rows + r) = *(in + r * nr_cols + c);
+                }
+            }
+        }
+    }
+}
 
 // ============================================================================
 // Faruk's favorite functions
@@ -642,6 +637,37 @@ std::tuple<float, float> simplex_perturb_2D(float x, float y, float a, float b)
     return std::make_tuple(x_new, y_new);
 }
 
+Neighbours26 neighbours_26(const uint32_t size_x, const uint32_t size_y,
+                           const uint32_t size_z, const float dX,
+                           const float dY, const float dZ) {
+    // Short diagonals
+    const float dia_xy = sqrt(dX * dX + dY * dY);
+    const float dia_xz = sqrt(dX * dX + dZ * dZ);
+    const float dia_yz = sqrt(dY * dY + dZ * dZ);
+    // Long diagonals
+    const float dia_xyz = sqrt(dX * dX + dY * dY + dZ * dZ);
+
+    Neighbours26 nb;
+    nb.size_x = size_x;
+    nb.size_y = size_y;
+    nb.size_z = size_z;
+    for (int n = 0; n != 26; ++n) {
+        nb.offset[n] = NB26_DX[n]
+                       + static_cast<int64_t>(NB26_DY[n]) * size_x
+                       + static_cast<int64_t>(NB26_DZ[n]) * size_x * size_y;
+
+        int jumps = abs(NB26_DX[n]) + abs(NB26_DY[n]) + abs(NB26_DZ[n]);
+        if (jumps == 1) {
+            nb.dist[n] = NB26_DX[n] != 0 ? dX : (NB26_DY[n] != 0 ? dY : dZ);
+        } else if (jumps == 2) {
+            nb.dist[n] = NB26_DX[n] == 0 ? dia_yz : (NB26_DY[n] == 0 ? dia_xz : dia_xy);
+        } else {
+            nb.dist[n] = dia_xyz;
+        }
+    }
+    return nb;
+}
+
 // std::tuple<float, float> simplex_power_2D(float x, float y, float a) {
 //     float x_new = std::pow(x, a);
 //     float y_new = std::pow(y, a);
@@ -655,9 +681,13 @@ std::tuple<float, float> simplex_perturb_2D(float x, float y, float a, float b)
 nifti_image* iterative_smoothing(nifti_image* nii_in, int iter_smooth,
                                  nifti_image* nii_mask, int32_t mask_value) {
 
-    // Copy input niftis TODO[Faruk]: Understand why I have to do this
+    // Copy input nifti, its data is overwritten by each iteration. The mask
+    // is only read, so it is used as it is when it is int32 already.
     nifti_image* temp1 = copy_nifti_as_float32(nii_in);
-    nifti_image* temp2 = copy_nifti_as_int32(nii_mask);
+    nifti_image* temp2 = nii_mask;
+    if (nii_mask->datatype != NIFTI_TYPE_INT32) {
+        temp2 = copy_nifti_as_int32(nii_mask);
+    }
 
     float* nii_in_data = static_cast<float*>(temp1->data);
     int32_t* nii_mask_data = static_cast<int32_t*>(temp2->data);
@@ -707,11 +737,13 @@ nifti_image* iterative_smoothing(nifti_image* nii_in, int iter_smooth,
 
     // ------------------------------------------------------------------------
     // Prepare output nifti
-    nifti_image* nii_smooth = copy_nifti_as_float32(nii_in);
+    // NOTE: Only the first volume starts from zeros, others from the input
+    nifti_image* nii_smooth = nifti_copy_nim_info(temp1);
+    nii_smooth->data = malloc(nii_smooth->nvox * nii_smooth->nbyper);
     float* nii_smooth_data = static_cast<float*>(nii_smooth->data);
-    for (uint32_t i = 0; i != nr_voxels; ++i) {
-        *(nii_smooth_data + i) = 0;
-    }
+    memset(nii_smooth_data, 0, nr_voxels * sizeof(float));
+    memcpy(nii_smooth_data + nr_voxels, nii_in_data + nr_voxels,
+           (nii_smooth->nvox - nr_voxels) * sizeof(float));
 
     // Pre-compute weights
     float FWHM_val = 1;  // TODO(Faruk): Might tweak this one
@@ -800,5 +832,415 @@ nifti_image* iterative_smoothing(nifti_image* nii_in, int iter_smooth,
         }
         cout << endl;
     }
+    free(voi_id);
+    nifti_image_free(temp1);
+    if (temp2 != nii_mask) {
+        nifti_image_free(temp2);
+    }
     return nii_smooth;
 }
+
+// ============================================================================
+// Connected clusters
+// ============================================================================
+static inline uint32_t find_root(std::vector<uint32_t>& parent, uint32_t p) {
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];  // Path halving
+        p = parent[p];
+    }
+    return p;
+}
+
+ConnectedClusters connected_clusters(const Neighbours26& nb,
+                                     const int connectivity, int32_t* labels) {
+    const uint32_t end_x = nb.size_x - 1;
+    const uint32_t end_y = nb.size_y - 1;
+    const uint32_t end_z = nb.size_z - 1;
+    const uint32_t nr_voxels = nb.size_x * nb.size_y * nb.size_z;
+    const int nr_nb = connectivity <= 6 ? 6 : (connectivity <= 18 ? 18 : 26);
+    uint32_t ix, iy, iz, j;
+
+    // ------------------------------------------------------------------------
+    // First pass: provisional label (order of visit + 1), merged with the
+    // already visited neighbours. The root of a set is its smallest label.
+    std::vector<uint32_t> voi, parent;
+    for (uint32_t i = 0; i != nr_voxels; ++i) {
+        if (*(labels + i) == 0) continue;
+        uint32_t p = voi.size();
+        voi.push_back(i);
+        parent.push_back(p);
+        *(labels + i) = p + 1;
+
+        tie(ix, iy, iz) = ind2sub_3D(i, nb.size_x, nb.size_y);
+        for (int n = 0; n != nr_nb; ++n) {
+            if (nb.offset[n] > 0
+                || (NB26_DX[n] < 0 && ix == 0) || (NB26_DX[n] > 0 && ix >= end_x)
+                || (NB26_DY[n] < 0 && iy == 0) || (NB26_DY[n] > 0 && iy >= end_y)
+                || (NB26_DZ[n] < 0 && iz == 0) || (NB26_DZ[n] > 0 && iz >= end_z)) {
+                continue;
+            }
+            j = i + nb.offset[n];
+            if (*(labels + j) != 0) {
+                uint32_t r1 = find_root(parent, p);
+                uint32_t r2 = find_root(parent, *(labels + j) - 1);
+                if (r1 < r2) {
+                    parent[r2] = r1;
+                } else if (r2 < r1) {
+                    parent[r1] = r2;
+                }
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Second pass: one slot per root, in order of first voxel
+    ConnectedClusters cc;
+    std::vector<uint32_t> slot(voi.size());
+    uint32_t nr_slots = 0;
+    for (uint32_t p = 0; p != voi.size(); ++p) {
+        uint32_t r = find_root(parent, p);
+        if (r == p) {
+            slot[p] = nr_slots++;
+            cc.nr_voxels.push_back(0);
+            cc.last_voxel.push_back(0);
+            cc.min_x.push_back(end_x); cc.min_y.push_back(end_y); cc.min_z.push_back(end_z);
+            cc.max_x.push_back(0); cc.max_y.push_back(0); cc.max_z.push_back(0);
+        }
+        uint32_t k = slot[r];
+        slot[p] = k;
+
+        tie(ix, iy, iz) = ind2sub_3D(voi[p], nb.size_x, nb.size_y);
+        cc.nr_voxels[k] += 1;
+        cc.last_voxel[k] = voi[p];  // Visited in ascending voxel order
+        cc.min_x[k] = std::min(cc.min_x[k], ix);
+        cc.min_y[k] = std::min(cc.min_y[k], iy);
+        cc.min_z[k] = std::min(cc.min_z[k], iz);
+        cc.max_x[k] = std::max(cc.max_x[k], ix);
+        cc.max_y[k] = std::max(cc.max_y[k], iy);
+        cc.max_z[k] = std::max(cc.max_z[k], iz);
+    }
+    cc.nr_clusters = nr_slots;
+
+    // Cluster ids follow descending highest voxel index
+    std::vector<uint32_t> order(nr_slots);
+    for (uint32_t k = 0; k != nr_slots; ++k) {
+        order[k] = k;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return cc.last_voxel[a] > cc.last_voxel[b];
+    });
+    std::vector<uint32_t> cluster_id(nr_slots);
+    for (uint32_t n = 0; n != nr_slots; ++n) {
+        cluster_id[order[n]] = n + 1;
+    }
+    for (uint32_t p = 0; p != voi.size(); ++p) {
+        *(labels + voi[p]) = cluster_id[slot[p]];
+    }
+
+    // Reorder per cluster vectors by cluster id
+    std::vector<uint32_t>* stats[8] = {&cc.nr_voxels, &cc.last_voxel,
+                                       &cc.min_x, &cc.min_y, &cc.min_z,
+                                       &cc.max_x, &cc.max_y, &cc.max_z};
+    std::vector<uint32_t> temp(nr_slots);
+    for (int s = 0; s != 8; ++s) {
+        for (uint32_t n = 0; n != nr_slots; ++n) {
+            temp[n] = (*stats[s])[order[n]];
+        }
+        stats[s]->swap(temp);
+    }
+    return cc;
+}
+
+// ============================================================================
+// Euclidean distance transform
+// ============================================================================
+// Lower envelope of the parabolas f(q) + w * (p - q)^2 along lines of
+// voxels, where f is the squared distance of the previous pass and w the
+// squared voxel size along the axis. The site of the parabola that wins at
+// p carries its nearest feature voxel with it.
+static void distance_transform_pass(double* f, int64_t* nearest,
+                                    const int64_t size, const int64_t stride,
+                                    const int64_t nr_lines,
+                                    const int64_t line_stride_in,
+                                    const int64_t line_stride_out,
+                                    const double w) {
+    #pragma omp parallel
+    {
+        vector<double> line_f(size), line_out(size);
+        vector<int64_t> line_nearest(size), line_out_nearest(size);
+        vector<int64_t> sites(size);     // Sites of the lower envelope
+        vector<double> bounds(size + 1);  // Where each site starts to win
+
+        #pragma omp for
+        for (int64_t l = 0; l < nr_lines; ++l) {
+            // First voxel of line l
+            int64_t start = (l / line_stride_in) * line_stride_out
+                            + l % line_stride_in;
+
+            int64_t k = -1;
+            for (int64_t q = 0; q < size; ++q) {
+                line_f[q] = f[start + q * stride];
+                line_nearest[q] = nearest[start + q * stride];
+                if (line_nearest[q] < 0) continue;
+
+                // Remove sites whose parabola is below the new one everywhere
+                double s = 0;
+                while (k >= 0) {
+                    int64_t r = sites[k];
+                    s = ((line_f[q] + w * q * q) - (line_f[r] + w * r * r))
+                        / (2 * w * (q - r));
+                    if (s > bounds[k]) break;
+                    k -= 1;
+                }
+                k += 1;
+                sites[k] = q;
+                bounds[k] = k == 0 ? -numeric_limits<double>::infinity() : s;
+            }
+
+            if (k < 0) continue;  // No feature reaches this line
+
+            int64_t j = 0;
+            for (int64_t p = 0; p < size; ++p) {
+                while (j < k && bounds[j + 1] < p) j += 1;
+                int64_t q = sites[j];
+                line_out[p] = line_f[q] + w * (p - q) * (p - q);
+                line_out_nearest[p] = line_nearest[q];
+            }
+            for (int64_t p = 0; p < size; ++p) {
+                f[start + p * stride] = line_out[p];
+                nearest[start + p * stride] = line_out_nearest[p];
+            }
+        }
+    }
+}
+
+void distance_transform(const uint8_t* is_feature, const int64_t size_x,
+                        const int64_t size_y, const int64_t size_z,
+                        const float dX, const float dY, const float dZ,
+                        const bool slicewise, float* dist,
+                        int64_t* nearest) {
+    const int64_t nxy = size_x * size_y;
+    const int64_t nr_voxels = nxy * size_z;
+
+    vector<double> f(nr_voxels);
+    for (int64_t i = 0; i < nr_voxels; ++i) {
+        f[i] = is_feature[i] ? 0 : numeric_limits<double>::infinity();
+        nearest[i] = is_feature[i] ? i : -1;
+    }
+
+    // Along x, y and z. Lines of one axis are grouped by the dimensions
+    // before it (line_stride_in) inside blocks of the full axis length.
+    distance_transform_pass(f.data(), nearest, size_x, 1, nxy / size_x * size_z,
+                            1, size_x, dX * dX);
+    distance_transform_pass(f.data(), nearest, size_y, size_x,
+                            size_x * size_z, size_x, nxy, dY * dY);
+    if (!slicewise) {
+        distance_transform_pass(f.data(), nearest, size_z, nxy, nxy, nxy,
+                                nr_voxels, dZ * dZ);
+    }
+
+    for (int64_t i = 0; i < nr_voxels; ++i) {
+        dist[i] = sqrt(f[i]);
+    }
+}
+
+// ============================================================================
+// Grouped statistics
+// ============================================================================
+LabelStats label_stats(const LabelIndex& index, const float* values,
+                       const bool with_median) {
+    const uint32_t nr_labels = index.nr_labels;
+    LabelStats st;
+    st.count.assign(nr_labels, 0);
+    st.mean.assign(nr_labels, 0);
+    st.stdev.assign(nr_labels, 0);
+    st.min.assign(nr_labels, 0);
+    st.max.assign(nr_labels, 0);
+    if (with_median) {
+        st.median.assign(nr_labels, 0);
+    }
+
+    std::vector<double> vec;
+    for (uint32_t l = 0; l != nr_labels; ++l) {
+        const uint32_t* ids = index.ids.data() + index.start[l];
+        const uint32_t n = index.start[l + 1] - index.start[l];
+        st.count[l] = n;
+        if (n == 0) continue;
+
+        // Same summation order as ren_average and ren_stdev
+        double sum = 0, vmin = *(values + ids[0]), vmax = vmin;
+        for (uint32_t k = 0; k != n; ++k) {
+            double v = *(values + ids[k]);
+            sum += v;
+            if (v < vmin) vmin = v;
+            if (v > vmax) vmax = v;
+        }
+        double mean = sum / n;
+        double var = 0;
+        if (n > 1) {
+            for (uint32_t k = 0; k != n; ++k) {
+                double d = *(values + ids[k]) - mean;
+                var += d * d / ((double)n - 1);
+            }
+        }
+        st.mean[l] = mean;
+        st.stdev[l] = sqrt(var);
+        st.min[l] = vmin;
+        st.max[l] = vmax;
+
+        if (with_median) {
+            vec.resize(n);
+            for (uint32_t k = 0; k != n; ++k) {
+                vec[k] = *(values + ids[k]);
+            }
+            std::nth_element(vec.begin(), vec.begin() + n / 2, vec.end());
+            double med = vec[n / 2];
+            if (n % 2 == 0) {
+                med = (med + *std::max_element(vec.begin(), vec.begin() + n / 2)) / 2;
+            }
+            st.median[l] = med;
+        }
+    }
+    return st;
+}
+
+// ============================================================================
+// Incremental farthest point sampling
+// ============================================================================
+FarthestPoints farthest_points(const int32_t* voi_id, const uint32_t nr_voi,
+                               float* dist, int32_t* step) {
+    FarthestPoints fp;
+    fp.dist = dist;
+    fp.step = step;
+    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+        *(dist + *(voi_id + ii)) = std::numeric_limits<float>::infinity();
+        if (step != NULL) *(step + *(voi_id + ii)) = 0;
+    }
+    return fp;
+}
+
+bool farthest_points_next(FarthestPoints& fp, uint32_t* voxel) {
+    // Entries whose distance was lowered by a later seed are stale
+    while (!fp.farthest.empty()
+           && fp.farthest.top().first != *(fp.dist + fp.farthest.top().second)) {
+        fp.farthest.pop();
+    }
+    if (fp.farthest.empty() || fp.farthest.top().first == 0) {
+        return false;
+    }
+    *voxel = fp.farthest.top().second;
+    return true;
+}
+
+// ============================================================================
+// UVD cylinder queries
+// ============================================================================
+GridUVD grid_uvd(const std::vector<float>& u, const std::vector<float>& v,
+                 const std::vector<float>& d, const float radius,
+                 const float height) {
+    // NOTE: Points with non-finite coordinates are left out. They can never
+    // pass the cylinder checks anyway.
+    const uint32_t nr_points = u.size();
+    GridUVD grid;
+
+    bool is_first = true;
+    double max_u = 0, max_v = 0, max_d = 0;
+    grid.min_u = 0, grid.min_v = 0, grid.min_d = 0;
+    for (uint32_t i = 0; i != nr_points; ++i) {
+        if (!isfinite(u[i]) || !isfinite(v[i]) || !isfinite(d[i])) continue;
+        if (is_first) {
+            grid.min_u = max_u = u[i];
+            grid.min_v = max_v = v[i];
+            grid.min_d = max_d = d[i];
+            is_first = false;
+        }
+        grid.min_u = min(grid.min_u, static_cast<double>(u[i]));
+        grid.min_v = min(grid.min_v, static_cast<double>(v[i]));
+        grid.min_d = min(grid.min_d, static_cast<double>(d[i]));
+        max_u = max(max_u, static_cast<double>(u[i]));
+        max_v = max(max_v, static_cast<double>(v[i]));
+        max_d = max(max_d, static_cast<double>(d[i]));
+    }
+
+    // Small margin so that float rounding in the cylinder checks can never
+    // accept a point that is two bins away
+    const double margin = 1.001;
+    grid.bin_uv = abs(radius) * margin;
+    grid.bin_d = abs(height / 2) * margin;
+    if (!(grid.bin_uv > 0)) grid.bin_uv = 1;
+    if (!(grid.bin_d > 0)) grid.bin_d = 1;
+
+    // Wider bins are always correct, use them to bound the grid size
+    const int64_t max_bins = 2 * static_cast<int64_t>(nr_points) + 1024;
+    while (true) {
+        grid.size_u = static_cast<int64_t>((max_u - grid.min_u) / grid.bin_uv) + 1;
+        grid.size_v = static_cast<int64_t>((max_v - grid.min_v) / grid.bin_uv) + 1;
+        grid.size_d = static_cast<int64_t>((max_d - grid.min_d) / grid.bin_d) + 1;
+        if (grid.size_u * grid.size_v * grid.size_d <= max_bins) break;
+        if (grid.size_d > max(grid.size_u, grid.size_v)) {
+            grid.bin_d *= 2;
+        } else {
+            grid.bin_uv *= 2;
+        }
+    }
+
+    // Count points per bin, then fill bins in ascending point order
+    const int64_t nr_bins = grid.size_u * grid.size_v * grid.size_d;
+    vector<int64_t> point_bin(nr_points, -1);
+    grid.bin_start.assign(nr_bins + 1, 0);
+    for (uint32_t i = 0; i != nr_points; ++i) {
+        if (!isfinite(u[i]) || !isfinite(v[i]) || !isfinite(d[i])) continue;
+        int64_t bu = min(static_cast<int64_t>((u[i] - grid.min_u) / grid.bin_uv), grid.size_u - 1);
+        int64_t bv = min(static_cast<int64_t>((v[i] - grid.min_v) / grid.bin_uv), grid.size_v - 1);
+        int64_t bd = min(static_cast<int64_t>((d[i] - grid.min_d) / grid.bin_d), grid.size_d - 1);
+        point_bin[i] = bu + grid.size_u * (bv + grid.size_v * bd);
+        grid.bin_start[point_bin[i] + 1] += 1;
+    }
+    for (int64_t b = 0; b != nr_bins; ++b) {
+        grid.bin_start[b + 1] += grid.bin_start[b];
+    }
+    grid.bin_ids.resize(grid.bin_start[nr_bins]);
+    vector<uint32_t> bin_fill(grid.bin_start.begin(), grid.bin_start.end() - 1);
+    for (uint32_t i = 0; i != nr_points; ++i) {
+        if (point_bin[i] >= 0) {
+            grid.bin_ids[bin_fill[point_bin[i]]++] = i;
+        }
+    }
+    return grid;
+}
+
+void query_cylinder_uvd(const GridUVD& grid, const std::vector<float>& u,
+                        const std::vector<float>& v,
+                        const std::vector<float>& d, const uint32_t i,
+                        const float radius, const float height,
+                        std::vector<uint32_t>& found) {
+    // Fills found with the indices (ascending) of all points within the
+    // cylinder centered at point i, including i itself.
+    found.clear();
+    const float half_height = height / 2;
+    const float radius_sqr = radius * radius;
+    if (!isfinite(u[i]) || !isfinite(v[i]) || !isfinite(d[i])) return;
+
+    const int64_t bu = static_cast<int64_t>((u[i] - grid.min_u) / grid.bin_uv);
+    const int64_t bv = static_cast<int64_t>((v[i] - grid.min_v) / grid.bin_uv);
+    const int64_t bd = static_cast<int64_t>((d[i] - grid.min_d) / grid.bin_d);
+
+    for (int64_t kd = max(bd - 1, (int64_t)0); kd <= min(bd + 1, grid.size_d - 1); ++kd) {
+        for (int64_t kv = max(bv - 1, (int64_t)0); kv <= min(bv + 1, grid.size_v - 1); ++kv) {
+            for (int64_t ku = max(bu - 1, (int64_t)0); ku <= min(bu + 1, grid.size_u - 1); ++ku) {
+                int64_t b = ku + grid.size_u * (kv + grid.size_v * kd);
+                for (uint32_t k = grid.bin_start[b]; k != grid.bin_start[b + 1]; ++k) {
+                    uint32_t j = grid.bin_ids[k];
+                    if (abs(d[i] - d[j]) < half_height) {  // Check height
+                        float dist_uv = (u[i] - u[j])*(u[i] - u[j])
+                            + (v[i] - v[j])*(v[i] - v[j]);
+                        if (dist_uv < radius_sqr) {  // Check Euclidean distance
+                            found.push_back(j);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::sort(found.begin(), found.end());
+}
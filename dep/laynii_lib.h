@@ -6,7 +6,19 @@
 #include <iostream>
 #include <string>
 #include <tuple>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <queue>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <type_traits>
 #include "./nifti2_io.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -30,14 +42,33 @@ void log_welcome(const char* programname);
 void log_output(const char* filename);
 void log_nifti_descriptives(nifti_image* nii);
 
+void set_nr_threads(int nr_threads);
+bool is_main_thread(void);
+
+string output_path_txt(const string path, const string tag);
 void save_output_nifti(string filename, string prefix, nifti_image* nii,
                        bool log = true, bool use_outpath = false);
+znzFile open_output_nifti(string filename, string prefix, nifti_image* nii,
+                          bool log = true, bool use_outpath = false);
+void write_output_volume(znzFile fp, const float* data, int64_t nr_voxels);
+void close_output_nifti(znzFile fp);
 
-nifti_image* copy_nifti_as_double(nifti_image* nii);
-nifti_image* copy_nifti_as_float32(nifti_image* nii);
+// scale = true applies scl_slope/scl_inter to the values (and resets them)
+nifti_image* copy_nifti_as_double(nifti_image* nii, bool scale = false);
+nifti_image* copy_nifti_as_float32(nifti_image* nii, bool scale = false);
 nifti_image* copy_nifti_as_float16(nifti_image* nii);
-nifti_image* copy_nifti_as_int32(nifti_image* nii);
-nifti_image* copy_nifti_as_int16(nifti_image* nii);
+nifti_image* copy_nifti_as_int32(nifti_image* nii, bool scale = false);
+nifti_image* copy_nifti_as_int16(nifti_image* nii, bool scale = false);
+void convert_nifti_to_float32(nifti_image* nii);
+void convert_nifti_to_int32(nifti_image* nii);
+void copy_volume_as_float32(nifti_image* nii, int64_t t, float* out);
+
+// Voxel-major (time series contiguous) layout for 4D data, see
+// "Voxel-major layout" in laynii_lib.cpp
+void copy_voxels_as_float32(nifti_image* nii, int64_t start, int64_t count,
+                            float* out);
+void transpose_blocked(const float* in, float* out, int64_t nr_rows,
+                       int64_t nr_cols);
 
 std::tuple<uint32_t, uint32_t, uint32_t> ind2sub_3D(
     const uint32_t linear_index, const uint32_t size_x, const uint32_t size_y);
@@ -51,6 +82,765 @@ std::tuple<float, float> simplex_perturb_2D(float x, float y, float a, float b);
 nifti_image* iterative_smoothing(nifti_image* nii_in, int iter_smooth,
                                  nifti_image* nii_mask, int32_t mask_value);
 
+// ============================================================================
+// Geodesic propagation
+// ============================================================================
+// NOTE: Neighbours are listed in the same order as the hand-unrolled
+// 1-jump, 2-jump and 3-jump visits in LN2 programs. Keep it this way, ties
+// between equal distances are resolved by this order.
+const int8_t NB26_DX[26] = {-1, 1,  0, 0,  0, 0,
+                            -1, -1, 1, 1,  0, 0,  0, 0, -1, 1, -1, 1,
+                            -1, -1, -1, 1, -1, 1, 1, 1};
+const int8_t NB26_DY[26] = { 0, 0, -1, 1,  0, 0,
+                            -1, 1, -1, 1, -1, -1, 1, 1,  0, 0,  0, 0,
+                            -1, -1, 1, -1, 1, -1, 1, 1};
+const int8_t NB26_DZ[26] = { 0, 0,  0, 0, -1, 1,
+                             0, 0,  0, 0, -1, 1, -1, 1, -1, -1, 1, 1,
+                            -1, 1, -1, -1, 1, 1, -1, 1};
+
+// Precomputed linear index offsets and distances of the 26 neighbours
+struct Neighbours26 {
+    uint32_t size_x, size_y, size_z;
+    int64_t offset[26];
+    float dist[26];
+};
+
+Neighbours26 neighbours_26(const uint32_t size_x, const uint32_t size_y,
+                           const uint32_t size_z, const float dX,
+                           const float dY, const float dZ);
+
+// Default for floods that never stop at diagonal jumps
+struct NoJumpLock {
+    bool operator()(uint32_t) const { return false; }
+};
+
+template <typename T_step, typename T_id, typename F_domain, typename F_lock>
+uint32_t flood_geodesic_26(const Neighbours26& nb,
+                           std::vector<uint32_t>& frontier,
+                           F_domain in_domain, F_lock is_lock,
+                           float* flood_dist, T_step* flood_step,
+                           T_id* flood_id, int32_t* flood_prev,
+                           uint32_t* last_voxel) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Active-frontier version of the step-sweep flood fill.
+    // - frontier: voxel ids with a non-zero flood_step, in ascending order.
+    //   Each voxel enters the flood at the step it is labeled with.
+    // - in_domain(j): true when voxel j is allowed to be reached.
+    // - is_lock(j): true when a face neighbour j outside of the domain should
+    //   stop the diagonal (2-jump and 3-jump) visits of the current voxel.
+    // - flood_id, flood_prev, last_voxel: optional (can be NULL). Carry the
+    //   seed label, the voxel id of the previous step and the last updated
+    //   voxel.
+    //
+    // Instead of rescanning all voxels of interest for flood_step == step at
+    // every step, only the voxels updated in the previous step are visited.
+    // Each step is visited in ascending voxel order, which reproduces the
+    // outputs of the full rescan exactly. Returns the number of grow steps.
+    ///////////////////////////////////////////////////////////////////////////
+    const uint32_t end_x = nb.size_x - 1;
+    const uint32_t end_y = nb.size_y - 1;
+    const uint32_t end_z = nb.size_z - 1;
+
+    // Voxels that join the flood at later steps, sorted by (step, id)
+    std::vector<std::pair<T_step, uint32_t> > pending;
+    pending.reserve(frontier.size());
+    for (size_t ii = 0; ii != frontier.size(); ++ii) {
+        pending.push_back(std::make_pair(*(flood_step + frontier[ii]),
+                                         frontier[ii]));
+    }
+    std::stable_sort(pending.begin(), pending.end());
+    size_t p = 0;
+
+    std::vector<uint32_t> current, joining;
+    frontier.clear();
+    uint32_t grow_step = 1;
+    uint32_t ix, iy, iz, i, j;
+    float d;
+
+    while (true) {
+        // Merge the voxels updated in the previous step with the joining ones
+        joining.clear();
+        while (p != pending.size()
+               && pending[p].first <= static_cast<T_step>(grow_step)) {
+            if (pending[p].first == static_cast<T_step>(grow_step)) {
+                joining.push_back(pending[p].second);
+            }
+            ++p;
+        }
+        current.clear();
+        std::set_union(frontier.begin(), frontier.end(),
+                       joining.begin(), joining.end(),
+                       std::back_inserter(current));
+        frontier.clear();
+
+        uint32_t voxel_counter = 0;
+        for (size_t ii = 0; ii != current.size(); ++ii) {
+            i = current[ii];
+            // Skip voxels that were updated again before their turn
+            if (*(flood_step + i) != static_cast<T_step>(grow_step)) continue;
+            voxel_counter += 1;
+
+            tie(ix, iy, iz) = ind2sub_3D(i, nb.size_x, nb.size_y);
+            bool is_inside = ix > 0 && ix < end_x && iy > 0 && iy < end_y
+                             && iz > 0 && iz < end_z;
+            bool jump_lock = false;
+
+            for (int n = 0; n != 26; ++n) {
+                if (n == 6 && jump_lock) break;
+                // Bounds are only checked for voxels at the volume border
+                if (!is_inside
+                    && ((NB26_DX[n] < 0 && ix == 0) || (NB26_DX[n] > 0 && ix >= end_x)
+                        || (NB26_DY[n] < 0 && iy == 0) || (NB26_DY[n] > 0 && iy >= end_y)
+                        || (NB26_DZ[n] < 0 && iz == 0) || (NB26_DZ[n] > 0 && iz >= end_z))) {
+                    continue;
+                }
+                j = i + nb.offset[n];
+                if (in_domain(j)) {
+                    d = *(flood_dist + i) + nb.dist[n];
+                    if (d < *(flood_dist + j) || *(flood_dist + j) == 0) {
+                        if (*(flood_step + j) != static_cast<T_step>(grow_step + 1)) {
+                            frontier.push_back(j);
+                        }
+                        *(flood_dist + j) = d;
+                        *(flood_step + j) = grow_step + 1;
+                        if (flood_id != NULL) {
+                            *(flood_id + j) = *(flood_id + i);
+                        }
+                        if (flood_prev != NULL) {
+                            *(flood_prev + j) = i;
+                        }
+                        if (last_voxel != NULL) {
+                            *last_voxel = j;
+                        }
+                    }
+                } else if (n < 6 && is_lock(j)) {
+                    jump_lock = true;
+                }
+            }
+        }
+        if (voxel_counter == 0) break;
+        std::sort(frontier.begin(), frontier.end());
+        grow_step += 1;
+    }
+    return grow_step - 1;
+}
+
+template <typename T_step, typename F_domain>
+uint32_t flood_geodesic_26(const Neighbours26& nb,
+                           std::vector<uint32_t>& frontier,
+                           F_domain in_domain, float* flood_dist,
+                           T_step* flood_step) {
+    return flood_geodesic_26(nb, frontier, in_domain, NoJumpLock(),
+                             flood_dist, flood_step,
+                             static_cast<int32_t*>(NULL),
+                             static_cast<int32_t*>(NULL),
+                             static_cast<uint32_t*>(NULL));
+}
+
+// Flood of up to 4 channels (c0 to c0 + nr_lanes - 1) in a single traversal,
+// see flood_geodesic_26_channels.
+template <typename T_id, typename F_domain, typename F_lock>
+void flood_geodesic_26_lanes(const Neighbours26& nb,
+                             std::vector<std::vector<uint32_t> >& frontiers,
+                             const int c0, const int nr_lanes,
+                             F_domain in_domain, F_lock is_lock,
+                             float* flood_dist, T_id* flood_id) {
+    const int64_t nr_voxels = static_cast<int64_t>(nb.size_x) * nb.size_y
+                              * nb.size_z;
+    const uint32_t end_x = nb.size_x - 1;
+    const uint32_t end_y = nb.size_y - 1;
+    const uint32_t end_z = nb.size_z - 1;
+
+    // Channels of a voxel at the current step (low 4 bits, one per channel)
+    // and at the next step (high 4 bits)
+    std::vector<uint8_t> lane_state(nr_voxels, 0);
+    uint8_t* state = lane_state.data();
+    std::vector<uint32_t> current, next;
+    uint32_t reach_id[26];
+    float reach_dist[26];
+    uint32_t ix, iy, iz, i, j;
+    float d;
+
+    float* lane_dist[4];
+    T_id* lane_id[4];
+    for (int c = 0; c != nr_lanes; ++c) {
+        lane_dist[c] = flood_dist + nr_voxels * (c0 + c);
+        lane_id[c] = flood_id != NULL ? flood_id + nr_voxels * (c0 + c)
+                                      : NULL;
+        std::vector<uint32_t>& frontier = frontiers[c0 + c];
+        for (size_t ii = 0; ii != frontier.size(); ++ii) {
+            if (*(state + frontier[ii]) == 0) {
+                current.push_back(frontier[ii]);
+            }
+            *(state + frontier[ii]) |= 1 << c;
+        }
+        frontier.clear();
+    }
+    std::sort(current.begin(), current.end());
+
+    while (!current.empty()) {
+        next.clear();
+        for (size_t ii = 0; ii != current.size(); ++ii) {
+            i = current[ii];
+            // Channels that updated this voxel again before its turn
+            // have already moved it to the next step
+            const uint8_t lanes_i = *(state + i) & 0x0F;
+            if (lanes_i == 0) continue;
+            *(state + i) &= 0xF0;
+
+            // Neighbours that can be reached, shared by all channels
+            tie(ix, iy, iz) = ind2sub_3D(i, nb.size_x, nb.size_y);
+            bool is_inside = ix > 0 && ix < end_x && iy > 0 && iy < end_y
+                             && iz > 0 && iz < end_z;
+            bool jump_lock = false;
+            int nr_reach = 0;
+            for (int n = 0; n != 26; ++n) {
+                if (n == 6 && jump_lock) break;
+                if (!is_inside
+                    && ((NB26_DX[n] < 0 && ix == 0) || (NB26_DX[n] > 0 && ix >= end_x)
+                        || (NB26_DY[n] < 0 && iy == 0) || (NB26_DY[n] > 0 && iy >= end_y)
+                        || (NB26_DZ[n] < 0 && iz == 0) || (NB26_DZ[n] > 0 && iz >= end_z))) {
+                    continue;
+                }
+                j = i + nb.offset[n];
+                if (in_domain(j)) {
+                    reach_id[nr_reach] = j;
+                    reach_dist[nr_reach] = nb.dist[n];
+                    nr_reach += 1;
+                } else if (n < 6 && is_lock(j)) {
+                    jump_lock = true;
+                }
+            }
+
+            for (int c = 0; c != nr_lanes; ++c) {
+                if (!(lanes_i & (1 << c))) continue;
+                float* dist_c = lane_dist[c];
+                T_id* id_c = lane_id[c];
+                const float dist_i = *(dist_c + i);
+                for (int k = 0; k != nr_reach; ++k) {
+                    j = reach_id[k];
+                    d = dist_i + reach_dist[k];
+                    if (d < *(dist_c + j) || *(dist_c + j) == 0) {
+                        uint8_t state_j = *(state + j);
+                        if (state_j < 0x10) {
+                            next.push_back(j);
+                        }
+                        state_j &= ~(1 << c);
+                        state_j |= 0x10 << c;
+                        *(state + j) = state_j;
+                        *(dist_c + j) = d;
+                        if (id_c != NULL) {
+                            *(id_c + j) = *(id_c + i);
+                        }
+                    }
+                }
+            }
+        }
+        std::sort(next.begin(), next.end());
+        for (size_t ii = 0; ii != next.size(); ++ii) {
+            *(state + next[ii]) >>= 4;
+        }
+        current.swap(next);
+    }
+}
+
+// Several independent floods over the same domain, e.g. distances from
+// different control points. Every channel has its own frontier (seed voxels,
+// which start at step 1 with their flood_dist and flood_id already set) and
+// its own planes of flood_dist and flood_id (optional, can be NULL), stored
+// one after the other like the volumes of a 4D nifti. Each channel gives
+// exactly the outputs of its own flood_geodesic_26 call.
+//
+// NOTE: Channels are split into groups of up to 4, as few groups as there are
+// threads. Groups are flooded concurrently. The channels of a group share one
+// frontier: every voxel on it is visited once per step, and its bounds,
+// domain and jump lock checks are done once for all channels that reached it
+// at this step. Instead of a step plane per channel, one byte per voxel and
+// group tells which channels are at the current and at the next step.
+template <typename T_id, typename F_domain, typename F_lock>
+void flood_geodesic_26_channels(const Neighbours26& nb,
+                                std::vector<std::vector<uint32_t> >& frontiers,
+                                F_domain in_domain, F_lock is_lock,
+                                float* flood_dist, T_id* flood_id) {
+    const int nr_channels = frontiers.size();
+    int nr_threads = 1;
+#ifdef _OPENMP
+    nr_threads = omp_get_max_threads();
+#endif
+    if (nr_channels == 0) return;
+
+    // Channels per group, at most 4
+    int nr_groups = std::min(nr_channels, std::max(nr_threads, 1));
+    const int nr_lanes = std::min(4, (nr_channels + nr_groups - 1) / nr_groups);
+    nr_groups = (nr_channels + nr_lanes - 1) / nr_lanes;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int g = 0; g < nr_groups; ++g) {
+        const int c0 = g * nr_lanes;
+        flood_geodesic_26_lanes(nb, frontiers, c0,
+                                std::min(nr_lanes, nr_channels - c0),
+                                in_domain, is_lock, flood_dist, flood_id);
+    }
+}
+
+template <typename F_domain>
+void flood_geodesic_26_channels(const Neighbours26& nb,
+                                std::vector<std::vector<uint32_t> >& frontiers,
+                                F_domain in_domain, float* flood_dist) {
+    flood_geodesic_26_channels(nb, frontiers, in_domain, NoJumpLock(),
+                               flood_dist, static_cast<int32_t*>(NULL));
+}
+
+// ============================================================================
+// Local connected patches
+// ============================================================================
+// Voxels that are connected to a center voxel through a path that stays in a
+// box of +-radius voxels around the center. Reached voxels are stamped with
+// the epoch of the search, so nothing is cleared between searches and the
+// cost only depends on the size of the patch instead of the box.
+struct LocalPatch {
+    std::vector<uint32_t> stamp;  // Epoch of the last search reaching a voxel
+    std::vector<uint32_t> sweep;  // Sweep in which a reached voxel grows
+    uint32_t epoch;
+    std::vector<uint32_t> voxels;  // Voxels of the last patch
+};
+
+inline LocalPatch local_patch(const int64_t nr_voxels) {
+    LocalPatch lp;
+    lp.stamp.assign(nr_voxels, 0);
+    lp.sweep.assign(nr_voxels, 0);
+    lp.epoch = 0;
+    return lp;
+}
+
+inline bool in_local_patch(const LocalPatch& lp, const uint32_t i) {
+    return lp.stamp[i] == lp.epoch;
+}
+
+// - nr_neighbours: 6 (faces) or 26 (faces, edges and corners).
+// - in_domain(j): true when voxel j can join the patch. The center always
+//   joins.
+// - nr_sweeps: 0 for every connected voxel in the box. Otherwise the patch
+//   is the one of growing with that many in-place sweeps over the box in
+//   ascending voxel order: a step to a higher voxel index is taken in the
+//   same sweep, a step back has to wait for the next one. This is searched
+//   as a 0-1 breadth-first search over the number of sweeps.
+template <typename F_domain>
+void local_patch_grow(LocalPatch& lp, const Neighbours26& nb,
+                      const uint32_t center, const int radius,
+                      const int nr_neighbours, F_domain in_domain,
+                      const uint32_t nr_sweeps = 0) {
+    if (lp.epoch == std::numeric_limits<uint32_t>::max()) {
+        std::fill(lp.stamp.begin(), lp.stamp.end(), 0);
+        lp.epoch = 0;
+    }
+    lp.epoch += 1;
+    lp.voxels.clear();
+
+    uint32_t cx, cy, cz;
+    tie(cx, cy, cz) = ind2sub_3D(center, nb.size_x, nb.size_y);
+    const int64_t min_x = max(static_cast<int64_t>(cx) - radius, static_cast<int64_t>(0));
+    const int64_t min_y = max(static_cast<int64_t>(cy) - radius, static_cast<int64_t>(0));
+    const int64_t min_z = max(static_cast<int64_t>(cz) - radius, static_cast<int64_t>(0));
+    const int64_t max_x = min(static_cast<int64_t>(cx) + radius, static_cast<int64_t>(nb.size_x) - 1);
+    const int64_t max_y = min(static_cast<int64_t>(cy) + radius, static_cast<int64_t>(nb.size_y) - 1);
+    const int64_t max_z = min(static_cast<int64_t>(cz) + radius, static_cast<int64_t>(nb.size_z) - 1);
+
+    lp.stamp[center] = lp.epoch;
+    lp.sweep[center] = 0;
+    lp.voxels.push_back(center);
+
+    std::deque<uint32_t> queue(1, center);
+    uint32_t ix, iy, iz;
+    while (!queue.empty()) {
+        uint32_t i = queue.front();
+        queue.pop_front();
+        uint32_t sweep_i = lp.sweep[i];
+        // Reached in the last sweep, too late to grow any further
+        if (nr_sweeps > 0 && sweep_i >= nr_sweeps) continue;
+
+        tie(ix, iy, iz) = ind2sub_3D(i, nb.size_x, nb.size_y);
+        for (int n = 0; n != nr_neighbours; ++n) {
+            int64_t jx = static_cast<int64_t>(ix) + NB26_DX[n];
+            int64_t jy = static_cast<int64_t>(iy) + NB26_DY[n];
+            int64_t jz = static_cast<int64_t>(iz) + NB26_DZ[n];
+            if (jx < min_x || jx > max_x || jy < min_y || jy > max_y
+                || jz < min_z || jz > max_z) {
+                continue;
+            }
+            uint32_t j = i + nb.offset[n];
+            bool is_back = nr_sweeps > 0 && j < i;
+            uint32_t sweep_j = sweep_i + (is_back ? 1 : 0);
+            if (lp.stamp[j] != lp.epoch) {
+                if (!in_domain(j)) continue;
+                lp.stamp[j] = lp.epoch;
+                lp.voxels.push_back(j);
+            } else if (lp.sweep[j] <= sweep_j) {
+                continue;
+            }
+            lp.sweep[j] = sweep_j;
+            if (is_back) {
+                queue.push_back(j);
+            } else {
+                queue.push_front(j);
+            }
+        }
+    }
+}
+
+// ============================================================================
+// Connected clusters
+// ============================================================================
+// Two-pass union-find labeling. Each voxel is merged with the neighbours
+// that were already visited (in the 6, 18 or 26 neighbourhood), then the
+// union-find roots are relabeled into consecutive cluster ids. Cluster ids
+// are ordered by descending highest voxel index, like the iterative flood
+// it replaces. Per cluster vectors are indexed with (cluster id - 1).
+struct ConnectedClusters {
+    uint32_t nr_clusters;
+    std::vector<uint32_t> nr_voxels;
+    std::vector<uint32_t> last_voxel;  // Highest voxel index in the cluster
+    std::vector<uint32_t> min_x, min_y, min_z;  // Bounding boxes
+    std::vector<uint32_t> max_x, max_y, max_z;
+};
+
+// - labels: input non-zero voxels are clustered, output is the cluster id.
+ConnectedClusters connected_clusters(const Neighbours26& nb,
+                                     const int connectivity, int32_t* labels);
+
+// ============================================================================
+// Euclidean distance transform
+// ============================================================================
+// Exact distance of every voxel to its nearest feature voxel, together with
+// the linear index of that feature voxel (feature transform). One pass per
+// axis takes the lower envelope of the parabolas of a line of voxels
+// (Felzenszwalb and Huttenlocher, 2012), so the cost is linear in the number
+// of voxels. Lines of a pass are processed in parallel.
+// - slicewise: only x and y, every slice on its own.
+// - dist: distance in units of dX, dY, dZ. Infinity without any feature.
+// - nearest: index of the nearest feature voxel. -1 without any feature.
+void distance_transform(const uint8_t* is_feature, const int64_t size_x,
+                        const int64_t size_y, const int64_t size_z,
+                        const float dX, const float dY, const float dZ,
+                        const bool slicewise, float* dist, int64_t* nearest);
+
+// ============================================================================
+// Grouped statistics
+// ============================================================================
+// Voxels grouped by an integer label (e.g. layer, column or layer x column)
+// in compressed sparse row form: the voxels of label l (1 to nr_labels) are
+// ids[start[l-1]] to ids[start[l] - 1], in ascending voxel order. Built with
+// one counting pass and one filling pass, after which any per label loop
+// only visits the voxels of that label.
+struct LabelIndex {
+    uint32_t nr_labels;
+    std::vector<uint32_t> start;  // nr_labels + 1 offsets into ids
+    std::vector<uint32_t> ids;
+};
+
+// - label(i): label of voxel i. Values outside 1 to nr_labels are ignored.
+template <typename F_label>
+LabelIndex label_index(const uint32_t nr_voxels, const uint32_t nr_labels,
+                       F_label label) {
+    LabelIndex index;
+    index.nr_labels = nr_labels;
+    index.start.assign(nr_labels + 1, 0);
+    for (uint32_t i = 0; i != nr_voxels; ++i) {
+        int64_t l = label(i);
+        if (l > 0 && l <= nr_labels) {
+            index.start[l] += 1;
+        }
+    }
+    for (uint32_t l = 0; l != nr_labels; ++l) {
+        index.start[l + 1] += index.start[l];
+    }
+    index.ids.resize(index.start[nr_labels]);
+    std::vector<uint32_t> fill(index.start.begin(), index.start.end() - 1);
+    for (uint32_t i = 0; i != nr_voxels; ++i) {
+        int64_t l = label(i);
+        if (l > 0 && l <= nr_labels) {
+            index.ids[fill[l - 1]++] = i;
+        }
+    }
+    return index;
+}
+
+// Per label statistics, indexed with (label - 1). Labels without voxels
+// have zero for every statistic.
+struct LabelStats {
+    std::vector<uint32_t> count;
+    std::vector<double> mean, stdev, min, max;
+    std::vector<double> median;  // Only filled when asked for
+};
+
+LabelStats label_stats(const LabelIndex& index, const float* values,
+                       const bool with_median = false);
+
+// Sorted distinct positive keys of the voxels, for groups with a large but
+// sparsely occupied key range (e.g. layer x column pairs). Keys are collected
+// in a hash set, so memory and time scale with the occupied groups instead
+// of the range or the number of voxels. Only the distinct keys are sorted.
+// - key(i): key of voxel i. Values below 1 are ignored.
+template <typename F_key>
+std::vector<int64_t> sparse_keys(const uint32_t nr_voxels, F_key key) {
+    std::unordered_set<int64_t> seen;
+    for (uint32_t i = 0; i != nr_voxels; ++i) {
+        int64_t k = key(i);
+        if (k > 0) {
+            seen.insert(k);
+        }
+    }
+    std::vector<int64_t> keys(seen.begin(), seen.end());
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+// Compact label (1 to keys.size()) of every key of sparse_keys, so that each
+// voxel is labeled with a single lookup of its own key.
+inline std::unordered_map<int64_t, uint32_t> sparse_labels(
+    const std::vector<int64_t>& keys) {
+    std::unordered_map<int64_t, uint32_t> labels(keys.size());
+    for (uint32_t g = 0; g != keys.size(); ++g) {
+        labels[keys[g]] = g + 1;
+    }
+    return labels;
+}
+
+// ============================================================================
+// Running moments of time series
+// ============================================================================
+// Central moments of every voxel's time series in a single pass (Welford,
+// with the Terriberry update for the 3rd and 4th moments). Volumes are added
+// one at a time and the arrays are voxel-contiguous, so that the update
+// loops vectorize over voxels. T_acc is float or double.
+// - m2, m3, m4: sums of (x - mean)^k over the volumes added so far.
+template <typename T_acc>
+struct RunningMoments {
+    int64_t nr_voxels;
+    int64_t n;     // Number of volumes added
+    bool higher;   // Also keep m3 and m4
+    std::vector<T_acc> mean, m2, m3, m4;
+};
+
+template <typename T_acc>
+RunningMoments<T_acc> running_moments(const int64_t nr_voxels,
+                                      const bool higher = true) {
+    RunningMoments<T_acc> rm;
+    rm.nr_voxels = nr_voxels;
+    rm.n = 0;
+    rm.higher = higher;
+    rm.mean.assign(nr_voxels, 0);
+    rm.m2.assign(nr_voxels, 0);
+    if (higher) {
+        rm.m3.assign(nr_voxels, 0);
+        rm.m4.assign(nr_voxels, 0);
+    }
+    return rm;
+}
+
+template <typename T_acc>
+void running_moments_add(RunningMoments<T_acc>& rm, const float* vol) {
+    rm.n += 1;
+    const T_acc n = static_cast<T_acc>(rm.n);
+    const T_acc inv_n = 1 / n;
+    const T_acc n1 = n - 1;
+    const T_acc c3 = n - 2;
+    const T_acc c4 = n * n - 3 * n + 3;
+    const int64_t nr_voxels = rm.nr_voxels;
+    T_acc* mean = rm.mean.data();
+    T_acc* m2 = rm.m2.data();
+
+    if (rm.higher) {
+        T_acc* m3 = rm.m3.data();
+        T_acc* m4 = rm.m4.data();
+        #pragma omp parallel for simd
+        for (int64_t i = 0; i < nr_voxels; ++i) {
+            T_acc delta = static_cast<T_acc>(*(vol + i)) - mean[i];
+            T_acc dn = delta * inv_n;
+            T_acc dn2 = dn * dn;
+            T_acc term1 = delta * dn * n1;
+            mean[i] += dn;
+            m4[i] += term1 * dn2 * c4 + 6 * dn2 * m2[i] - 4 * dn * m3[i];
+            m3[i] += term1 * dn * c3 - 3 * dn * m2[i];
+            m2[i] += term1;
+        }
+    } else {
+        #pragma omp parallel for simd
+        for (int64_t i = 0; i < nr_voxels; ++i) {
+            T_acc delta = static_cast<T_acc>(*(vol + i)) - mean[i];
+            T_acc dn = delta * inv_n;
+            mean[i] += dn;
+            m2[i] += delta * dn * n1;
+        }
+    }
+}
+
+// Means, second moments and co-moment of two voxel-wise time series (e.g.
+// for correlations), also in a single pass.
+template <typename T_acc>
+struct RunningComoments {
+    int64_t nr_voxels;
+    int64_t n;
+    std::vector<T_acc> mean_x, mean_y, m2_x, m2_y, c_xy;
+};
+
+template <typename T_acc>
+RunningComoments<T_acc> running_comoments(const int64_t nr_voxels) {
+    RunningComoments<T_acc> rc;
+    rc.nr_voxels = nr_voxels;
+    rc.n = 0;
+    rc.mean_x.assign(nr_voxels, 0);
+    rc.mean_y.assign(nr_voxels, 0);
+    rc.m2_x.assign(nr_voxels, 0);
+    rc.m2_y.assign(nr_voxels, 0);
+    rc.c_xy.assign(nr_voxels, 0);
+    return rc;
+}
+
+template <typename T_acc>
+void running_comoments_add(RunningComoments<T_acc>& rc, const float* vol_x,
+                           const float* vol_y) {
+    rc.n += 1;
+    const T_acc inv_n = 1 / static_cast<T_acc>(rc.n);
+    const int64_t nr_voxels = rc.nr_voxels;
+    T_acc* mean_x = rc.mean_x.data();
+    T_acc* mean_y = rc.mean_y.data();
+    T_acc* m2_x = rc.m2_x.data();
+    T_acc* m2_y = rc.m2_y.data();
+    T_acc* c_xy = rc.c_xy.data();
+
+    #pragma omp parallel for simd
+    for (int64_t i = 0; i < nr_voxels; ++i) {
+        T_acc dx = static_cast<T_acc>(*(vol_x + i)) - mean_x[i];
+        T_acc dy = static_cast<T_acc>(*(vol_y + i)) - mean_y[i];
+        mean_x[i] += dx * inv_n;
+        mean_y[i] += dy * inv_n;
+        // Old deviation of x times new deviation of y
+        T_acc dy_new = static_cast<T_acc>(*(vol_y + i)) - mean_y[i];
+        m2_x[i] += dx * (static_cast<T_acc>(*(vol_x + i)) - mean_x[i]);
+        m2_y[i] += dy * dy_new;
+        c_xy[i] += dx * dy_new;
+    }
+}
+
+// ============================================================================
+// Incremental farthest point sampling
+// ============================================================================
+// Keeps the geodesic distance of every voxel of interest to its nearest seed.
+// Adding a seed only re-propagates (Dijkstra) the voxels that it brings
+// closer, and a max-heap with lazy deletion returns the next farthest voxel.
+// Adding K seeds therefore costs about the size of their Voronoi cells
+// instead of K full floods.
+struct FarthestPoints {
+    float* dist;     // Distance to the nearest seed, infinity if not reached
+    int32_t* step;   // Optional (can be NULL). Number of jumps from the seed
+    std::priority_queue<std::pair<float, uint32_t> > farthest;
+    std::priority_queue<std::pair<float, uint32_t>,
+                        std::vector<std::pair<float, uint32_t> >,
+                        std::greater<std::pair<float, uint32_t> > > queue;
+};
+
+FarthestPoints farthest_points(const int32_t* voi_id, const uint32_t nr_voi,
+                               float* dist, int32_t* step);
+
+template <typename F_domain>
+void farthest_points_add_seed(FarthestPoints& fp, const Neighbours26& nb,
+                              const uint32_t seed, F_domain in_domain) {
+    const uint32_t end_x = nb.size_x - 1;
+    const uint32_t end_y = nb.size_y - 1;
+    const uint32_t end_z = nb.size_z - 1;
+    uint32_t ix, iy, iz, i, j;
+
+    *(fp.dist + seed) = 0;
+    if (fp.step != NULL) *(fp.step + seed) = 1;
+    fp.queue.push(std::make_pair(0.f, seed));
+    while (!fp.queue.empty()) {
+        float d_i = fp.queue.top().first;
+        i = fp.queue.top().second;
+        fp.queue.pop();
+        if (d_i != *(fp.dist + i)) continue;  // Improved again since pushed
+        fp.farthest.push(std::make_pair(d_i, i));
+
+        tie(ix, iy, iz) = ind2sub_3D(i, nb.size_x, nb.size_y);
+        bool is_inside = ix > 0 && ix < end_x && iy > 0 && iy < end_y
+                         && iz > 0 && iz < end_z;
+        for (int n = 0; n != 26; ++n) {
+            if (!is_inside
+                && ((NB26_DX[n] < 0 && ix == 0) || (NB26_DX[n] > 0 && ix >= end_x)
+                    || (NB26_DY[n] < 0 && iy == 0) || (NB26_DY[n] > 0 && iy >= end_y)
+                    || (NB26_DZ[n] < 0 && iz == 0) || (NB26_DZ[n] > 0 && iz >= end_z))) {
+                continue;
+            }
+            j = i + nb.offset[n];
+            float d = d_i + nb.dist[n];
+            if (d < *(fp.dist + j) && in_domain(j)) {
+                *(fp.dist + j) = d;
+                if (fp.step != NULL) *(fp.step + j) = *(fp.step + i) + 1;
+                fp.queue.push(std::make_pair(d, j));
+            }
+        }
+    }
+}
+
+// Returns false when every reachable voxel is already a seed
+bool farthest_points_next(FarthestPoints& fp, uint32_t* voxel);
+
+// ============================================================================
+// UVD cylinder queries
+// ============================================================================
+// Uniform grid over flat (U, V) and depth (D) coordinates of voxels of
+// interest. Bins are slightly wider than the cylinder radius and half height,
+// therefore a cylinder query only needs to visit the 3 x 3 x 3 bins around
+// its center.
+struct GridUVD {
+    double min_u, min_v, min_d;
+    double bin_uv, bin_d;
+    int64_t size_u, size_v, size_d;
+    std::vector<uint32_t> bin_start;  // Offset of each bin in bin_ids
+    std::vector<uint32_t> bin_ids;    // Point indices grouped by bin
+};
+
+GridUVD grid_uvd(const std::vector<float>& u, const std::vector<float>& v,
+                 const std::vector<float>& d, const float radius,
+                 const float height);
+
+void query_cylinder_uvd(const GridUVD& grid, const std::vector<float>& u,
+                        const std::vector<float>& v,
+                        const std::vector<float>& d, const uint32_t i,
+                        const float radius, const float height,
+                        std::vector<uint32_t>& found);
+
+// ============================================================================
+// Random numbers
+// ============================================================================
+// Counter-based generator: every sample is a pure function of (seed,
+// counter), e.g. counter = voxel index. Loops over voxels can therefore run
+// in parallel (and vectorize) and give the same noise for any number of
+// threads. The mixing function is the SplitMix64 finalizer applied twice.
+inline uint64_t random_bits(uint64_t seed, uint64_t counter) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ULL + counter;
+    for (int k = 0; k < 2; ++k) {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z = z ^ (z >> 31);
+    }
+    return z;
+}
+
+// Standard normal sample (Box-Muller). Even and odd counters share one pair
+// of uniforms and return its cosine and sine branch.
+inline float random_normal(uint64_t seed, uint64_t counter) {
+    uint64_t bits = random_bits(seed, counter >> 1);
+    // Uniforms in (0, 1) and [0, 1) from the upper and lower 32 bits
+    double u1 = (static_cast<double>(bits >> 32) + 0.5) * 2.3283064365386963e-10;
+    double u2 = static_cast<double>(bits & 0xFFFFFFFFULL) * 2.3283064365386963e-10;
+    double r = std::sqrt(-2.0 * std::log(u1));
+    double theta = 6.283185307179586 * u2;
+    return static_cast<float>(
+        (counter & 1) ? r * std::sin(theta) : r * std::cos(theta));
+}
+
 // ============================================================================
 // Preprocessor macros.
 // ============================================================================
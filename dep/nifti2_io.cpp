@@ -3,6 +3,14 @@
 #include "nifti2_io.h"   /* typedefs, prototypes, macros, etc. */
 #include <math.h>
 
+#if !defined(_WIN32)      /* for nifti_image_read_mmap()  */
+#define NIFTI_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 /*****===================================================================*****/
 /*****     Sample functions to deal with NIFTI-1,2 and ANALYZE files     *****/
@@ -5960,6 +5968,121 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
 }
 
 
+/*----------------------------------------------------------------------
+ * memory mapped data blobs, see nifti_image_read_mmap()
+ *
+ * The nifti_image struct is left as is, mapped blobs are remembered
+ * here so that nifti_image_unload() and nifti_image_free() can unmap
+ * them instead of calling free().
+ *----------------------------------------------------------------------*/
+#define NIFTI_MAX_MMAPS 64
+static struct {
+   void   *data;           /* nim->data, points into the mapping */
+   void   *base;           /* start of the mapping               */
+   size_t  length;         /* length of the mapping              */
+} g_mmaps[NIFTI_MAX_MMAPS];
+
+/* unmap data if it came from nifti_image_read_mmap()
+   return 1 if it was unmapped, 0 if data is not a mapped blob */
+static int nifti_munmap_data( void *data )
+{
+   int ii;
+   if( data == NULL ) return 0;
+   for( ii = 0; ii < NIFTI_MAX_MMAPS; ii++ ){
+      if( g_mmaps[ii].data == data ){
+#ifdef NIFTI_HAVE_MMAP
+         munmap(g_mmaps[ii].base, g_mmaps[ii].length);
+#endif
+         g_mmaps[ii].data = NULL;
+         g_mmaps[ii].base = NULL;
+         g_mmaps[ii].length = 0;
+         return 1;
+      }
+   }
+   return 0;
+}
+
+
+/***************************************************************
+ * nifti_image_read_mmap
+ ***************************************************************/
+/*! \brief Read a nifti header and map the data blob into memory.
+
+        - Like nifti_image_read(hname, 1), but for an uncompressed,
+          single file dataset (.nii) in native byte order the data
+          is not copied. nim->data points into a private, copy on
+          write mapping of the file, pages are read on first access.
+        - Writing into nim->data never changes the file on disk.
+        - Any other dataset (.nii.gz, .hdr/.img, byte swapped) or a
+          failed mapping falls back to nifti_image_load().
+        - Free with nifti_image_free() or nifti_image_unload(), as usual.
+
+    \param hname filename of the nifti dataset
+    \return A pointer to the nifti_image data structure.
+
+    \sa nifti_image_read, nifti_image_free, nifti_image_unload
+*/
+nifti_image *nifti_image_read_mmap( const char *hname )
+{
+   nifti_image *nim;
+   char        *tmpimgname;
+   char         fname[] = { "nifti_image_read_mmap" };
+
+   nim = nifti_image_read(hname, 0);
+   if( nim == NULL ) return NULL;
+
+#ifdef NIFTI_HAVE_MMAP
+   if( nim->nbyper > 0 && nim->nvox > 0 && nim->iname != NULL &&
+       nim->iname_offset >= 0 &&
+       ( nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ||
+         nim->nifti_type == NIFTI_FTYPE_NIFTI2_1 ) &&
+       ( nim->swapsize <= 1 || nim->byteorder == nifti_short_order() ) )
+   {
+      int64_t ntot = nifti_get_volsize(nim);
+      size_t  length = (size_t)(nim->iname_offset + ntot);
+      int     ii, fd = -1;
+      void   *base = MAP_FAILED;
+      struct stat st;
+
+      tmpimgname = nifti_findimgname(nim->iname, nim->nifti_type);
+      if( tmpimgname != NULL && !nifti_is_gzfile(tmpimgname) ){
+         fd = open(tmpimgname, O_RDONLY);
+      }
+      free(tmpimgname);
+
+      /* find a free slot, a full table means a normal read */
+      for( ii = 0; ii < NIFTI_MAX_MMAPS; ii++ )
+         if( g_mmaps[ii].data == NULL ) break;
+
+      if( fd >= 0 && ii < NIFTI_MAX_MMAPS && fstat(fd, &st) == 0 &&
+          (size_t)st.st_size >= length )
+         base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+      if( fd >= 0 ) close(fd);   /* the mapping stays valid */
+
+      if( base != MAP_FAILED ){
+         nim->data = (char *)base + nim->iname_offset;
+         g_mmaps[ii].data = nim->data;
+         g_mmaps[ii].base = base;
+         g_mmaps[ii].length = length;
+         if( g_opts.debug > 1 )
+            fprintf(stderr,"+d %s: mapped %s\n", fname, nim->iname);
+         return nim;
+      }
+   }
+#endif
+
+   /**- otherwise read the data as nifti_image_read() would */
+   if( g_opts.debug > 1 )
+      fprintf(stderr,"+d %s: reading data of %s\n", fname, hname);
+   if( nifti_image_load( nim ) < 0 ){
+      nifti_image_free(nim);
+      return NULL;
+   }
+   return nim;
+}
+
+
 /*----------------------------------------------------------------------
  # return the index of the first occurrence of the given ecode, else -1
  *----------------------------------------------------------------------*/
@@ -6837,7 +6960,8 @@ int64_t nifti_read_buffer(znzFile fp, void* dataptr, int64_t ntot,
 void nifti_image_unload( nifti_image *nim )
 {
    if( nim != NULL && nim->data != NULL ){
-     free(nim->data) ; nim->data = NULL ;
+     if( !nifti_munmap_data(nim->data) ) free(nim->data) ;
+     nim->data = NULL ;
    }
    return ;
 }
@@ -6857,7 +6981,7 @@ void nifti_image_free( nifti_image *nim )
    if( nim == NULL ) return ;
    if( nim->fname != NULL ) free(nim->fname) ;
    if( nim->iname != NULL ) free(nim->iname) ;
-   if( nim->data  != NULL ) free(nim->data ) ;
+   if( nim->data  != NULL && !nifti_munmap_data(nim->data) ) free(nim->data ) ;
    (void)nifti_free_extensions( nim ) ;
    free(nim) ; return ;
 }
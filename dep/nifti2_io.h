@@ -433,6 +433,7 @@ int          nifti_image_load_bricks(nifti_image *nim , int64_t nbricks,
 void         nifti_free_NBL( nifti_brick_list * NBL );
 
 nifti_image *nifti_image_read    ( const char *hname , int read_data);
+nifti_image *nifti_image_read_mmap( const char *hname );
 int          nifti_image_load    ( nifti_image *nim);
 void         nifti_image_unload  ( nifti_image *nim);
 void         nifti_image_free    ( nifti_image *nim);
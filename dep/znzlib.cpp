@@ -39,6 +39,409 @@ znzlib.c  (zipped or non-zipped library)
 */
 
 
+/* threads for block gzip, see znz_set_nthreads */
+static int znz_nthreads = 1;
+
+void znz_set_nthreads(int nthreads)
+{
+  znz_nthreads = (nthreads < 1) ? 1 : nthreads;
+}
+
+#ifdef HAVE_ZLIB
+
+/*
+Block gzip
+
+Compressed files are written as a series of gzip members, each holding
+ZNZ_GZ_BLOCK_SIZE bytes of data (the last one less). The members are
+independent, so they are compressed in parallel. Concatenated gzip members
+are one valid gzip stream (RFC 1952), so any gzip reader (including gzread)
+decodes such files as usual.
+
+Each member header carries an extra field (subfield 'L','N') with the
+compressed size of the member and the uncompressed size of its data. When
+such a file is opened for reading, these are used to index the members
+without inflating them, and reads that span whole members inflate them in
+parallel. Any other compressed file is read with gzread.
+*/
+
+#define ZNZ_GZ_BLOCK_SIZE (1<<20)
+#define ZNZ_GZ_HEADER_SIZE 24
+#define ZNZ_GZ_TRAILER_SIZE 8
+
+static void znz_gz_put32(unsigned char * p, unsigned long v)
+{
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)((v >> 8) & 0xff);
+  p[2] = (unsigned char)((v >> 16) & 0xff);
+  p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+static unsigned long znz_gz_get32(const unsigned char * p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+         ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/* offsets past 2 GB, long is 32 bits on Windows */
+#if defined(_WIN32)
+#define znz_fseek64 _fseeki64
+#else
+#define znz_fseek64 fseeko
+#endif
+
+/* largest member for len bytes of data */
+static size_t znz_gz_bound(size_t len)
+{
+  return compressBound((uLong)len) + ZNZ_GZ_HEADER_SIZE + ZNZ_GZ_TRAILER_SIZE;
+}
+
+/* compress len bytes of src into one gzip member at dst,
+   return the member size, or 0 on failure */
+static size_t znz_gz_deflate(const unsigned char * src, size_t len,
+                             unsigned char * dst, size_t dst_size, int level)
+{
+  z_stream strm;
+  size_t   member_size;
+
+  memset(&strm, 0, sizeof(strm));
+  if( deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK ) return 0;
+  strm.next_in   = (Bytef *)src;
+  strm.avail_in  = (uInt)len;
+  strm.next_out  = dst + ZNZ_GZ_HEADER_SIZE;
+  strm.avail_out = (uInt)(dst_size - ZNZ_GZ_HEADER_SIZE - ZNZ_GZ_TRAILER_SIZE);
+  if( deflate(&strm, Z_FINISH) != Z_STREAM_END ) {
+    deflateEnd(&strm);
+    return 0;
+  }
+  member_size = ZNZ_GZ_HEADER_SIZE + strm.total_out + ZNZ_GZ_TRAILER_SIZE;
+  deflateEnd(&strm);
+
+  /* header: magic, deflate, FEXTRA, no mtime, no xfl, unix, XLEN = 12 */
+  dst[0] = 0x1f; dst[1] = 0x8b; dst[2] = 8; dst[3] = 4;
+  memset(dst + 4, 0, 5);
+  dst[9] = 3;
+  dst[10] = 12; dst[11] = 0;
+  dst[12] = 'L'; dst[13] = 'N'; dst[14] = 8; dst[15] = 0;
+  znz_gz_put32(dst + 16, (unsigned long)member_size);
+  znz_gz_put32(dst + 20, (unsigned long)len);
+
+  /* trailer: CRC-32 and ISIZE */
+  znz_gz_put32(dst + member_size - 8, crc32(crc32(0L, Z_NULL, 0), src, (uInt)len));
+  znz_gz_put32(dst + member_size - 4, (unsigned long)len);
+  return member_size;
+}
+
+/* inflate one member (as written by znz_gz_deflate) into dst,
+   return 0 on success */
+static int znz_gz_inflate(const unsigned char * src, size_t member_size,
+                          unsigned char * dst, size_t len)
+{
+  z_stream strm;
+  int      ret;
+
+  memset(&strm, 0, sizeof(strm));
+  if( inflateInit2(&strm, -MAX_WBITS) != Z_OK ) return -1;
+  strm.next_in   = (Bytef *)(src + ZNZ_GZ_HEADER_SIZE);
+  strm.avail_in  = (uInt)(member_size - ZNZ_GZ_HEADER_SIZE - ZNZ_GZ_TRAILER_SIZE);
+  strm.next_out  = dst;
+  strm.avail_out = (uInt)len;
+  ret = inflate(&strm, Z_FINISH);
+  inflateEnd(&strm);
+  if( ret != Z_STREAM_END || strm.total_out != len ) return -1;
+  if( znz_gz_get32(src + member_size - 8) !=
+      crc32(crc32(0L, Z_NULL, 0), dst, (uInt)len) ) return -1;
+  return 0;
+}
+
+/* compress len bytes as members of ZNZ_GZ_BLOCK_SIZE and write them,
+   return 0 on success */
+static int znz_gz_write_blocks(znzFile file, const unsigned char * src,
+                               size_t len)
+{
+  int64_t          nblocks = (int64_t)((len + ZNZ_GZ_BLOCK_SIZE - 1) / ZNZ_GZ_BLOCK_SIZE);
+  int64_t          nbatch = 4 * znz_nthreads;
+  size_t           bound = znz_gz_bound(ZNZ_GZ_BLOCK_SIZE);
+  unsigned char  * out;
+  size_t         * out_size;
+  int64_t          b0, b, nb;
+  int              err = 0;
+
+  if( nblocks == 0 ) nblocks = 1;  /* an empty member for empty files */
+  if( nbatch > nblocks ) nbatch = nblocks;
+
+  out = (unsigned char *)malloc(nbatch * bound);
+  out_size = (size_t *)malloc(nbatch * sizeof(size_t));
+  if( out == NULL || out_size == NULL ) {
+    fprintf(stderr,"** ERROR: znzwrite failed to alloc block buffers\n");
+    free(out); free(out_size);
+    return -1;
+  }
+
+  for( b0 = 0; b0 < nblocks && !err; b0 += nbatch ) {
+    nb = (nblocks - b0 < nbatch) ? nblocks - b0 : nbatch;
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(znz_nthreads)
+    for( b = 0; b < nb; b++ ) {
+      size_t start = (size_t)(b0 + b) * ZNZ_GZ_BLOCK_SIZE;
+      size_t n = (len - start < ZNZ_GZ_BLOCK_SIZE) ? len - start : ZNZ_GZ_BLOCK_SIZE;
+      out_size[b] = znz_gz_deflate(src + start, n, out + b * bound, bound,
+                                   file->level);
+    }
+
+    for( b = 0; b < nb; b++ ) {
+      if( out_size[b] == 0 ||
+          fwrite(out + b * bound, 1, out_size[b], file->nzfptr) != out_size[b] ) {
+        err = -1;
+        break;
+      }
+    }
+  }
+
+  free(out);
+  free(out_size);
+  return err;
+}
+
+static size_t znz_gz_write(znzFile file, const unsigned char * src, size_t len)
+{
+  size_t n, nfull;
+
+  /* complete the pending block first */
+  if( file->bbuf_len > 0 ) {
+    n = ZNZ_GZ_BLOCK_SIZE - file->bbuf_len;
+    if( n > len ) n = len;
+    memcpy(file->bbuf + file->bbuf_len, src, n);
+    file->bbuf_len += n;
+    file->pos += n;
+    src += n;
+    len -= n;
+    if( file->bbuf_len < ZNZ_GZ_BLOCK_SIZE ) return n;
+    if( znz_gz_write_blocks(file, file->bbuf, file->bbuf_len) != 0 ) return 0;
+    file->bbuf_len = 0;
+  } else {
+    n = 0;
+  }
+
+  /* whole blocks straight from the caller's buffer */
+  nfull = len - len % ZNZ_GZ_BLOCK_SIZE;
+  if( nfull > 0 ) {
+    if( znz_gz_write_blocks(file, src, nfull) != 0 ) return n;
+    file->pos += nfull;
+    n += nfull;
+  }
+
+  /* keep the rest for the next block */
+  memcpy(file->bbuf, src + nfull, len - nfull);
+  file->bbuf_len = len - nfull;
+  file->pos += len - nfull;
+  return n + len - nfull;
+}
+
+/* index the members of an open block gzip file,
+   return 0 on success and -1 if it is not one */
+static int znz_gz_index(znzFile file)
+{
+  unsigned char hdr[ZNZ_GZ_HEADER_SIZE];
+  int64_t       offset = 0, usize = 0, nalloc = 0, csize;
+  size_t        nread;
+
+  file->nblocks = 0;
+  while( 1 ) {
+    nread = fread(hdr, 1, ZNZ_GZ_HEADER_SIZE, file->nzfptr);
+    if( nread == 0 && file->nblocks > 0 && feof(file->nzfptr) ) break;
+    if( nread != ZNZ_GZ_HEADER_SIZE || hdr[0] != 0x1f || hdr[1] != 0x8b ||
+        hdr[2] != 8 || hdr[3] != 4 || hdr[10] != 12 || hdr[11] != 0 ||
+        hdr[12] != 'L' || hdr[13] != 'N' || hdr[14] != 8 || hdr[15] != 0 )
+      return -1;
+    csize = (int64_t)znz_gz_get32(hdr + 16);
+    if( csize < ZNZ_GZ_HEADER_SIZE + ZNZ_GZ_TRAILER_SIZE ) return -1;
+
+    if( file->nblocks + 2 > nalloc ) {
+      nalloc = 2 * nalloc + 64;
+      file->boffset = (int64_t *)realloc(file->boffset, nalloc * sizeof(int64_t));
+      file->bstart = (int64_t *)realloc(file->bstart, nalloc * sizeof(int64_t));
+      if( file->boffset == NULL || file->bstart == NULL ) return -1;
+    }
+    file->boffset[file->nblocks] = offset;
+    file->bstart[file->nblocks] = usize;
+    file->nblocks++;
+
+    offset += csize;
+    usize += (int64_t)znz_gz_get32(hdr + 20);
+    if( znz_fseek64(file->nzfptr, offset, SEEK_SET) != 0 ) return -1;
+  }
+  file->boffset[file->nblocks] = offset;
+  file->bstart[file->nblocks] = usize;
+  file->size = usize;
+  return 0;
+}
+
+/* index of the member holding uncompressed position pos */
+static int64_t znz_gz_find(znzFile file, int64_t pos)
+{
+  int64_t lo = 0, hi = file->nblocks - 1, mid;
+  while( lo < hi ) {
+    mid = (lo + hi + 1) / 2;
+    if( file->bstart[mid] <= pos ) lo = mid;
+    else                           hi = mid - 1;
+  }
+  return lo;
+}
+
+/* read (whole) members b0 to b1-1 and inflate them into dst */
+static int znz_gz_read_blocks(znzFile file, int64_t b0, int64_t b1, unsigned char * dst)
+{
+  int64_t         offset = file->boffset[b0];
+  size_t          csize = (size_t)(file->boffset[b1] - offset);
+  unsigned char * src;
+  int64_t         b;
+  int             err = 0;
+
+  src = (unsigned char *)malloc(csize);
+  if( src == NULL ) {
+    fprintf(stderr,"** ERROR: znzread failed to alloc %u bytes\n",(unsigned)csize);
+    return -1;
+  }
+  if( znz_fseek64(file->nzfptr, offset, SEEK_SET) != 0 ||
+      fread(src, 1, csize, file->nzfptr) != csize ) {
+    free(src);
+    return -1;
+  }
+
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(znz_nthreads)
+  for( b = b0; b < b1; b++ ) {
+    if( znz_gz_inflate(src + (file->boffset[b] - offset),
+                       (size_t)(file->boffset[b + 1] - file->boffset[b]),
+                       dst + (file->bstart[b] - file->bstart[b0]),
+                       (size_t)(file->bstart[b + 1] - file->bstart[b])) != 0 ) {
+      #pragma omp atomic write
+      err = -1;
+    }
+  }
+
+  free(src);
+  if( err ) fprintf(stderr,"** ERROR: znzread failed to inflate gzip member\n");
+  return err;
+}
+
+static size_t znz_gz_read(znzFile file, unsigned char * dst, size_t len)
+{
+  size_t done = 0, n;
+  int64_t b, b1, bsize;
+
+  if( file->pos >= file->size ) return 0;
+  if( len > (size_t)(file->size - file->pos) ) len = (size_t)(file->size - file->pos);
+
+  while( done < len ) {
+    b = znz_gz_find(file, file->pos);
+
+    /* whole members go straight to the caller's buffer, in parallel */
+    for( b1 = b; b1 < file->nblocks &&
+                 file->bstart[b1 + 1] - file->pos <= (int64_t)(len - done); b1++ ) ;
+    if( file->pos == file->bstart[b] && b1 > b ) {
+      if( znz_gz_read_blocks(file, b, b1, dst + done) != 0 ) break;
+      n = (size_t)(file->bstart[b1] - file->pos);
+    } else {
+      /* partial member (or a single one) through the cache */
+      if( file->bbuf_block != b ) {
+        bsize = file->bstart[b + 1] - file->bstart[b];
+        if( bsize > (int64_t)file->bbuf_len ) {
+          free(file->bbuf);
+          file->bbuf = (unsigned char *)malloc(bsize);
+          file->bbuf_len = (file->bbuf == NULL) ? 0 : bsize;
+          if( file->bbuf == NULL ) break;
+        }
+        file->bbuf_block = -1;
+        if( znz_gz_read_blocks(file, b, b + 1, file->bbuf) != 0 ) break;
+        file->bbuf_block = b;
+      }
+      n = (size_t)(file->bstart[b + 1] - file->pos);
+      if( n > len - done ) n = len - done;
+      memcpy(dst + done, file->bbuf + (file->pos - file->bstart[b]), n);
+    }
+    done += n;
+    file->pos += (int64_t)n;
+  }
+  return done;
+}
+
+static int64_t znz_gz_seek(znzFile file, int64_t offset, int whence)
+{
+  int64_t pos;
+  if( whence == SEEK_SET )      pos = offset;
+  else if( whence == SEEK_CUR ) pos = file->pos + offset;
+  else if( whence == SEEK_END && file->blockz == 2 ) pos = file->size + offset;
+  else return -1;
+  if( pos < 0 ) return -1;
+
+  if( file->blockz == 1 ) {  /* writing: only forward, fill with zeros */
+    unsigned char zeros[1024];
+    size_t        n;
+    if( pos < file->pos ) return -1;
+    memset(zeros, 0, sizeof(zeros));
+    while( file->pos < pos ) {
+      n = (pos - file->pos < (int64_t)sizeof(zeros)) ? (size_t)(pos - file->pos) : sizeof(zeros);
+      if( znz_gz_write(file, zeros, n) != n ) return -1;
+    }
+  }
+  file->pos = pos;
+  return pos;
+}
+
+static znzFile znz_gz_open(znzFile file, const char *path, const char *mode)
+{
+  const char * c;
+
+  if( strchr(mode, 'w') != NULL && strchr(mode, '+') == NULL ) {
+    file->level = Z_DEFAULT_COMPRESSION;
+    for( c = mode; *c; c++ ) if( *c >= '0' && *c <= '9' ) file->level = *c - '0';
+    file->bbuf = (unsigned char *)malloc(ZNZ_GZ_BLOCK_SIZE);
+    if( file->bbuf == NULL || (file->nzfptr = fopen(path, "wb")) == NULL ) {
+      free(file->bbuf);
+      file->bbuf = NULL;
+      return NULL;
+    }
+    file->blockz = 1;
+    return file;
+  }
+
+  if( strchr(mode, 'r') != NULL && strchr(mode, '+') == NULL ) {
+    if( (file->nzfptr = fopen(path, "rb")) == NULL ) return NULL;
+    if( znz_gz_index(file) == 0 ) {
+      file->blockz = 2;
+      file->bbuf_block = -1;
+      return file;
+    }
+    /* not block gzip, read as any other gzip file */
+    fclose(file->nzfptr);
+    file->nzfptr = NULL;
+    free(file->boffset); file->boffset = NULL;
+    free(file->bstart); file->bstart = NULL;
+  }
+
+  if( (file->zfptr = gzopen(path, mode)) == NULL ) return NULL;
+  return file;
+}
+
+static int znz_gz_close(znzFile file)
+{
+  int retval = 0;
+  if( file->blockz == 1 ) {
+    /* pending data, or an empty member if nothing was written */
+    if( file->bbuf_len > 0 || file->pos == 0 )
+      retval = znz_gz_write_blocks(file, file->bbuf, file->bbuf_len);
+  }
+  if( fclose(file->nzfptr) != 0 ) retval = -1;
+  file->nzfptr = NULL;
+  free(file->bbuf);
+  free(file->boffset);
+  free(file->bstart);
+  return retval;
+}
+#endif
+
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
    use_compression!=0 uses zlib (gzip) compression
@@ -60,7 +463,7 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 
   if (use_compression) {
     file->withz = 1;
-    if((file->zfptr = gzopen(path,mode)) == NULL) {
+    if(znz_gz_open(file,path,mode) == NULL) {
         free(file);
         file = NULL;
     }
@@ -113,6 +516,7 @@ int Xznzclose(znzFile * file)
   int retval = 0;
   if (*file!=NULL) {
 #ifdef HAVE_ZLIB
+    if ((*file)->blockz)       { retval = znz_gz_close(*file); }
     if ((*file)->zfptr!=NULL)  { retval = gzclose((*file)->zfptr); }
 #endif
     if ((*file)->nzfptr!=NULL) { retval = fclose((*file)->nzfptr); }
@@ -137,6 +541,10 @@ size_t znzread(void* buf, size_t size, size_t nmemb, znzFile file)
 
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz) {
+    if (size == 0) return 0;
+    return znz_gz_read(file, (unsigned char *)buf, remain) / size;
+  }
   if (file->zfptr!=NULL) {
     /* gzread/write take unsigned int length, so maybe read in int pieces
        (noted by M Hanke, example given by M Adler)   6 July 2010 [rickr] */
@@ -171,6 +579,10 @@ size_t znzwrite(const void* buf, size_t size, size_t nmemb, znzFile file)
 
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 1) {
+    if (size == 0) return 0;
+    return znz_gz_write(file, (const unsigned char *)buf, remain) / size;
+  }
   if (file->zfptr!=NULL) {
     while( remain > 0 ) {
        n2write = (remain < ZNZ_MAX_BLOCK_SIZE) ? remain : ZNZ_MAX_BLOCK_SIZE;
@@ -200,6 +612,7 @@ long znzseek(znzFile file, long offset, int whence)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz) return znz_gz_seek(file,offset,whence);
   if (file->zfptr!=NULL) return (long) gzseek(file->zfptr,offset,whence);
 #endif
   return fseek(file->nzfptr,offset,whence);
@@ -215,6 +628,7 @@ int znzrewind(znzFile stream)
      if (stream->zfptr!=NULL) return gzrewind(stream->zfptr);
   */
 
+  if (stream->blockz) return (int)znz_gz_seek(stream, 0L, SEEK_SET);
   if (stream->zfptr!=NULL) return (int)gzseek(stream->zfptr, 0L, SEEK_SET);
 #endif
   rewind(stream->nzfptr);
@@ -225,6 +639,7 @@ long znztell(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz) return file->pos;
   if (file->zfptr!=NULL) return (long) gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -234,6 +649,7 @@ int znzputs(const char * str, znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 1) return (int)znz_gz_write(file, (const unsigned char *)str, strlen(str));
   if (file->zfptr!=NULL) return gzputs(file->zfptr,str);
 #endif
   return fputs(str,file->nzfptr);
@@ -244,6 +660,15 @@ char * znzgets(char* str, int size, znzFile file)
 {
   if (file==NULL) { return NULL; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 2) {
+    int n = 0;
+    while (n < size - 1 && znz_gz_read(file, (unsigned char *)str + n, 1) == 1) {
+      if (str[n++] == '\n') break;
+    }
+    if (n == 0) return NULL;
+    str[n] = '\0';
+    return str;
+  }
   if (file->zfptr!=NULL) return gzgets(file->zfptr,str,size);
 #endif
   return fgets(str,size,file->nzfptr);
@@ -254,6 +679,7 @@ int znzflush(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz) return 0;  /* pending data is written on close */
   if (file->zfptr!=NULL) return gzflush(file->zfptr,Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -264,6 +690,7 @@ int znzeof(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 2) return file->pos >= file->size;
   if (file->zfptr!=NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -274,6 +701,10 @@ int znzputc(int c, znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 1) {
+    unsigned char uc = (unsigned char)c;
+    return (znz_gz_write(file, &uc, 1) == 1) ? uc : -1;
+  }
   if (file->zfptr!=NULL) return gzputc(file->zfptr,c);
 #endif
   return fputc(c,file->nzfptr);
@@ -284,6 +715,10 @@ int znzgetc(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->blockz == 2) {
+    unsigned char uc;
+    return (znz_gz_read(file, &uc, 1) == 1) ? uc : -1;
+  }
   if (file->zfptr!=NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
@@ -307,7 +742,10 @@ int znzprintf(znzFile stream, const char *format, ...)
        return retval;
     }
     vsprintf(tmpstr,format,va);
-    retval=gzprintf(stream->zfptr,"%s",tmpstr);
+    if (stream->blockz == 1)
+      retval=(int)znz_gz_write(stream,(const unsigned char *)tmpstr,strlen(tmpstr));
+    else
+      retval=gzprintf(stream->zfptr,"%s",tmpstr);
     free(tmpstr);
   } else
 #endif
@@ -33,6 +33,11 @@ are required:
 
 NB: seeks for writable files with compression are quite restricted
 
+Compressed files are written as a series of independent gzip members
+(block gzip), which are compressed in parallel when built with OpenMP.
+Standard gzip readers see them as one stream. Files written this way are
+also read with the members inflated in parallel.
+
 */
 
 
@@ -46,6 +51,7 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 /* include optional check for HAVE_FDOPEN here, from deleted config.h:
 
@@ -68,6 +74,18 @@ struct znzptr {
   FILE* nzfptr;
 #ifdef HAVE_ZLIB
   gzFile zfptr;
+
+  /* block gzip (see znzlib.c), data file is nzfptr */
+  int blockz;               /* 1: writing blocks, 2: reading blocks */
+  int level;                /* compression level (writing) */
+  unsigned char * bbuf;     /* pending data (writing), cached block (reading) */
+  size_t bbuf_len;          /* bytes in bbuf */
+  int64_t bbuf_block;       /* index of the cached block (reading) */
+  int64_t pos;              /* uncompressed position */
+  int64_t size;             /* uncompressed size (reading) */
+  int64_t nblocks;          /* number of members (reading) */
+  int64_t * boffset;        /* file offset of each member, nblocks+1 */
+  int64_t * bstart;         /* uncompressed start of each member, nblocks+1 */
 #endif
 } ;
 
@@ -95,6 +113,9 @@ size_t znzread(void* buf, size_t size, size_t nmemb, znzFile file);
 
 size_t znzwrite(const void* buf, size_t size, size_t nmemb, znzFile file);
 
+/* number of threads to (de)compress block gzip members with, default 1 */
+void znz_set_nthreads(int nthreads);
+
 long znzseek(znzFile file, long offset, int whence);
 
 int znzrewind(znzFile stream);
@@ -0,0 +1,464 @@
+#include "../dep/laynii_lib.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int show_help(void) {
+    printf(
+    "LN2_BENCHMARK: Generates synthetic rim/layer/activation phantoms and times\n"
+    "               the LN2 pipeline on them (wall time, peak memory and\n"
+    "               voxels per second for each stage).\n"
+    "\n"
+    "    Stages (in order):\n"
+    "      LN2_LAYERS, LN2_COLUMNS, LN2_LAYER_SMOOTH, LN2_MULTILATERATE,\n"
+    "      LN2_UVD_FILTER\n"
+    "\n"
+    "Usage:\n"
+    "    LN2_BENCHMARK -sizes 64,128,256\n"
+    "    LN2_BENCHMARK -sizes 512 -threads 8 -workdir /scratch/bench -clean\n"
+    "    LN2_BENCHMARK -sizes 96 -phantom_only\n"
+    "\n"
+    "Options:\n"
+    "    -help         : Show this help.\n"
+    "    -sizes        : Comma separated matrix sizes. Each phantom is size^3\n"
+    "                    voxels. Default is '64,128'.\n"
+    "    -bindir       : (Optional) Folder with the LAYNII programs. Default is\n"
+    "                    the current folder.\n"
+    "    -workdir      : (Optional) Folder for phantoms, stage outputs and\n"
+    "                    logs. Default is 'benchmark'.\n"
+    "    -threads      : (Optional) Number of threads passed to the stages that\n"
+    "                    support it. Default is 1.\n"
+    "    -nr_columns   : (Optional) Number of columns for LN2_COLUMNS. Default\n"
+    "                    is 100.\n"
+    "    -phantom_only : (Optional) Only write the phantoms.\n"
+    "    -clean        : (Optional) Remove phantoms and stage outputs of each\n"
+    "                    size once its stages are done.\n"
+    "\n"
+    "Notes:\n"
+    "    - Phantoms cover a fixed 32 mm field of view, so voxels get smaller\n"
+    "      as size increases. Smoothing and filter kernels are given in voxels\n"
+    "      (converted to mm per size), which keeps the work per voxel similar\n"
+    "      across sizes so that voxels/s is comparable.\n"
+    "    - Each phantom is a shell of gray matter (rim label 3) between a\n"
+    "      white matter border (2) and a CSF border (1). The inner surface is\n"
+    "      a sphere with sinusoidal folds. Activation is a smooth pattern that\n"
+    "      varies along the surface and across depth plus deterministic noise.\n"
+    "      Control points are the analytic mid gray matter surface (1) with\n"
+    "      the origin (2) at the top of the sphere.\n"
+    "    - Results are appended to '<workdir>/benchmark.tsv'. Output of each\n"
+    "      stage goes to '<workdir>/size<N>/<stage>.log'.\n"
+    "    - Stages whose inputs from earlier stages or outputs have no\n"
+    "      non-zero voxels (e.g. no layers) are reported as empty and their\n"
+    "      times are recorded as NA.\n"
+    "    - Stages run as child processes. Peak memory is the maximum resident\n"
+    "      set size reported by the operating system for that child.\n"
+    "\n");
+    return 0;
+}
+
+// ============================================================================
+// Phantom
+// ============================================================================
+// Physical model in mm. Field of view is fixed, voxel size follows the matrix.
+static const float PHANTOM_FOV = 32;
+static const float PHANTOM_RADIUS = 8;
+static const float PHANTOM_THICKNESS = 2.5;
+
+static inline float phantom_inner_radius(float x, float y, float z, float r) {
+    // Sphere with folds. At the poles (theta = 0) the radius is unchanged.
+    float theta = acos(z / r);
+    float phi = atan2(y, x);
+    return PHANTOM_RADIUS * (1 + 0.12 * sin(5 * theta) * cos(4 * phi));
+}
+
+static inline float phantom_noise(uint64_t i) {
+    // Deterministic hash noise in [-1, 1]
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ULL;
+    i ^= i >> 33;
+    return static_cast<float>(i >> 40) / static_cast<float>(1 << 23) - 1;
+}
+
+static nifti_image* phantom_new_nifti(int size, int datatype) {
+    const int64_t dims[8] = {3, size, size, size, 1, 1, 1, 1};
+    nifti_image* nii = nifti_make_new_nim(dims, datatype, 1);
+    // NOTE: A 3D header leaves nt at 0, tools loop over time points though
+    nii->dim[4] = 1;
+    nifti_update_dims_from_array(nii);
+    const float dX = PHANTOM_FOV / size;
+    nii->dx = nii->dy = nii->dz = dX;
+    nii->pixdim[1] = nii->pixdim[2] = nii->pixdim[3] = dX;
+    nii->xyz_units = NIFTI_UNITS_MM;
+    nii->qform_code = NIFTI_XFORM_SCANNER_ANAT;
+    nii->quatern_b = nii->quatern_c = nii->quatern_d = 0;
+    nii->qoffset_x = nii->qoffset_y = nii->qoffset_z = 0;
+    nii->qfac = 1;
+    nii->qto_xyz = nifti_quatern_to_dmat44(0, 0, 0, 0, 0, 0, dX, dX, dX, 1);
+    nii->qto_ijk = nifti_dmat44_inverse(nii->qto_xyz);
+    return nii;
+}
+
+static void phantom_write(nifti_image* nii, const string& filename) {
+    nifti_set_filenames(nii, filename.c_str(), 0, 1);
+    nifti_image_write(nii);
+    log_output(filename.c_str());
+}
+
+static void write_phantom(int size, const string& prefix) {
+    nifti_image* rim = phantom_new_nifti(size, NIFTI_TYPE_INT16);
+    nifti_image* act = phantom_new_nifti(size, NIFTI_TYPE_FLOAT32);
+    nifti_image* points = phantom_new_nifti(size, NIFTI_TYPE_INT16);
+    int16_t* rim_data = static_cast<int16_t*>(rim->data);
+    float* act_data = static_cast<float*>(act->data);
+    int16_t* points_data = static_cast<int16_t*>(points->data);
+
+    const float dX = PHANTOM_FOV / size;
+    const float center = (size - 1) * 0.5;
+    // Borders are slightly thicker than a voxel diagonal so that they are
+    // closed under 26 connectivity.
+    const float border = 1.8 * dX;
+    const float half_voxel = 0.9 * dX;
+    const float mid_depth = PHANTOM_THICKNESS * 0.5;
+
+    #pragma omp parallel for
+    for (int iz = 0; iz < size; ++iz) {
+        for (int iy = 0; iy < size; ++iy) {
+            for (int ix = 0; ix < size; ++ix) {
+                int64_t i = (static_cast<int64_t>(iz) * size + iy) * size + ix;
+                float x = (ix - center) * dX;
+                float y = (iy - center) * dX;
+                float z = (iz - center) * dX;
+                float r = sqrt(x * x + y * y + z * z);
+                if (r == 0) {
+                    continue;
+                }
+                float r_in = phantom_inner_radius(x, y, z, r);
+                float depth = r - r_in;  // 0 at white matter, thickness at CSF
+
+                if (depth > PHANTOM_THICKNESS && depth <= PHANTOM_THICKNESS + border) {
+                    *(rim_data + i) = 1;
+                } else if (depth <= 0 && depth > -border) {
+                    *(rim_data + i) = 2;
+                } else if (depth > 0 && depth <= PHANTOM_THICKNESS) {
+                    *(rim_data + i) = 3;
+                    if (abs(depth - mid_depth) <= half_voxel) {
+                        *(points_data + i) = 1;
+                    }
+                }
+
+                // Columnar pattern along the surface, stronger towards CSF
+                float pattern = sin(x * 1.5) * sin(y * 1.5) * cos(z * 0.75);
+                float layer = depth / PHANTOM_THICKNESS;
+                *(act_data + i) = 100 + 20 * pattern * (0.5 + layer)
+                                  + 5 * phantom_noise(i);
+            }
+        }
+    }
+
+    // Origin of UV coordinates: mid gray matter voxel at the top pole
+    int ic = static_cast<int>(center + 0.5);
+    int iz_top = static_cast<int>(center + (PHANTOM_RADIUS + mid_depth) / dX + 0.5);
+    if (iz_top >= size) iz_top = size - 1;
+    int64_t i_top = (static_cast<int64_t>(iz_top) * size + ic) * size + ic;
+    *(rim_data + i_top) = 3;
+    *(points_data + i_top) = 2;
+
+    phantom_write(rim, prefix + "_rim.nii.gz");
+    phantom_write(act, prefix + "_act.nii.gz");
+    phantom_write(points, prefix + "_control_points.nii.gz");
+    nifti_image_free(rim);
+    nifti_image_free(act);
+    nifti_image_free(points);
+}
+
+// ============================================================================
+// Stage runner
+// ============================================================================
+struct StageResult {
+    double wall_s;
+    double peak_rss_mb;
+    int exit_code;
+};
+
+static StageResult run_stage(const vector<string>& args, const string& logfile) {
+    StageResult res = {0, 0, -1};
+    vector<char*> argv;
+    for (const string& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(NULL);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("** fork");
+        return res;
+    }
+    if (pid == 0) {
+        int fd = open(logfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv(argv[0], argv.data());
+        perror("** execv");
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("** wait4");
+        return res;
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    res.wall_s = std::chrono::duration<double>(stop - start).count();
+#ifdef __APPLE__
+    res.peak_rss_mb = usage.ru_maxrss / (1024. * 1024.);  // Bytes
+#else
+    res.peak_rss_mb = usage.ru_maxrss / 1024.;  // Kilobytes
+#endif
+    res.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return res;
+}
+
+static string float_arg(float val) {
+    std::ostringstream ss;
+    ss << val;
+    return ss.str();
+}
+
+static bool file_exists(const string& filename) {
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0;
+}
+
+static int64_t nr_nonzero_voxels(const string& filename) {
+    // Number of non-zero voxels of a stage output, -1 if it can not be read
+    nifti_image* nii = nifti_image_read(filename.c_str(), 1);
+    if (!nii) {
+        return -1;
+    }
+    nifti_image* nii_float = copy_nifti_as_float32(nii);
+    const float* data = static_cast<float*>(nii_float->data);
+    int64_t nr_nonzero = 0;
+    for (int64_t i = 0; i != static_cast<int64_t>(nii_float->nvox); ++i) {
+        if (*(data + i) != 0) {
+            nr_nonzero += 1;
+        }
+    }
+    nifti_image_free(nii_float);
+    nifti_image_free(nii);
+    return nr_nonzero;
+}
+
+// Program arguments of a stage and the files that need non-zero voxels for
+// it to have done any work: inputs from earlier stages and its own output.
+struct Stage {
+    string name;
+    vector<string> args;
+    vector<string> checks;
+};
+
+int main(int argc, char*  argv[]) {
+
+    string sizes_arg = "64,128", bindir = ".", workdir = "benchmark";
+    int nr_threads = 1, nr_columns = 100;
+    bool mode_phantom_only = false, mode_clean = false;
+    int ac;
+    if (argc < 2) {
+        return show_help();
+    }
+    for (ac = 1; ac < argc; ac++) {
+        if (!strncmp(argv[ac], "-h", 2)) {
+            return show_help();
+        } else if (!strcmp(argv[ac], "-sizes")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -sizes\n");
+                return 1;
+            }
+            sizes_arg = argv[ac];
+        } else if (!strcmp(argv[ac], "-bindir")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -bindir\n");
+                return 1;
+            }
+            bindir = argv[ac];
+        } else if (!strcmp(argv[ac], "-workdir")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -workdir\n");
+                return 1;
+            }
+            workdir = argv[ac];
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
+        } else if (!strcmp(argv[ac], "-nr_columns")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -nr_columns\n");
+                return 1;
+            }
+            nr_columns = atoi(argv[ac]);
+        } else if (!strcmp(argv[ac], "-phantom_only")) {
+            mode_phantom_only = true;
+        } else if (!strcmp(argv[ac], "-clean")) {
+            mode_clean = true;
+        } else {
+            fprintf(stderr, "** invalid option, '%s'\n", argv[ac]);
+            return 1;
+        }
+    }
+
+    vector<int> sizes;
+    std::stringstream ss(sizes_arg);
+    string item;
+    while (std::getline(ss, item, ',')) {
+        int s = atoi(item.c_str());
+        if (s < 16) {
+            fprintf(stderr, "** size must be at least 16, '%s'\n", item.c_str());
+            return 1;
+        }
+        sizes.push_back(s);
+    }
+    if (nr_threads < 1) {
+        nr_threads = 1;
+    }
+
+    log_welcome("LN2_BENCHMARK");
+    set_nr_threads(nr_threads);
+    mkdir(workdir.c_str(), 0755);
+
+    const string tsv = workdir + "/benchmark.tsv";
+    bool new_tsv = !file_exists(tsv);
+    std::ofstream report(tsv.c_str(), std::ios::app);
+    if (new_tsv) {
+        report << "size\tstage\tnr_voxels\tthreads\twall_s\tpeak_rss_mb\tvoxels_per_s\texit_code\n";
+    }
+    const string t = std::to_string(nr_threads);
+
+    for (int size : sizes) {
+        const int64_t nr_voxels = static_cast<int64_t>(size) * size * size;
+        const float dX = PHANTOM_FOV / size;
+        const string dir = workdir + "/size" + std::to_string(size);
+        const string p = dir + "/phantom";
+        mkdir(dir.c_str(), 0755);
+
+        cout << "\n  Size " << size << "^3 (" << nr_voxels << " voxels, "
+             << dX << " mm)" << endl;
+        cout << "  Writing phantom..." << endl;
+        auto start = std::chrono::steady_clock::now();
+        write_phantom(size, p);
+        auto stop = std::chrono::steady_clock::now();
+        cout << "    Took " << std::chrono::duration<double>(stop - start).count()
+             << " s" << endl;
+        if (mode_phantom_only) {
+            continue;
+        }
+
+        const string rim = p + "_rim.nii.gz";
+        const string act = p + "_act.nii.gz";
+        const string cp = p + "_control_points.nii.gz";
+        vector<Stage> stages = {
+            {"LN2_LAYERS", {bindir + "/LN2_LAYERS", "-rim", rim, "-nr_layers", "3"},
+                {p + "_rim_layers_equidist.nii.gz"}},
+            {"LN2_COLUMNS", {bindir + "/LN2_COLUMNS", "-rim", rim,
+                "-midgm", p + "_rim_midGM_equidist.nii.gz",
+                "-nr_columns", std::to_string(nr_columns)},
+                {p + "_rim_midGM_equidist.nii.gz",
+                 p + "_rim_columns" + std::to_string(nr_columns) + ".nii.gz"}},
+            {"LN2_LAYER_SMOOTH", {bindir + "/LN2_LAYER_SMOOTH", "-input", act,
+                "-layer_file", p + "_rim_layers_equidist.nii.gz",
+                "-FWHM", float_arg(2 * dX), "-threads", t},
+                {p + "_rim_layers_equidist.nii.gz",
+                 p + "_act_layer_smoothed.nii.gz"}},
+            {"LN2_MULTILATERATE", {bindir + "/LN2_MULTILATERATE", "-rim", rim,
+                "-control_points", cp, "-radius", float_arg(PHANTOM_RADIUS),
+                "-threads", t},
+                {p + "_rim_UV_coordinates.nii.gz"}},
+            {"LN2_UVD_FILTER", {bindir + "/LN2_UVD_FILTER", "-values", act,
+                "-coord_uv", p + "_rim_UV_coordinates.nii.gz",
+                "-coord_d", p + "_rim_metric_equidist.nii.gz",
+                "-domain", p + "_rim_perimeter_chunk.nii.gz",
+                "-radius", float_arg(3 * dX), "-height", "0.25", "-threads", t},
+                {p + "_rim_UV_coordinates.nii.gz",
+                 p + "_rim_metric_equidist.nii.gz",
+                 p + "_rim_perimeter_chunk.nii.gz",
+                 p + "_act_UVD_median_filter.nii.gz"}}
+        };
+
+        cout << "  " << std::left << std::setw(20) << "Stage"
+             << std::right << std::setw(10) << "Wall [s]"
+             << std::setw(14) << "Peak RSS [MB]"
+             << std::setw(14) << "Voxels/s" << endl;
+        for (auto& stage : stages) {
+            const string logfile = dir + "/" + stage.name + ".log";
+            StageResult res = run_stage(stage.args, logfile);
+            double voxels_per_s = res.wall_s > 0 ? nr_voxels / res.wall_s : 0;
+
+            // NOTE: Stages with empty inputs or outputs (e.g. no layers) did
+            // not do the work that is benchmarked, their times are not recorded.
+            string empty_file;
+            if (res.exit_code == 0) {
+                for (const string& f : stage.checks) {
+                    if (nr_nonzero_voxels(f) <= 0) {
+                        empty_file = f;
+                        break;
+                    }
+                }
+            }
+            const bool is_empty = !empty_file.empty();
+
+            cout << "  " << std::left << std::setw(20) << stage.name
+                 << std::right << std::fixed << std::setprecision(2);
+            if (is_empty) {
+                cout << std::setw(10) << "-" << std::setw(14) << "-"
+                     << std::setw(14) << "-"
+                     << "  (empty " << empty_file << ")";
+            } else {
+                cout << std::setw(10) << res.wall_s
+                     << std::setw(14) << res.peak_rss_mb
+                     << std::setw(14) << std::setprecision(0) << voxels_per_s;
+            }
+            if (res.exit_code != 0) {
+                cout << "  (failed, exit " << res.exit_code << ", see " << logfile << ")";
+            }
+            cout << std::defaultfloat << std::setprecision(6) << endl;
+
+            report << size << "\t" << stage.name << "\t" << nr_voxels << "\t"
+                   << nr_threads << "\t";
+            if (is_empty) {
+                report << "NA\tNA\tNA\t";
+            } else {
+                report << res.wall_s << "\t" << res.peak_rss_mb << "\t"
+                       << voxels_per_s << "\t";
+            }
+            report << res.exit_code << "\n";
+            report.flush();
+        }
+
+        if (mode_clean) {
+            // NOTE: Only the stage logs are kept
+            string cmd = "rm -f '" + dir + "'/*.nii.gz";
+            if (system(cmd.c_str()) != 0) {
+                cout << "  Could not clean " << dir << endl;
+            }
+        }
+    }
+
+    cout << "\n  Results appended to " << tsv << endl;
+    cout << "  Finished." << endl;
+    return 0;
+}
@@ -115,23 +115,12 @@ int main(int argc, char*  argv[]) {
     const uint32_t size_y = nii1->ny;
     const uint32_t size_z = nii1->nz;
 
-    const uint32_t end_x = size_x - 1;
-    const uint32_t end_y = size_y - 1;
-    const uint32_t end_z = size_z - 1;
-
     const uint32_t nr_voxels = size_z * size_y * size_x;
 
     const float dX = nii1->pixdim[1];
     const float dY = nii1->pixdim[2];
     const float dZ = nii1->pixdim[3];
 
-    // Short diagonals
-    const float dia_xy = sqrt(dX * dX + dY * dY);
-    const float dia_xz = sqrt(dX * dX + dZ * dZ);
-    const float dia_yz = sqrt(dY * dY + dZ * dZ);
-    // Long diagonals
-    const float dia_xyz = sqrt(dX * dX + dY * dY + dZ * dZ);
-
     // ========================================================================
     // Fix input datatype issues
     nifti_image* nii_layers = copy_nifti_as_int16(nii1);
@@ -187,316 +176,19 @@ int main(int argc, char*  argv[]) {
         }
     }
 
-    uint16_t grow_step = 1;
-    uint32_t voxel_counter = nr_voxels;
-    uint32_t ix, iy, iz, j, k;
-    float d;
-    while (voxel_counter != 0) {
-        cout << "\r  Growing step " << grow_step << "......"  << flush;
-        voxel_counter = 0;
-        for (uint32_t i = 0; i != nr_voxels; ++i) {
-
-            if (*(step_data + i) == grow_step) {
-                tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                voxel_counter += 1;
-
-                // ------------------------------------------------------------
-                // 1-jump neighbours (faces of cube)
-                // ------------------------------------------------------------
-                if (ix > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dX;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x) {
-                    j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dX;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dY;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy < end_y) {
-                    j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dY;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iz > 0) {
-                    j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dZ;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iz < end_z) {
-                    j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dZ;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 2-jump neighbours (edges of cube)
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xy;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y) {
-                    j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xy;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xy;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y) {
-                    j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xy;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_yz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_yz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_yz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_yz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 3-jump neighbours (corners of cube)
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j)  || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_layers_data + j) == 0) {
-                        d = *(dist_data + i) + dia_xyz;
-                        if (d < *(dist_data + j) || *(dist_data + j) == 0) {
-                            *(dist_data + j) = d;
-                            *(step_data + j) = grow_step + 1;
-                        }
-                    }
-                }
-            }
+    vector<uint32_t> frontier;
+    for (uint32_t i = 0; i != nr_voxels; ++i) {
+        if (*(step_data + i) == 1) {
+            frontier.push_back(i);
         }
-        grow_step += 1;
     }
 
+    const Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
+    uint32_t nr_steps = flood_geodesic_26(
+        nb, frontier, [&](uint32_t j) { return *(nii_layers_data + j) == 0; },
+        dist_data, step_data);
+    cout << "  Number of growing steps = " << nr_steps << endl;
+
     if (mode_debug) {
         save_output_nifti(fout, "step", step, false);
         save_output_nifti(fout, "dist", dist, false);
@@ -149,12 +149,7 @@ int main(int argc, char*  argv[]) {
     const float dY = nii1->pixdim[2];
     const float dZ = nii1->pixdim[3];
 
-    // Short diagonals
-    const float dia_xy = sqrt(dX * dX + dY * dY);
-    const float dia_xz = sqrt(dX * dX + dZ * dZ);
-    const float dia_yz = sqrt(dY * dY + dZ * dZ);
-    // Long diagonals
-    const float dia_xyz = sqrt(dX * dX + dY * dY + dZ * dZ);
+    const Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
 
     // ========================================================================
     // Fix input datatype issues
@@ -217,6 +212,8 @@ int main(int argc, char*  argv[]) {
     for (uint32_t i = 0; i != nr_voxels; ++i) {
         if (*(nii_midgm_data + i) == 1){
             nr_voi += 1;
+        } else {
+            *(nii_midgm_data + i) = 0;
         }
     }
     // Allocate memory to only the voxel of interest
@@ -236,219 +233,10 @@ int main(int argc, char*  argv[]) {
     // Find connected clusters to initialize one voxel in each
     // ========================================================================
     cout << "  Start finding connected clusters..." << endl;
+    ConnectedClusters cc = connected_clusters(nb, 26, nii_midgm_data);
+    cout << "    Nr. of connected clusters within midgm input: "
+        << cc.nr_clusters << endl;
 
-    // Loop until all clusters have one initial voxel
-    uint32_t voxel_counter = 0, prev_voxel_counter = 0;
-    int32_t init_voxel_id = 1;
-    bool terminate_switch1 = true;
-    while (terminate_switch1) {
-        uint32_t ix, iy, iz, i, j;
-
-        if (voxel_counter == nr_voi) {
-            // Indicates all clusters are reached. Terminate condition.
-            terminate_switch1 = false;
-            cout << "    Nr. of connected clusters within midgm input: "
-                << init_voxel_id - 1 << endl;
-        } else if (voxel_counter == prev_voxel_counter) {
-            // Find the initial voxel for each disconnected cluster
-            uint32_t start_voxel;
-            for (uint32_t i = 0; i != nr_voxels; ++i) {
-                if (*(nii_midgm_data + i) == 1) {
-                    start_voxel = i;
-                }
-            }
-            voxel_counter += 1;
-            init_voxel_id += 1;
-            *(nii_midgm_data + start_voxel) = init_voxel_id;
-        }
-
-        while (prev_voxel_counter != voxel_counter) {
-            prev_voxel_counter = voxel_counter;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                // Map subset to full set
-                i = *(voi_id + ii);
-                if (*(nii_midgm_data + i) == init_voxel_id) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            *(nii_midgm_data + j) = init_voxel_id;
-                        }
-                    }
-                }
-            }
-
-            // Count cluster assigned voxels
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                i = *(voi_id + ii);  // Map subset to full set
-                if (*(nii_midgm_data + i) > 1) {
-                    voxel_counter += 1;
-                }
-            }
-        }
-    }
     if (mode_debug) {
         save_output_nifti(fout, "connected_clusters", nii_midgm, false);
     }
@@ -457,407 +245,38 @@ int main(int argc, char*  argv[]) {
     // Find column centers through farthest flood distance
     // ========================================================================
     cout << "  Start generating columns..." << endl;
-    // Find the initial voxel
-    uint32_t start_voxel;
-    for (int32_t n = 2; n <= init_voxel_id; ++n) {
-        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-            uint32_t i = *(voi_id + ii);  // Map subset to full set
-            if (*(nii_midgm_data + i) == n) {
-                start_voxel = i;
-                *(nii_midgm_data + i) = 1;  // Reset midgm
-            }
+    // The highest voxel index of each cluster is its initial voxel
+    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+        *(nii_midgm_data + *(voi_id + ii)) = 1;  // Reset
+    }
+    for (uint32_t n = 0; n != cc.nr_clusters; ++n) {
+        *(nii_midgm_data + cc.last_voxel[n]) = 2;
+    }
+
+    // Seeds are the initial voxel of each cluster and the given columns
+    FarthestPoints fp = farthest_points(voi_id, nr_voi, flood_dist_data,
+                                        flood_step_data);
+    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+        uint32_t i = *(voi_id + ii);  // Map subset to full set
+        if (*(nii_midgm_data + i) == 2 || *(nii_columns_data + i) != 0) {
+            farthest_points_add_seed(fp, nb, i,
+                [&](uint32_t j) { return *(nii_midgm_data + j) != 0; });
         }
-        *(nii_midgm_data + start_voxel) = 2;  // Reduce to single initial voxel
     }
 
-    // Initialize new voxel
+    // Loop until desired number of columns reached. Each new column is
+    // the voxel farthest from all seeds so far.
     uint32_t new_voxel_id;
-    float flood_dist_thr = std::numeric_limits<float>::infinity();
-
-    // Loop until desired number of columns reached
     for (int32_t n = max_column_id; n < nr_columns; ++n) {
         cout << "\r    Column [" << n+1 << "/" << nr_columns << "]" << flush;
-
-        int32_t grow_step = 1;
-        voxel_counter = 1;
-        uint32_t ix, iy, iz, i, j;
-        float d;
-
-        // Initialize grow volume
-        for (uint32_t i = 0; i != nr_voxels; ++i) {
-            if (*(nii_midgm_data + i) == 2) {
-                *(flood_step_data + i) = 1.;
-                *(flood_dist_data + i) = 0.;
-            } else if (*(flood_dist_data + i) >= flood_dist_thr
-                       && *(flood_dist_data + i) > 0) {
-                *(flood_step_data + i) = 0.;
-                *(flood_dist_data + i) = 0.;
-                *(nii_midgm_data + i) = 1;
-            } else if (*(flood_dist_data + i) < flood_dist_thr
-                       && *(flood_dist_data + i) > 0) {
-                *(nii_midgm_data + i) = 0;  // no need to recompute
-            }
+        if (!farthest_points_next(fp, &new_voxel_id)) {
+            cout << "\n    Every voxel is already a column, stopping." << flush;
+            break;
         }
-
-        while (voxel_counter != 0) {
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                // Map subset to full set
-                i = *(voi_id + ii);
-                if (*(flood_step_data + i) == grow_step) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                    voxel_counter += 1;
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_midgm_data + j) == 1) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                new_voxel_id = j;
-                            }
-                        }
-                    }
-                }
-            }
-            grow_step += 1;
-        }
-        flood_dist_thr = *(flood_dist_data + new_voxel_id) / 2.;
+        farthest_points_add_seed(fp, nb, new_voxel_id,
+            [&](uint32_t j) { return *(nii_midgm_data + j) != 0; });
         *(nii_midgm_data + new_voxel_id) = 2;
-        *(nii_columns_data + new_voxel_id) = n+1;
+        *(nii_columns_data + new_voxel_id) = n + 1;
 
         // Remove the initial voxel (reduces arbitrariness of the 1st point)
         // NOTE(Faruk): This step guarantees to start from extrememums. The
@@ -922,384 +341,23 @@ int main(int argc, char*  argv[]) {
         }
     }
 
-    int32_t grow_step = 1;
-    voxel_counter = 1;
-    uint32_t ix, iy, iz, i, j;
-    float d;
-    voxel_counter = nr_voxels;
-    while (voxel_counter != 0) {
-        voxel_counter = 0;
-        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-            i = *(voi_id + ii);
-            if (*(flood_step_data + i) == grow_step) {
-                tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                voxel_counter += 1;
-
-                bool jump_lock = false;
-                // ------------------------------------------------------------
-                // 1-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dX;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-                if (ix < end_x) {
-                    j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dX;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-                if (iy > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dY;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-                if (iy < end_y) {
-                    j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dY;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-                if (iz > 0) {
-                    j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dZ;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-                if (iz < end_z) {
-                    j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(flood_dist_data + i) + dZ;
-                        if (d < *(flood_dist_data + j)
-                            || *(flood_dist_data + j) == 0) {
-                            *(flood_dist_data + j) = d;
-                            *(flood_step_data + j) = grow_step + 1;
-                            *(nii_columns_data + j) = *(nii_columns_data + i);
-                        }
-                    } else if (*(nii_rim_data + j) != 0) {
-                        jump_lock = true;
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 2-jump neighbours
-                // ------------------------------------------------------------
-                if (jump_lock == false) {
-
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-
-                    // ------------------------------------------------------------
-                    // 3-jump neighbours
-                    // ------------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(nii_columns_data + j) = *(nii_columns_data + i);
-                            }
-                        }
-                    }
-                }
-            }
+    vector<uint32_t> frontier;
+    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+        uint32_t i = *(voi_id + ii);
+        if (*(flood_step_data + i) == 1) {
+            frontier.push_back(i);
         }
-        grow_step += 1;
     }
 
+    // Diagonal jumps are not taken next to a rim border voxel
+    flood_geodesic_26(nb, frontier,
+                      [&](uint32_t j) { return *(nii_rim_data + j) == 3; },
+                      [&](uint32_t j) { return *(nii_rim_data + j) != 0; },
+                      flood_dist_data, flood_step_data, nii_columns_data,
+                      static_cast<int32_t*>(NULL),
+                      static_cast<uint32_t*>(NULL));
+    uint32_t ix, iy, iz, j;
+
 
     // ========================================================================
     // Voronoi cell flood into borders of Rim file, if -include borders option is used.
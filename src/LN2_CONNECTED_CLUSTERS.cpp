@@ -1,5 +1,6 @@
 
 #include "../dep/laynii_lib.h"
+#include <fstream>
 #include <sstream>
 
 int show_help(void) {
@@ -8,11 +9,16 @@ int show_help(void) {
     "\n"
     "Usage:\n"
     "    LN2_CONNECTED_CLUSTERS -input input.nii\n"
-    "    ../LN2_CONNECTED_CLUSTERS -input input.nii\n"
+    "    ../LN2_CONNECTED_CLUSTERS -input input.nii -connectivity 6 -stats\n"
     "\n"
     "Options:\n"
     "    -help         : Show this help.\n"
     "    -input        : Binary nifti image (only consists of 0s and 1s).\n"
+    "    -connectivity : (Optional) Neighbourhood of a voxel. 6 (faces),\n"
+    "                    18 (faces and edges) or 26 (faces, edges and\n"
+    "                    corners). Default is 26.\n"
+    "    -stats        : (Optional) Write the number of voxels and the bounding\n"
+    "                    box (voxel indices) of each cluster into a text file.\n"
     "    -output       : (Optional) Output basename for all outputs.\n"
     "\n");
     return 0;
@@ -22,7 +28,8 @@ int main(int argc, char*  argv[]) {
 
     nifti_image *nii1 = NULL;
     char *fin1 = NULL, *fout = NULL;
-    int ac;
+    int ac, connectivity = 26;
+    bool mode_stats = false;
 
     // Process user options
     if (argc < 2) return show_help();
@@ -36,6 +43,18 @@ int main(int argc, char*  argv[]) {
             }
             fin1 = argv[ac];
             fout = argv[ac];
+        } else if (!strcmp(argv[ac], "-connectivity")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -connectivity\n");
+                return 1;
+            }
+            connectivity = atoi(argv[ac]);
+            if (connectivity != 6 && connectivity != 18 && connectivity != 26) {
+                fprintf(stderr, "** -connectivity must be 6, 18 or 26\n");
+                return 1;
+            }
+        } else if (!strcmp(argv[ac], "-stats")) {
+            mode_stats = true;
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -68,274 +87,44 @@ int main(int argc, char*  argv[]) {
     const uint32_t size_y = nii1->ny;
     const uint32_t size_z = nii1->nz;
 
-    const uint32_t end_x = size_x - 1;
-    const uint32_t end_y = size_y - 1;
-    const uint32_t end_z = size_z - 1;
-
-    const uint32_t nr_voxels = size_z * size_y * size_x;
+    const Neighbours26 nb = neighbours_26(size_x, size_y, size_z, 1, 1, 1);
 
     // ========================================================================
     // Fix input datatype issues
     nifti_image* nii_input = copy_nifti_as_int32(nii1);
     int32_t* nii_input_data = static_cast<int32_t*>(nii_input->data);
 
-    // ------------------------------------------------------------------------
-    // NOTE(Faruk): This section is written to constrain the big iterative
-    // flooding distance loop to the subset of voxels. Required for substantial
-    // speed boost.
-    // Find the subset voxels that will be used many times
-    uint32_t nr_voi = 0;  // Voxels of interest
-    for (uint32_t i = 0; i != nr_voxels; ++i) {
-        if (*(nii_input_data + i) != 0){
-            *(nii_input_data + i) = 1;
-            nr_voi += 1;
-        }
-    }
-    // Allocate memory to only the voxel of interest
-    int32_t* voi_id;
-    voi_id = (int32_t*) malloc(nr_voi*sizeof(int32_t));
-
-    // Fill in indices to be able to remap from subset to full set of voxels
-    uint32_t ii = 0;
-    for (uint32_t i = 0; i != nr_voxels; ++i) {
-        if (*(nii_input_data + i) != 0){
-            *(voi_id + ii) = i;
-            ii += 1;
-        }
-    }
-
     // ========================================================================
     // Find connected clusters
     // ========================================================================
-    cout << "  Start finding connected clusters (3-jump neighbourhood)..." << endl;
+    cout << "  Start finding connected clusters (" << connectivity
+        << " neighbourhood)..." << endl;
+    ConnectedClusters cc = connected_clusters(nb, connectivity, nii_input_data);
+    cout << "  Nr. connected clusters = " << cc.nr_clusters << endl;
 
-    // Loop until all clusters have one initial voxel
-    uint32_t voxel_counter = 0, prev_voxel_counter = 0;
-    int32_t init_voxel_id = 1;
-    bool terminate_switch1 = true;
-    while (terminate_switch1) {
-        uint32_t ix, iy, iz, i, j;
-
-        if (voxel_counter == nr_voi) {
-            // Indicates all clusters are reached. Terminate condition.
-            terminate_switch1 = false;
-            cout << "    Nr. of connected clusters within midgm input: "
-                << init_voxel_id - 1 << endl;
-        } else if (voxel_counter == prev_voxel_counter) {
-            // Find the initial voxel for each disconnected cluster
-            uint32_t start_voxel;
-            for (uint32_t i = 0; i != nr_voxels; ++i) {
-                if (*(nii_input_data + i) == 1) {
-                    start_voxel = i;
-                }
-            }
-            voxel_counter += 1;
-            init_voxel_id += 1;
-            *(nii_input_data + start_voxel) = init_voxel_id;
-        }
-
-        while (prev_voxel_counter != voxel_counter) {
-            prev_voxel_counter = voxel_counter;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                // Map subset to full set
-                i = *(voi_id + ii);
-                if (*(nii_input_data + i) == init_voxel_id) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-                        if (*(nii_input_data + j) == 1) {
-                            *(nii_input_data + j) = init_voxel_id;
-                        }
-                    }
-                }
-            }
+    // Add number of clusters into the output tag
+    std::ostringstream tag;
+    tag << cc.nr_clusters;
+    save_output_nifti(fout, "connected_clusters" + tag.str(), nii_input, true);
 
-            // Count cluster assigned voxels
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                i = *(voi_id + ii);  // Map subset to full set
-                if (*(nii_input_data + i) > 1) {
-                    voxel_counter += 1;
-                }
-            }
+    if (mode_stats) {
+        string path_out = output_path_txt(fout, "connected_clusters" + tag.str() + "_stats");
+        ofstream outf(path_out.c_str());
+        if (!outf) {
+            fprintf(stderr, "** failed to open '%s'\n", path_out.c_str());
+            return 2;
         }
-    }
-    cout << "  Nr. connected clusters = " << init_voxel_id - 1 << endl;
-
-    // Make uniqute cluster ids start from 1 instead of 2
-    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-        uint32_t i = *(voi_id + ii);  // Map subset to full set
-        if (*(nii_input_data + i) != 0) {
-            *(nii_input_data + i) -= 1;
+        outf << "cluster nr_voxels min_x min_y min_z max_x max_y max_z" << endl;
+        for (uint32_t n = 0; n != cc.nr_clusters; ++n) {
+            outf << n + 1 << " " << cc.nr_voxels[n]
+                << " " << cc.min_x[n] << " " << cc.min_y[n] << " " << cc.min_z[n]
+                << " " << cc.max_x[n] << " " << cc.max_y[n] << " " << cc.max_z[n]
+                << endl;
         }
+        outf.close();
+        log_output(path_out.c_str());
     }
 
-    // Add number of clusters into the output tag
-    std::ostringstream tag;
-    tag << init_voxel_id - 1;
-    save_output_nifti(fout, "connected_clusters" + tag.str(), nii_input, true);
-
     cout << "\n  Finished." << endl;
     return 0;
 }
@@ -178,15 +178,14 @@ int main(int argc, char* argv[]) {
     // Fix datatype issues
     nifti_image* nii_input = copy_nifti_as_float32(nii);
     float *nii_input_data = static_cast<float*>(nii_input->data);
+    nifti_image_free(nii);
     nifti_image* nii_layer = copy_nifti_as_float32(nii_layeri);
     float *nii_layer_data = static_cast<float*>(nii_layer->data);
 
-    // Allocate new niftis
-    nifti_image *nii_output = copy_nifti_as_float32(nii_input);
-    float *nii_output_data = static_cast<float*>(nii_output->data);
-    for (int i = 0; i < nr_voxels * size_t; ++i) {
-        *(nii_output_data + i) = 0;
-    }
+    // NOTE: Results are written in place of the input time series, so that
+    // only one 4D float copy is kept (and one transpose in column mode).
+    nifti_image *nii_output = nii_input;
+    float *nii_output_data = nii_input_data;
 
     // ------------------------------------------------------------------------
     // Find input value ranges
@@ -253,6 +252,8 @@ int main(int argc, char* argv[]) {
                     }
 
                     *(nii_output_data + j) = *(nii_input_data + j) * l;
+                } else {
+                    *(nii_output_data + j) = 0;
                 }
             }
         }
@@ -315,54 +316,64 @@ int main(int argc, char* argv[]) {
         // ====================================================================
         // Do deconvolution column by column. First, I allocate all.
         // ====================================================================
-        float vec1[nr_layers][size_t], vec2[nr_layers][size_t], vecALF[nr_layers];
-        int vec_nr_voxels[nr_layers];
-
-        for (int i = 0; i < nr_layers; ++i) {
-            for (int t = 0; t < size_t; t++) {
-                vec1[i][t] = 0.;
-                vec2[i][t] = 0.;
+        // NOTE: Layer x time tables are on the heap (layer-major), long time
+        // series would overflow the stack otherwise.
+        vector<float> vec1(nr_layers * size_t), vec2(nr_layers * size_t);
+        vector<float> vecALF(nr_layers);
+        vector<int> vec_nr_voxels(nr_layers);
+
+        // NOTE: Time series are handled voxel-major (size_t * voxel + t)
+        // within the column loop, so that they are contiguous in memory. A
+        // column is written over its own time series after all of them have
+        // been averaged, voxels outside of columns are set to zero.
+        vector<float> column_ts(static_cast<int64_t>(nr_voxels) * size_t);
+        transpose_blocked(nii_input_data, column_ts.data(), size_t, nr_voxels);
+        for (int ivox = 0; ivox < nr_voxels; ++ivox) {
+            if (*(nii_column_data + ivox) <= 0) {
+                fill(column_ts.begin() + static_cast<int64_t>(size_t) * ivox,
+                     column_ts.begin() + static_cast<int64_t>(size_t) * (ivox + 1),
+                     0.);
             }
-            vecALF[i] = 0.;
-            vec_nr_voxels[i] = 0;
         }
 
+        // Voxels of each column, so that the loop below only visits them
+        LabelIndex column_index = label_index(nr_voxels, nr_columns,
+            [&](uint32_t i) { return *(nii_column_data + i); });
+
         // ====================================================================
         // Big loop across columns
         // ====================================================================
         for (int icol = 1; icol <= nr_columns; ++icol) {
+            const uint32_t col_start = column_index.start[icol - 1];
+            const uint32_t col_end = column_index.start[icol];
 
             // Reset vector
-            for (int i = 0; i < nr_layers; ++i) {
-                for (int t = 0; t < size_t; t++){
-                    vec1[i][t] = 0.;
-                    vec2[i][t] = 0.;
-                }
-                vecALF[i] = 0.;
-                vec_nr_voxels[i] = 0;
-            }
+            fill(vec1.begin(), vec1.end(), 0.);
+            fill(vec2.begin(), vec2.end(), 0.);
+            fill(vecALF.begin(), vecALF.end(), 0.);
+            fill(vec_nr_voxels.begin(), vec_nr_voxels.end(), 0);
 
             // Fill vector of column #icol
-            for (int ivox = 0; ivox < nr_voxels; ++ivox) {
-                if (icol == *(nii_column_data + ivox)) {
-                    int i = *(nii_layer_data + ivox) - 1;  // current layer
+            for (uint32_t k = col_start; k != col_end; ++k) {
+                int ivox = column_index.ids[k];
+                int i = *(nii_layer_data + ivox) - 1;  // current layer
 
-                    if (!mode_linear) {
-                        vecALF[i] += *(nii_ALF_data + ivox);
-                    }
+                if (!mode_linear) {
+                    vecALF[i] += *(nii_ALF_data + ivox);
+                }
 
-                    vec_nr_voxels[i] += 1;
+                vec_nr_voxels[i] += 1;
 
-                    for (int t = 0; t < size_t; t++) {
-                        vec1[i][t] += *(nii_input_data + t * nr_voxels + ivox);
-                    }
+                const float* ts = &column_ts[static_cast<int64_t>(size_t) * ivox];
+                for (int t = 0; t < size_t; t++) {
+                    vec1[i * size_t + t] += *(ts + t);
                 }
             }
 
             // Get mean of values within column vector
             for (int i = 0; i < nr_layers; ++i) {
                 for (int t = 0; t < size_t; t++) {
-                    vec1[i][t] /= (float)vec_nr_voxels[i];
+                    vec1[i * size_t + t] /= (float)vec_nr_voxels[i];
                 }
                 vecALF[i] /= (float)vec_nr_voxels[i];
             }
@@ -389,7 +400,7 @@ int main(int argc, char* argv[]) {
                 for (int i = 0; i < nr_layers; ++i) {
                     if (mode_CBV) {  // Just CBV normalization
                         if (vec_nr_voxels[i] > 0) {
-                            vec2[i][t] = vec1[i][t] / vecALF[i] * (float)nr_layers;
+                            vec2[i * size_t + t] = vec1[i * size_t + t] / vecALF[i] * (float)nr_layers;
                         }
                     } else {  // Deconvolution
                         // Macrovascular contribution value, that needs to be
@@ -400,26 +411,27 @@ int main(int argc, char* argv[]) {
                             // Lambda is the inverse of peak to tail ratio
                             // from from Markuerkiaga et al. 2016 Fig. 5B at 7T.
                             if (vec_nr_voxels[j] > 0) {
-                                sum += vec1[j][t] / (float)nr_layers / vecALF[j] * lambda;
+                                sum += vec1[j * size_t + t] / (float)nr_layers / vecALF[j] * lambda;
                             }
                         }
                         if (vec_nr_voxels[i] > 0) {
-                            vec2[i][t] = (vec1[i][t] - sum);
+                            vec2[i * size_t + t] = (vec1[i * size_t + t] - sum);
                         }
                     }
                 }
             }
 
             // Fill file with the deconvolved values
-            for (int ivox = 0; ivox < nr_voxels; ++ivox) {
-                if (icol == *(nii_column_data + ivox)) {
-                    int i = *(nii_layer_data + ivox) - 1;
-                    for (int t = 0; t < size_t; t++) {
-                        *(nii_output_data + t * nr_voxels + ivox ) = vec2[i][t];
-                    }
+            for (uint32_t k = col_start; k != col_end; ++k) {
+                int ivox = column_index.ids[k];
+                int i = *(nii_layer_data + ivox) - 1;
+                float* ts = &column_ts[static_cast<int64_t>(size_t) * ivox];
+                for (int t = 0; t < size_t; t++) {
+                    *(ts + t) = vec2[i * size_t + t];
                 }
             }
         }
+        transpose_blocked(column_ts.data(), nii_output_data, nr_voxels, size_t);
     }
 
     // ------------------------------------------------------------------------
@@ -1,4 +1,5 @@
 #include "../dep/laynii_lib.h"
+#include <fstream>
 #include <limits>
 #include <sstream>
 
@@ -15,7 +16,9 @@ int show_help(void) {
     "    -coord_uv : A 4D nifti file that contains 2D (UV) coordinates.\n"
     "                For example LN2_MULTILATERATE output named 'UV_coords'.\n"
     "    -radius   : Radius of the circle inscribed within hexagons.\n"
-    "                In UV coordinate metric units (e.g. mm)."
+    "                In UV coordinate metric units (e.g. mm).\n"
+    "    -counts   : (Optional) Write the center and the number of voxels of\n"
+    "                each non-empty bin into a text file.\n"
     "    -output   : (Optional) Output basename for all outputs.\n"
     "\n");
     return 0;
@@ -27,6 +30,7 @@ int main(int argc, char*  argv[]) {
     char *fin1 = NULL, *fout = NULL;
     int ac;
     float radius = 10;
+    bool mode_counts = false;
 
     // Process user options
     if (argc < 2) return show_help();
@@ -46,6 +50,8 @@ int main(int argc, char*  argv[]) {
                 return 1;
             }
             radius = atof(argv[ac]);
+        } else if (!strcmp(argv[ac], "-counts")) {
+            mode_counts = true;
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -195,30 +201,69 @@ int main(int argc, char*  argv[]) {
     // ========================================================================
     // Evaluate each voxel agains hexbin centers to find closest center
     // ========================================================================
+    // NOTE: Even and odd rows are two rectangular lattices (rows 2*step_v
+    // apart, odd ones shifted by half a step). In a finite rectangular
+    // lattice the closest center is found by rounding and clamping each
+    // coordinate, so only the centers around the rounded ones of both
+    // lattices are compared instead of all bins. Distances and ties (lowest
+    // bin wins) are evaluated as in comparing against every bin.
+    vector<uint32_t> bin_counts(nr_bins, 0);
     for (int ii = 0; ii != nr_voi; ++ii) {
         int i = *(voi_id + ii);
+        if (nr_bins == 0) break;
 
         float coord_u = *(nii_input_data + nr_voxels*0 + i);
         float coord_v = *(nii_input_data + nr_voxels*1 + i);
 
-        // Compute distance to each bin center
         float min_dist = std::numeric_limits<float>::max();
-        for (int32_t j = 0; j != nr_bins; j++) {
-            float bin_u = arr_centers_u[j];
-            float bin_v = arr_centers_v[j];
-
-            float dist = sqrt(pow(coord_u - bin_u, 2) + pow(coord_v - bin_v, 2));
-            if (dist < min_dist) {
-                min_dist = dist;
-                *(nii_bins_data + i) = j;
+        int32_t min_bin = 0;
+        for (int parity = 0; parity < 2 && parity < nr_bins_v; ++parity) {
+            float shift_u = parity == 0 ? 0 : step_u / 2;
+            int nr_rows = (nr_bins_v - parity + 1) / 2;
+            int iu = ceil((coord_u - min_u - shift_u) / step_u - 0.5);
+            int iv = ceil((coord_v - min_v - step_v * parity) / (2 * step_v) - 0.5);
+            iu = max(0, min(iu, nr_bins_u - 1));
+            iv = max(0, min(iv, nr_rows - 1));
+
+            for (int jv = max(0, iv - 1); jv <= min(iv + 1, nr_rows - 1); ++jv) {
+                for (int ju = max(0, iu - 1); ju <= min(iu + 1, nr_bins_u - 1); ++ju) {
+                    int32_t j = (2 * jv + parity) * nr_bins_u + ju;
+                    float bin_u = arr_centers_u[j];
+                    float bin_v = arr_centers_v[j];
+
+                    float dist = sqrt(pow(coord_u - bin_u, 2) + pow(coord_v - bin_v, 2));
+                    if (dist < min_dist || (dist == min_dist && j < min_bin)) {
+                        min_dist = dist;
+                        min_bin = j;
+                    }
+                }
             }
         }
+        *(nii_bins_data + i) = min_bin;
+        bin_counts[min_bin] += 1;
     }
 
     std::ostringstream tag;
     tag << radius;
     save_output_nifti(fout, "hexbins"+tag.str(), nii_bins, true);
 
+    if (mode_counts) {
+        string path_out = output_path_txt(fout, "hexbins" + tag.str() + "_counts");
+        ofstream outf(path_out.c_str());
+        if (!outf) {
+            fprintf(stderr, "** failed to open '%s'\n", path_out.c_str());
+            return 2;
+        }
+        outf << "bin center_u center_v nr_voxels" << endl;
+        for (int32_t j = 0; j != nr_bins; ++j) {
+            if (bin_counts[j] == 0) continue;
+            outf << j << " " << arr_centers_u[j] << " " << arr_centers_v[j]
+                << " " << bin_counts[j] << endl;
+        }
+        outf.close();
+        log_output(path_out.c_str());
+    }
+
     cout << "\n  Finished." << endl;
     return 0;
 }
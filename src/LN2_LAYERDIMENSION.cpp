@@ -173,15 +173,6 @@ int main(int argc, char*  argv[]) {
     cout << "    There are " << nr_layers<< " layers. " << endl ;
     cout << "    There are " << nr_columns<< " columns. " << endl << endl;
 
-    double numb_voxels[nr_layers][nr_columns] ;
-    double mean_val[nr_layers][nr_columns] ;
-    for (int i = 0; i < nr_layers; i++) {
-        for (int j = 0; j < nr_columns; j++) {
-            mean_val   [i][j] = 0.;
-            numb_voxels[i][j] = 0.;
-        }
-    }
-
     // ========================================================================
     // Prepare outputs
     // ========================================================================
@@ -210,29 +201,49 @@ int main(int argc, char*  argv[]) {
     // ========================================================================
     // Average within columns and layers
     // ========================================================================
+    // NOTE: Each occupied (layer, column) pair is one group, keyed as
+    // (layer - 1) * nr_columns + column. Only occupied pairs are stored.
+    auto group_key = [&](int lay, int col) -> int64_t {
+        return (lay > 0 && col > 0)
+            ? static_cast<int64_t>(lay - 1) * nr_columns + col : 0;
+    };
+    vector<int64_t> group_keys = sparse_keys(nr_voxels, [&](uint32_t i) {
+        return group_key(*(layers_data + i), *(columns_data + i));
+    });
+    cout << "    There are " << group_keys.size()
+         << " occupied layer-column pairs. " << endl << endl;
+
+    // Label every voxel once with its own key
+    unordered_map<int64_t, uint32_t> group_labels = sparse_labels(group_keys);
+    vector<uint32_t> voxel_group(nr_voxels, 0);
     for (int i = 0; i != nr_voxels; ++i) {
-        if ( *(columns_data + i) !=0 && *(layers_data + i) != 0 ){
-            mean_val   [*(layers_data + i) -1 ][ *(columns_data + i) -1 ] += *(nii_input_data + i) ;
-            numb_voxels[*(layers_data + i) -1 ][ *(columns_data + i) -1 ] += 1;
+        int64_t k = group_key(*(layers_data + i), *(columns_data + i));
+        if (k > 0) {
+            voxel_group[i] = group_labels[k];
         }
     }
+    unordered_map<int64_t, uint32_t>().swap(group_labels);
 
-    for (int i = 0; i < nr_layers; i++) {
-        for (int j = 0; j < nr_columns; j++) {
-            if (numb_voxels[i][j] != 0){
-                mean_val[i][j] /= (float)numb_voxels[i][j] ;
-               // cout << "layer " << i+1 << " and column " << j+1 << " has value " << mean_val[i][j] << endl;
-            }
-        }
-    }
+    LabelIndex group_index = label_index(nr_voxels, group_keys.size(),
+        [&](uint32_t i) { return voxel_group[i]; });
+    LabelStats group_stats = label_stats(group_index, nii_input_data);
+
+    // NOTE: Groups of every column, so that the layer profile of a voxel is
+    // read from its own column instead of being searched for layer by layer.
+    LabelIndex column_groups = label_index(group_keys.size(), nr_columns,
+        [&](uint32_t g) { return (group_keys[g] - 1) % nr_columns + 1; });
 
     // ========================================================================
     // Fill average results into layer dimension file
     // ========================================================================
     for (int voxi = 0; voxi < nr_voxels; voxi++) {
-        if ( *(columns_data + voxi) !=0 && *(layers_data + voxi) != 0){
-            for (int l = 0; l < nr_layers; ++l) {
-                *(layerdim_data + nr_voxels * l + voxi) = mean_val[ l ][ *(columns_data + voxi) - 1 ] ;
+        if (voxel_group[voxi] > 0) {
+            int col = *(columns_data + voxi);
+            for (uint32_t j = column_groups.start[col - 1];
+                 j != column_groups.start[col]; ++j) {
+                uint32_t g = column_groups.ids[j];
+                int64_t l = (group_keys[g] - 1) / nr_columns;
+                *(layerdim_data + nr_voxels * l + voxi) = group_stats.mean[g];
             }
             // *(layerdim_data + nr_voxels * 0 + voxi) = voxi;
         }
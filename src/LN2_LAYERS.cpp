@@ -149,22 +149,13 @@ int main(int argc, char*  argv[]) {
     const uint32_t size_y = nii1->ny;
     const uint32_t size_z = nii1->nz;
 
-    const uint32_t end_x = size_x - 1;
-    const uint32_t end_y = size_y - 1;
-    const uint32_t end_z = size_z - 1;
-
     const uint32_t nr_voxels = size_z * size_y * size_x;
 
     const float dX = nii1->pixdim[1];
     const float dY = nii1->pixdim[2];
     const float dZ = nii1->pixdim[3];
 
-    // Short diagonals
-    const float dia_xy = sqrt(dX * dX + dY * dY);
-    const float dia_xz = sqrt(dX * dX + dZ * dZ);
-    const float dia_yz = sqrt(dY * dY + dZ * dZ);
-    // Long diagonals
-    const float dia_xyz = sqrt(dX * dX + dY * dY + dZ * dZ);
+    const Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
 
     // ========================================================================
     // Fix input datatype issues
@@ -252,404 +243,27 @@ int main(int argc, char*  argv[]) {
     cout << "\n  Start growing from inner GM (WM-facing border)..." << endl;
 
     // Initialize grow volume
+    vector<uint32_t> frontier;
     for (uint32_t i = 0; i != nr_voxels; ++i) {
         if (*(nii_rim_data + i) == 2) {  // WM boundary voxels within GM
             *(innerGM_step_data + i) = 1;
             *(innerGM_dist_data + i) = 0.;
             *(innerGM_id_data + i) = i;
+            frontier.push_back(i);
         } else {
             *(innerGM_step_data + i) = 0.;
             *(innerGM_dist_data + i) = 0.;
         }
     }
 
-    uint16_t grow_step = 1;
-    uint32_t voxel_counter = nr_voxels;
-    uint32_t ix, iy, iz, j, k;
-    float d;
-    while (voxel_counter != 0) {
-        voxel_counter = 0;
-        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-            uint32_t i = *(voi_id + ii);
-
-            if (*(innerGM_step_data + i) == grow_step) {
-                tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                voxel_counter += 1;
-
-                // ------------------------------------------------------------
-                // 1-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3) {
-                        d = *(innerGM_dist_data + i) + dX;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x) {
-                    j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dX;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dY;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y) {
-                    j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dY;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iz > 0) {
-                    j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dZ;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iz < end_z) {
-                    j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dZ;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 2-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xy;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y) {
-                    j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xy;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xy;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y) {
-                    j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xy;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_yz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_yz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_yz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_yz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 3-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 1 ) {
-                        d = *(innerGM_dist_data + i) + dia_xyz;
-                        if (d < *(innerGM_dist_data + j)
-                            || *(innerGM_dist_data + j) == 0) {
-                            *(innerGM_dist_data + j) = d;
-                            *(innerGM_step_data + j) = grow_step + 1;
-                            *(innerGM_id_data + j) = *(innerGM_id_data + i);
-                            *(innerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-            }
-        }
-        grow_step += 1;
-    }
+    // Only the voxels updated in the previous step are visited
+    flood_geodesic_26(nb, frontier,
+                      [&](uint32_t j) { return *(nii_rim_data + j) == 3
+                                               || *(nii_rim_data + j) == 1; },
+                      NoJumpLock(), innerGM_dist_data, innerGM_step_data,
+                      innerGM_id_data, innerGM_prevstep_id_data,
+                      static_cast<uint32_t*>(NULL));
+    uint32_t j, k;
     if (mode_debug) {
         save_output_nifti(fout, "innerGM_step", innerGM_step, false);
         save_output_nifti(fout, "innerGM_dist", innerGM_dist, false);
@@ -661,406 +275,25 @@ int main(int argc, char*  argv[]) {
     // ========================================================================
     cout << "\n  Start growing from outer GM..." << endl;
 
+    frontier.clear();
     for (uint32_t i = 0; i != nr_voxels; ++i) {
         if (*(nii_rim_data + i) == 1) {
             *(outerGM_step_data + i) = 1.;
             *(outerGM_dist_data + i) = 0.;
             *(outerGM_id_data + i) = i;
+            frontier.push_back(i);
         } else {
             *(outerGM_step_data + i) = 0.;
             *(outerGM_dist_data + i) = 0.;
         }
     }
 
-    grow_step = 1, voxel_counter = nr_voxels;
-    while (voxel_counter != 0) {
-        voxel_counter = 0;
-        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-            uint32_t i = *(voi_id + ii);
-
-            if (*(outerGM_step_data + i) == grow_step) {
-                tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                voxel_counter += 1;
-
-                // ------------------------------------------------------------
-                // 1-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dX;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x) {
-                    j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dX;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dY;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y) {
-                    j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dY;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iz > 0) {
-                    j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dZ;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iz < end_z) {
-                    j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dZ;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 2-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xy;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y) {
-                    j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xy;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xy;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y) {
-                    j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xy;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_yz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_yz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_yz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_yz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-
-                // ------------------------------------------------------------
-                // 3-jump neighbours
-                // ------------------------------------------------------------
-                if (ix > 0 && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix > 0 && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy > 0 && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz > 0) {
-                    j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-                if (ix < end_x && iy < end_y && iz < end_z) {
-                    j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                    if (*(nii_rim_data + j) == 3 || *(nii_rim_data + j) == 2 ) {
-                        d = *(outerGM_dist_data + i) + dia_xyz;
-                        if (d < *(outerGM_dist_data + j)
-                            || *(outerGM_dist_data + j) == 0) {
-                            *(outerGM_dist_data + j) = d;
-                            *(outerGM_step_data + j) = grow_step + 1;
-                            *(outerGM_id_data + j) = *(outerGM_id_data + i);
-                            *(outerGM_prevstep_id_data + j) = i;
-                        }
-                    }
-                }
-            }
-        }
-        grow_step += 1;
-    }
+    flood_geodesic_26(nb, frontier,
+                      [&](uint32_t j) { return *(nii_rim_data + j) == 3
+                                               || *(nii_rim_data + j) == 2; },
+                      NoJumpLock(), outerGM_dist_data, outerGM_step_data,
+                      outerGM_id_data, outerGM_prevstep_id_data,
+                      static_cast<uint32_t*>(NULL));
     if (mode_debug) {
         save_output_nifti(fout, "outerGM_step", outerGM_step, false);
         save_output_nifti(fout, "outerGM_dist", outerGM_dist, false);
@@ -33,6 +33,12 @@ int show_help(void) {
     "                  is best done with not too many layers. Otherwise a \n"
     "                  single layer has holes and is not connected.\n"
     "                  !!!WARNING!!! this option is not well tested for version 1.5\n"
+    "    -separable  : (Optional) Smooth each layer with three 1D passes \n"
+    "                  (normalized convolution). Much faster for large \n"
+    "                  FWHM. Results match the default up to floating \n"
+    "                  point rounding. Not used together with -NoKissing.\n"
+    "    -threads    : (Optional) Number of threads for parallel loops.\n"
+    "                  Default is 1.\n"
     "    -output     : (Optional) Output filename, including .nii or\n"
     "                  .nii.gz, and path if needed. Overwrites existing files.\n"    
     "\n");
@@ -43,7 +49,8 @@ int main(int argc, char* argv[]) {
     bool use_outpath = false ;
     char *fout = NULL ;
     char *f_input = NULL, *f_layer = NULL;
-    int ac, do_masking = 0, sulctouch = 0;
+    int ac, do_masking = 0, sulctouch = 0, nr_threads = 1;
+    bool do_separable = false;
     float FWHM_val = 0;
     bool twodim = false ;
     if (argc < 3) return show_help();
@@ -72,12 +79,20 @@ int main(int argc, char* argv[]) {
         } else if (!strcmp(argv[ac], "-NoKissing")) {
             sulctouch = 1;
             cout << "Smooth across gyri, might take longer."  << endl;
+        } else if (!strcmp(argv[ac], "-separable")) {
+            do_separable = true;
         } else if( ! strcmp(argv[ac], "-twodim") ) {
            twodim = true;
            cout << "I will do smoothing only in 2D"  << endl;
         } else if (!strcmp(argv[ac], "-mask")) {
             do_masking = 1;
             cout << "Set voxels to zero outside layers (mask option)"  << endl;
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -116,6 +131,7 @@ int main(int argc, char* argv[]) {
     log_welcome("LN2_LAYER_SMOOTH");
     log_nifti_descriptives(nii1);
     log_nifti_descriptives(nii2);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     const int size_z = nii2->nz;
@@ -133,9 +149,11 @@ int main(int argc, char* argv[]) {
 
     // ========================================================================
     // Fix datatype issues
-    nifti_image* nii_input = copy_nifti_as_float32(nii1);
+    convert_nifti_to_float32(nii1);
+    nifti_image* nii_input = nii1;
     float *nii_input_data = static_cast<float*>(nii_input->data);
-    nifti_image* nii_layer = copy_nifti_as_int32(nii2);
+    convert_nifti_to_int32(nii2);
+    nifti_image* nii_layer = nii2;
     int32_t *nii_layer_data = static_cast<int32_t*>(nii_layer->data);
 
     // Allocate new niftis
@@ -156,6 +174,20 @@ int main(int argc, char* argv[]) {
     cout << "  Vicinity = " << vic << endl;
     cout << "  FWHM = " << FWHM_val << endl;
 
+    // Kernel weights only depend on the voxel offsets, compute them once
+    const int kernel_size = 2 * vic + 1;
+    vector<float> kernel(kernel_size * kernel_size * kernel_size);
+    for (int kz = -vic; kz <= vic; ++kz) {
+        for (int ky = -vic; ky <= vic; ++ky) {
+            for (int kx = -vic; kx <= vic; ++kx) {
+                float d = dist(0, 0, 0, (float)kx, (float)ky, (float)kz,
+                               dX, dY, dZ);
+                kernel[kernel_size * (kernel_size * (kz + vic) + ky + vic) + kx + vic]
+                    = gaus(d, FWHM_val);
+            }
+        }
+    }
+
     ///////////////////////////
     // Find number of layers //
     ///////////////////////////
@@ -178,8 +210,9 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (sulctouch == 0) {
+    if (sulctouch == 0 && !do_separable) {
         cout << "  Smoothing in layer, not considering sulci." << endl;
+        #pragma omp parallel for collapse(3) schedule(dynamic, 64)
         for (int iz = 0; iz < size_z; ++iz) {
             for (int iy = 0; iy < size_y; ++iy) {
                 for (int ix = 0; ix < size_x; ++ix) {
@@ -187,9 +220,11 @@ int main(int argc, char* argv[]) {
                     int layer_i = *(nii_layer_data + voxel_i);
 
                     if (layer_i > 0) {
-                        idx += 1;
-                        int n = (idx * 100) / nr_vox_to_loop;
-                        if (n != prev_n) {
+                        int idx_i;
+                        #pragma omp atomic capture
+                        idx_i = ++idx;
+                        int n = (idx_i * 100) / nr_vox_to_loop;
+                        if (is_main_thread() && n != prev_n) {
                             cout << "\r    " << n <<  "%" << flush;
                             prev_n = n;
                         }
@@ -206,10 +241,7 @@ int main(int argc, char* argv[]) {
                                 for (int jx = jx_start; jx <= jx_stop; ++jx) {
                                     int voxel_j = nxy * jz + nx * jy + jx;
                                     if (*(nii_layer_data + voxel_j) == layer_i) {
-                                        float d = dist((float)ix, (float)iy, (float)iz,
-                                                       (float)jx, (float)jy, (float)jz,
-                                                       dX, dY, dZ);
-                                        float g = gaus(d, FWHM_val);
+                                        float g = kernel[kernel_size * (kernel_size * (jz - iz + vic) + jy - iy + vic) + jx - ix + vic];
                                         *(nii_smooth_data + voxel_i) += *(nii_input_data + voxel_j) * g;
                                         *(nii_gaussw_data + voxel_i) += g;
                                     }
@@ -227,15 +259,141 @@ int main(int argc, char* argv[]) {
         cout << endl;
     }
 
+    /////////////////////////////////////////////////
+    // SMOOTHING WITH SEPARABLE 1D PASSES PER LAYER //
+    /////////////////////////////////////////////////
+    // NOTE: Normalized convolution. Numerator (input inside the layer) and
+    // denominator (layer mask) are both smoothed, their ratio equals the
+    // weighted average of the default loop. Product of the 1D kernels gives
+    // the 3D kernel up to a constant factor which cancels in the ratio.
+    if (sulctouch == 0 && do_separable) {
+        cout << "  Smoothing in layer with separable 1D passes." << endl;
+        vector<float> kernel_x(kernel_size), kernel_y(kernel_size), kernel_z(kernel_size);
+        for (int k = -vic; k <= vic; ++k) {
+            kernel_x[k + vic] = gaus(k * dX, FWHM_val);
+            kernel_y[k + vic] = gaus(k * dY, FWHM_val);
+            kernel_z[k + vic] = gaus(k * dZ, FWHM_val);
+        }
+
+        // Bounding box of each layer
+        vector<int> min_x(nr_layers + 1, size_x), max_x(nr_layers + 1, -1);
+        vector<int> min_y(nr_layers + 1, size_y), max_y(nr_layers + 1, -1);
+        vector<int> min_z(nr_layers + 1, size_z), max_z(nr_layers + 1, -1);
+        for (int iz = 0; iz < size_z; ++iz) {
+            for (int iy = 0; iy < size_y; ++iy) {
+                for (int ix = 0; ix < size_x; ++ix) {
+                    int voxel_i = nxy * iz + nx * iy + ix;
+                    int layer_i = *(nii_layer_data + voxel_i);
+                    if (layer_i > 0) {
+                        min_x[layer_i] = min(min_x[layer_i], ix);
+                        max_x[layer_i] = max(max_x[layer_i], ix);
+                        min_y[layer_i] = min(min_y[layer_i], iy);
+                        max_y[layer_i] = max(max_y[layer_i], iy);
+                        min_z[layer_i] = min(min_z[layer_i], iz);
+                        max_z[layer_i] = max(max_z[layer_i], iz);
+                    } else {
+                        *(nii_smooth_data + voxel_i) = *(nii_input_data + voxel_i);
+                    }
+                }
+            }
+        }
+
+        vector<float> numer, denom, numer_temp, denom_temp;
+        for (int32_t layer = 1; layer <= nr_layers; ++layer) {
+            if (max_x[layer] < 0) continue;  // Empty layer
+            cout << "\r    Layer " << layer << "/" << nr_layers << flush;
+
+            // Grow the box by the kernel radius, outside of it nothing
+            // contributes to the voxels of this layer
+            const int x0 = max(0, min_x[layer] - vic);
+            const int y0 = max(0, min_y[layer] - vic);
+            const int z0 = max(0, min_z[layer] - vic);
+            const int bx = min(size_x - 1, max_x[layer] + vic) - x0 + 1;
+            const int by = min(size_y - 1, max_y[layer] + vic) - y0 + 1;
+            const int bz = min(size_z - 1, max_z[layer] + vic) - z0 + 1;
+            const int bxy = bx * by;
+            const int nr_box = bxy * bz;
+
+            numer.assign(nr_box, 0);
+            denom.assign(nr_box, 0);
+            numer_temp.assign(nr_box, 0);
+            denom_temp.assign(nr_box, 0);
+            for (int kz = 0; kz < bz; ++kz) {
+                for (int ky = 0; ky < by; ++ky) {
+                    for (int kx = 0; kx < bx; ++kx) {
+                        int voxel_i = nxy * (z0 + kz) + nx * (y0 + ky) + x0 + kx;
+                        if (*(nii_layer_data + voxel_i) == layer) {
+                            numer[bxy * kz + bx * ky + kx] = *(nii_input_data + voxel_i);
+                            denom[bxy * kz + bx * ky + kx] = 1;
+                        }
+                    }
+                }
+            }
+
+            // Pass along x, y and z. Each pass reads one pair of buffers and
+            // writes the other.
+            const int axis_size[3] = {bx, by, bz};
+            const int axis_stride[3] = {1, bx, bxy};
+            const float* axis_kernel[3] = {kernel_x.data(), kernel_y.data(), kernel_z.data()};
+            for (int a = 0; a != 3; ++a) {
+                const float* numer_in = (a == 1) ? numer_temp.data() : numer.data();
+                const float* denom_in = (a == 1) ? denom_temp.data() : denom.data();
+                float* numer_out = (a == 1) ? numer.data() : numer_temp.data();
+                float* denom_out = (a == 1) ? denom.data() : denom_temp.data();
+                const int n = axis_size[a];
+                const int stride = axis_stride[a];
+                const float* w = axis_kernel[a];
+
+                #pragma omp parallel for schedule(static)
+                for (int line = 0; line < nr_box / n; ++line) {
+                    // First voxel of the line
+                    int start = (a == 0) ? line * bx
+                                : (a == 1) ? (line / bx) * bxy + line % bx
+                                : line;
+                    for (int k = 0; k < n; ++k) {
+                        float sum_numer = 0, sum_denom = 0;
+                        for (int m = max(0, k - vic); m <= min(n - 1, k + vic); ++m) {
+                            sum_numer += numer_in[start + stride * m] * w[m - k + vic];
+                            sum_denom += denom_in[start + stride * m] * w[m - k + vic];
+                        }
+                        numer_out[start + stride * k] = sum_numer;
+                        denom_out[start + stride * k] = sum_denom;
+                    }
+                }
+            }
+
+            // Normalize, the result is in the temp buffers after three passes
+            for (int kz = 0; kz < bz; ++kz) {
+                for (int ky = 0; ky < by; ++ky) {
+                    for (int kx = 0; kx < bx; ++kx) {
+                        int voxel_i = nxy * (z0 + kz) + nx * (y0 + ky) + x0 + kx;
+                        if (*(nii_layer_data + voxel_i) == layer) {
+                            int k = bxy * kz + bx * ky + kx;
+                            *(nii_smooth_data + voxel_i) = numer_temp[k] / denom_temp[k];
+                        }
+                    }
+                }
+            }
+        }
+        cout << endl;
+    }
+
     ///////////////////////////////////////////////////////
     // if requested, smooth only within connected layers //
     ///////////////////////////////////////////////////////
+    // NOTE: The local patch of each voxel is a breadth-first search through
+    // the 26 neighbours within the same layer, bounded to the kernel box.
+    // This loop stays serial as every voxel reuses the same visit stamps.
     if (sulctouch == 1) {
-        // Allocating local connected vicinity file
+        // Number of voxels in the local connected vicinity of each voxel
         nifti_image* hairy_brain = copy_nifti_as_int32(nii_layer);
         int32_t* hairy_brain_data = static_cast<int32_t*>(hairy_brain->data);
         hairy_brain->scl_slope = 1.;
-        int vic_steps = 1;
+        for (int i = 0; i < nr_voxels; ++i) {
+            *(hairy_brain_data + i) = 0;
+        }
+        Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
+        LocalPatch patch = local_patch(nr_voxels);
 
         vic = max(1., 2. * FWHM_val / dX);  // Ignore if voxel is too far
         cout << "  vic " << vic << endl;
@@ -259,74 +417,24 @@ int main(int argc, char* argv[]) {
                         /////////////////////////////////////////////////
                         // Find area that is not from the other sulcus //
                         /////////////////////////////////////////////////
-                        int jz_start = max(0, iz - vic - vic_steps);
-                        int jz_stop = min(iz + vic + vic_steps, size_z - 1);
-                        int jy_start = max(0, iy - vic - vic_steps);
-                        int jy_stop = min(iy + vic + vic_steps, size_y - 1);
-                        int jx_start = max(0, ix - vic - vic_steps);
-                        int jx_stop = min(ix + vic + vic_steps, size_x - 1);
-
-                        for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                            for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                                for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                    *(hairy_brain_data + nxy * jz + nx * jy + jx) = 0;
-                                }
-                            }
-                        }
-                        *(hairy_brain_data + voxel_i) = 1;
-
-                        // Grow into neigbouring voxels.
-                        for (int K_= 0; K_< vic; K_++) {
-                            int kz_start = max(0, iz - vic);
-                            int kz_stop = min(iz + vic, size_z - 1);
-                            int ky_start = max(0, iy - vic);
-                            int ky_stop = min(iy + vic, size_x - 1);
-                            int kx_start = max(0, ix - vic);
-                            int kx_stop = min(ix + vic, size_y - 1);
-
-                            for (int kz = kz_start; kz <= kz_stop; ++kz) {
-                                for (int ky = ky_start; ky <= ky_stop; ++ky) {
-                                    for (int kx = kx_start; kx <= kx_stop; ++kx) {
-                                        if (*(hairy_brain_data + nxy * kz + nx * ky + kx) == 1) {
-                                            int mz_start = max(0, kz - vic_steps);
-                                            int mz_stop = min(kz + vic_steps, size_z - 1);
-                                            int my_start = max(0, ky - vic_steps);
-                                            int my_stop = min(ky + vic_steps, size_y - 1);
-                                            int mx_start = max(0, kx - vic_steps);
-                                            int mx_stop = min(kx + vic_steps, size_x - 1);
-
-                                            for (int mz = mz_start; mz <= mz_stop; ++mz) {
-                                                for (int my = my_start; my <= my_stop; ++my) {
-                                                    for (int mx = mx_start; mx <= mx_stop; ++mx) {
-                                                        if (dist((float)kx, (float)ky, (float)kz, (float)mx, (float)my, (float)mz, 1, 1, 1) <= 1.74
-                                                            && *(nii_layer_data + nxy * mz + nx * my + mx) == layer_i) {
-                                                            *(hairy_brain_data + nxy * mz + nx * my + mx) = 1;
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
+                        local_patch_grow(patch, nb, voxel_i, vic, 26, [&](uint32_t j) {
+                            return *(nii_layer_data + j) == layer_i;
+                        }, vic);
+                        *(hairy_brain_data + voxel_i) = patch.voxels.size();
 
                         // Smooth within each layer and within local patch
-                        jz_start = max(0, iz - vic);
-                        jz_stop = min(iz + vic, size_z - 1);
-                        jy_start = max(0, iy - vic);
-                        jy_stop = min(iy + vic, size_y - 1);
-                        jx_start = max(0, ix - vic);
-                        jx_stop = min(ix + vic, size_x - 1);
+                        int jz_start = max(0, iz - vic);
+                        int jz_stop = min(iz + vic, size_z - 1);
+                        int jy_start = max(0, iy - vic);
+                        int jy_stop = min(iy + vic, size_y - 1);
+                        int jx_start = max(0, ix - vic);
+                        int jx_stop = min(ix + vic, size_x - 1);
 
                         for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                            for (int jy = jy_start; jy <= jz_stop; ++jy) {
+                            for (int jy = jy_start; jy <= jy_stop; ++jy) {
                                 for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                    if (*(hairy_brain_data + nxy * jz + nx * jy + jx) == 1) {
-                                        float d = dist((float)ix, (float)iy, (float)iz,
-                                                       (float)jx, (float)jy, (float)jz,
-                                                       dX, dY, dZ);
-                                        float g = gaus(d, FWHM_val);
+                                    if (in_local_patch(patch, nxy * jz + nx * jy + jx)) {
+                                        float g = kernel[kernel_size * (kernel_size * (jz - iz + vic) + jy - iy + vic) + jx - ix + vic];
 
                                         *(nii_smooth_data + voxel_i) += *(nii_input_data + nxy * jz + nx * jy + jx) * g;
                                         *(nii_gaussw_data + voxel_i) += g;
@@ -162,14 +162,7 @@ int main(int argc, char*  argv[]) {
     }
     cout << "    There are " << nr_columns<< " columns, total. " << endl << endl;
 
-    double numb_voxels[nr_columns] ;
-    bool  thresh_exeed[nr_columns] ;
-    double mean_val[nr_columns] ;
-    for (int j = 0; j < nr_columns; j++) {
-        mean_val   [j] = 0.;
-        numb_voxels[j] = 0.;
-        thresh_exeed[j] = false;
-    }
+    vector<bool> thresh_exeed(nr_columns, false);
 
     // ========================================================================
     // considering necative activation too
@@ -180,13 +173,24 @@ int main(int argc, char*  argv[]) {
         }
     }
 
+    // ========================================================================
+    // Group voxels by column and compute statistics in one sweep
+    // ========================================================================
+    LabelIndex column_index = label_index(nr_voxels, nr_columns,
+        [&](uint32_t i) { return *(columns_data + i); });
+    LabelStats column_stats = label_stats(column_index, nii_input_data);
+
     // ========================================================================
     // Thresholding each column based on its maximally activated voxel
     // ========================================================================
     if (mode_max) {
-        for (int i = 0; i != nr_voxels; ++i) {
-            if (*(nii_input_data + i) * nii_input->scl_slope  >= thresh){
-                thresh_exeed [*(columns_data + i)-1] = true ;
+        for (int j = 0; j < nr_columns; j++) {
+            if (column_stats.count[j] == 0) continue;
+            // NOTE: With a negative slope the smallest value scales highest
+            float v = nii_input->scl_slope >= 0 ? column_stats.max[j]
+                                                : column_stats.min[j];
+            if (v * nii_input->scl_slope >= thresh) {
+                thresh_exeed[j] = true;
             }
         }
     }
@@ -195,24 +199,8 @@ int main(int argc, char*  argv[]) {
     // Threshold each column based on mean activated signal within
     // ========================================================================
     if (mode_mean) {
-
-        // ====================================================================
-        // average within columns and see if average is above threshold
-        // ====================================================================
-        for (int i = 0; i != nr_voxels; ++i) {
-            if ( *(columns_data + i) > 0 ){
-                mean_val   [ *(columns_data + i) -1 ] += *(nii_input_data + i) ;
-                numb_voxels[ *(columns_data + i) -1 ] += 1;
-            }
-        }
-
         for (int j = 0; j < nr_columns; j++) {
-            if (numb_voxels[j] != 0){
-                mean_val[j] /= (float)numb_voxels[j] ;
-                // cout << "layer " << i+1 << " and column " << j+1 << " has value " << mean_val[i][j] << endl;
-            }
-
-            if (mean_val[j] >= thresh){
+            if (column_stats.mean[j] >= thresh){
                 thresh_exeed [j] = true ;
             }
         }
@@ -228,7 +216,7 @@ int main(int argc, char*  argv[]) {
     // Set all voxels in columns that have been selected
     // ========================================================================
     for (int i = 0; i < nr_voxels; ++i) {
-        if ( (thresh_exeed [*(columns_data + i) - 1] == true ) && *(columns_data + i) > 0 ){
+        if (*(columns_data + i) > 0 && thresh_exeed[*(columns_data + i) - 1]) {
            *(mask_data + i) =  1;
        } else {
            *(columns_data + i) = 0;  // Also provide masked columns
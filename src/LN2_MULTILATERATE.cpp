@@ -35,6 +35,9 @@ int show_help(void) {
     "    -norms          : (Optional) Save L2 and Linf norm of the UV coordinates.\n"
     "    -angles         : (Optional) Save angles in radians and 4 quadrants.\n"
     "    -debug          : (Optional) Save extra intermediate outputs.\n"
+    "    -threads        : (Optional) Number of threads. With more than one,\n"
+    "                      the floods of control points, pin axes and Voronoi\n"
+    "                      are split into concurrent groups. Default is 1.\n"
     "    -output         : (Optional) Output basename for all outputs.\n"
     "\n"
     "Notes:\n"
@@ -55,7 +58,7 @@ int main(int argc, char*  argv[]) {
     nifti_image *nii1 = NULL, *nii2 = NULL;
     char *fin1 = NULL, *fout = NULL, *fin2=NULL;
     float thr_radius = 10;
-    int ac;
+    int ac, nr_threads = 1;
     bool mode_debug = false, mode_mask=true, mode_incl_borders = false;
     bool mode_norms = false, mode_angles=false;
 
@@ -97,6 +100,12 @@ int main(int argc, char*  argv[]) {
             fout = argv[ac];
         } else if (!strcmp(argv[ac], "-debug")) {
             mode_debug = true;
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else {
             fprintf(stderr, "** invalid option, '%s'\n", argv[ac]);
             return 1;
@@ -127,6 +136,7 @@ int main(int argc, char*  argv[]) {
     log_welcome("LN2_MULTILATERATE");
     log_nifti_descriptives(nii1);
     log_nifti_descriptives(nii2);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     const uint32_t size_x = nii1->nx;
@@ -143,12 +153,7 @@ int main(int argc, char*  argv[]) {
     const float dY = nii1->pixdim[2];
     const float dZ = nii1->pixdim[3];
 
-    // Short diagonals
-    const float dia_xy = sqrt(dX * dX + dY * dY);
-    const float dia_xz = sqrt(dX * dX + dZ * dZ);
-    const float dia_yz = sqrt(dY * dY + dZ * dZ);
-    // Long diagonals
-    const float dia_xyz = sqrt(dX * dX + dY * dY + dZ * dZ);
+    const Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
 
     // ========================================================================
     // Fix input datatype issues
@@ -222,8 +227,9 @@ int main(int argc, char*  argv[]) {
     float* pin_coords_data = static_cast<float*>(pin_coords->data);
 
     // ------------------------------------------------------------------------
-    // Final voronoi volume to output midgm distances for whole rim
-    nifti_image* voronoi = copy_nifti_as_float32(flood_dist);
+    // Final voronoi volumes (one per coordinate) to output midgm distances
+    // for whole rim
+    nifti_image* voronoi = copy_nifti_as_float32(point_coords);
     float* voronoi_data = static_cast<float*>(voronoi->data);
     nifti_image* smooth = copy_nifti_as_float32(flood_dist);
     float* smooth_data = static_cast<float*>(smooth->data);
@@ -320,10 +326,7 @@ int main(int argc, char*  argv[]) {
     }
 
 
-    int32_t grow_step = 1;
-    uint32_t voxel_counter = nr_voxels;
     uint32_t ix, iy, iz, i, j;
-    float d;
 
     if (!mode_custom_extrema) {
         cout << "\n  Computing control point 0 distances..." << endl;
@@ -335,335 +338,16 @@ int main(int argc, char*  argv[]) {
             }
         }
 
-        while (voxel_counter != 0) {
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                i = *(voi_id + ii);  // Map subset to full set
-                if (*(flood_step_data + i) == grow_step) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                    voxel_counter += 1;
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                }
+        vector<uint32_t> frontier;
+        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+            uint32_t i = *(voi_id + ii);  // Map subset to full set
+            if (*(flood_step_data + i) != 0) {
+                frontier.push_back(i);
             }
-            grow_step += 1;
         }
+        flood_geodesic_26(nb, frontier,
+                          [&](uint32_t j) { return *(control_points_data + j) > 0; },
+                          flood_dist_data, flood_step_data);
 
         if (mode_debug) {
             save_output_nifti(fout, "centroid_dist", flood_dist, false);
@@ -1149,11 +833,6 @@ int main(int argc, char*  argv[]) {
 
             // Loop until desired number of points reached
             for (int32_t n = 4; n < 7; ++n) {
-                int32_t grow_step = 1;
-                uint32_t voxel_counter = nr_voxels;
-                uint32_t ix, iy, iz, i, j;
-                float d;
-
                 // Initialize grow volume
                 for (uint32_t i = 0; i != nr_voxels; ++i) {
                     if (*(control_points_data + i) > 1) {
@@ -1165,338 +844,16 @@ int main(int argc, char*  argv[]) {
                     }
                 }
 
-                // Reset some parameters
-                grow_step = 1;
-                voxel_counter = nr_voxels;
-                while (voxel_counter != 0) {
-                    voxel_counter = 0;
-                    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                        i = *(voi_id + ii);  // Map subset to full set
-                        if (*(flood_step_data + i) == grow_step) {
-                            tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                            voxel_counter += 1;
-
-                            // ------------------------------------------------
-                            // 1-jump neighbours
-                            // ------------------------------------------------
-                            if (ix > 0) {
-                                j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dX;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x) {
-                                j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dX;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy > 0) {
-                                j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dY;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy < end_y) {
-                                j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dY;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iz > 0) {
-                                j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dZ;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iz < end_z) {
-                                j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dZ;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            // ------------------------------------------------
-                            // 2-jump neighbours
-                            // ------------------------------------------------
-                            if (ix > 0 && iy > 0) {
-                                j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xy;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iy < end_y) {
-                                j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xy;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy > 0) {
-                                j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xy;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy < end_y) {
-                                j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xy;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy > 0 && iz > 0) {
-                                j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_yz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy > 0 && iz < end_z) {
-                                j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_yz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy < end_y && iz > 0) {
-                                j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_yz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (iy < end_y && iz < end_z) {
-                                j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_yz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iz > 0) {
-                                j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iz > 0) {
-                                j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iz < end_z) {
-                                j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iz < end_z) {
-                                j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-
-                            // ------------------------------------------------
-                            // 3-jump neighbours
-                            // ------------------------------------------------
-                            if (ix > 0 && iy > 0 && iz > 0) {
-                                j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iy > 0 && iz < end_z) {
-                                j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iy < end_y && iz > 0) {
-                                j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy > 0 && iz > 0) {
-                                j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix > 0 && iy < end_y && iz < end_z) {
-                                j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy > 0 && iz < end_z) {
-                                j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy < end_y && iz > 0) {
-                                j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                            if (ix < end_x && iy < end_y && iz < end_z) {
-                                j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                                if (*(perimeter_data + j) == 2) {
-                                    d = *(flood_dist_data + i) + dia_xyz;
-                                    if (d < *(flood_dist_data + j)
-                                        || *(flood_dist_data + j) == 0) {
-                                        *(flood_dist_data + j) = d;
-                                        *(flood_step_data + j) = grow_step + 1;
-                                    }
-                                }
-                            }
-                        }
+                vector<uint32_t> frontier;
+                for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+                    uint32_t i = *(voi_id + ii);  // Map subset to full set
+                    if (*(flood_step_data + i) != 0) {
+                        frontier.push_back(i);
                     }
-                    grow_step += 1;
                 }
+                flood_geodesic_26(nb, frontier,
+                                  [&](uint32_t j) { return *(perimeter_data + j) == 2; },
+                                  flood_dist_data, flood_step_data);
 
                 // Find farthest point
                 float max_distance = 0;
@@ -1522,361 +879,27 @@ int main(int argc, char*  argv[]) {
     // Compute flood distances from each extrema control points
     // ========================================================================
     cout << "  Computing control point (1 to 4) distances..." << endl;
-    for (int p = 3; p < 7; ++p) {
-        cout << "    Relative to control point" + std::to_string(p-2) + "..." << endl;
-        // Initialize grow volume
-        for (uint32_t i = 0; i != nr_voxels; ++i) {
-            if (*(control_points_data + i) == p) {
-                *(flood_step_data + i) = 1.;
-                *(flood_dist_data + i) = 1.;
-            } else {
-                *(flood_step_data + i) = 0.;
-                *(flood_dist_data + i) = 0.;
-            }
+    // The four floods are independent. They run in one traversal, one
+    // channel per control point, directly into the 4D point distances.
+    vector<vector<uint32_t> > point_frontiers(4);
+    for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+        i = *(voi_id + ii);  // Map subset to full set
+        int32_t p = *(control_points_data + i);
+        if (p >= 3 && p < 7) {
+            *(point_dist_data + nr_voxels * (p-3) + i) = 1.;
+            point_frontiers[p-3].push_back(i);
         }
+    }
+    flood_geodesic_26_channels(nb, point_frontiers,
+                               [&](uint32_t j) { return *(control_points_data + j) > 0; },
+                               point_dist_data);
 
-        // Reset some parameters
-        grow_step = 1;
-        voxel_counter = nr_voxels;
-
-        while (voxel_counter != 0) {
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                i = *(voi_id + ii);  // Map subset to full set
-                if (*(flood_step_data + i) == grow_step) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                    voxel_counter += 1;
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) > 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                }
+    if (mode_debug) {
+        for (int p = 0; p != 4; ++p) {
+            for (uint32_t i = 0; i != nr_voxels; ++i) {
+                *(flood_dist_data + i) = *(point_dist_data + nr_voxels * p + i);
             }
-            grow_step += 1;
-        }
-
-        if (mode_debug) {
-            save_output_nifti(fout, "control_point" + std::to_string(p-2) + "_dist", flood_dist, false);
-        }
-
-        // Record distances into a 4D nifti
-        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-            i = *(voi_id + ii);  // Map subset to full set
-            *(point_dist_data + nr_voxels*(p-3) + i) = *(flood_dist_data + i);
+            save_output_nifti(fout, "control_point" + std::to_string(p+1) + "_dist", flood_dist, false);
         }
     }
 
@@ -1997,359 +1020,34 @@ int main(int argc, char*  argv[]) {
     // Compute flood distances relative to pin axes
     // ========================================================================
     cout << "\n  Computing pin axis distances..." << endl;
+    // TODO(Faruk): Guesstimate an initial distance to axis lines. Probably
+    // I can do this better by considering the local neighbourhood in the
+    // future.
+    float dist_to_axes = ((dX + dY + dZ) / 3) / 2;  // Half a voxel
+
+    // Both pin axes are flooded in one traversal, one channel per axis
+    vector<float> pin_dist(nr_voxels * 2, 0);
+    vector<vector<uint32_t> > pin_frontiers(2);
     for (int p = 0; p != 2; ++p) {
-        cout << "    Relative to pin axis " + std::to_string(p+1) + "/2..." << endl;
-
-        // TODO(Faruk): Guesstimate an initial distance to axis lines. Probably
-        // I can do this better by considering the local neighbourhood in the
-        // future.
-        float dist_to_axes = ((dX + dY + dZ) / 3) / 2;  // Half a voxel
-
-        // Initialize grow volume
-        for (uint32_t i = 0; i != nr_voxels; ++i) {
+        for (uint32_t ii = 0; ii != nr_voi; ++ii) {
+            i = *(voi_id + ii);  // Map subset to full set
             if (*(pin_axes_data + nr_voxels * p + i) != 0) {
-                *(flood_step_data + i) = 1.;
-                *(flood_dist_data + i) = dist_to_axes;
-            } else {
-                *(flood_step_data + i) = 0.;
-                *(flood_dist_data + i) = 0.;
+                pin_dist[nr_voxels * p + i] = dist_to_axes;
+                pin_frontiers[p].push_back(i);
             }
         }
+    }
+    flood_geodesic_26_channels(nb, pin_frontiers,
+                               [&](uint32_t j) { return *(control_points_data + j) != 0; },
+                               pin_dist.data());
 
-        // Reset some parameters
-        grow_step = 1;
-        voxel_counter = nr_voxels;
-
-        while (voxel_counter != 0) {
-            voxel_counter = 0;
-            for (uint32_t ii = 0; ii != nr_voi; ++ii) {
-                i = *(voi_id + ii);  // Map subset to full set
-                if (*(flood_step_data + i) == grow_step) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                    voxel_counter += 1;
-
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y) {
-                        j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y) {
-                        j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xy;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_yz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 3-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0 && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix > 0 && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy > 0 && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz > 0) {
-                        j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                    if (ix < end_x && iy < end_y && iz < end_z) {
-                        j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                        if (*(control_points_data + j) != 0) {
-                            d = *(flood_dist_data + i) + dia_xyz;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                            }
-                        }
-                    }
-                }
-            }
-            grow_step += 1;
+    for (int p = 0; p != 2; ++p) {
+        // NOTE: flood_dist is left with the last pin axis distances, like
+        // the flood of each axis one after the other. The perimeter update
+        // below reads it outside of the rim.
+        for (uint32_t i = 0; i != nr_voxels; ++i) {
+            *(flood_dist_data + i) = pin_dist[nr_voxels * p + i];
         }
-
         if (mode_debug) {
             save_output_nifti(fout, "pin_axis" + std::to_string(p+1) + "_dist", flood_dist, true);
         }
@@ -2359,9 +1057,9 @@ int main(int argc, char*  argv[]) {
             i = *(voi_id + ii);  // Map subset to full set
             // Transfer signs onto pin distances to convert them to coordinates
             if (*(point_coords_data + nr_voxels * p + i) < 0) {
-                *(pin_coords_data + nr_voxels * p + i) = -*(flood_dist_data + i);
+                *(pin_coords_data + nr_voxels * p + i) = -pin_dist[nr_voxels * p + i];
             } else {
-                *(pin_coords_data + nr_voxels * p + i) = *(flood_dist_data + i);
+                *(pin_coords_data + nr_voxels * p + i) = pin_dist[nr_voxels * p + i];
             }
         }
     }
@@ -2374,402 +1072,30 @@ int main(int argc, char*  argv[]) {
     // Final Voronoi for propagating distances to all gray matter
     // ========================================================================
     cout << "\n  Start Voronoi propagation..." << endl;
+    // Both coordinates are propagated in one traversal, one channel each
+    vector<float> voronoi_dist(nr_voxels * 2, 0);
+    vector<vector<uint32_t> > voronoi_frontiers(2);
     for (uint32_t t = 0; t != 2; ++t) {
-        cout << "    Doing coordinate " + std::to_string(t+1) + "/2..." << endl;
-        // Initialize grow volume
         for (uint32_t iii = 0; iii != nr_voi2; ++iii) {
             i = *(voi_id2 + iii);  // Map subset to full set
             if (*(pin_coords_data + nr_voxels*t + i) != 0) {
-                *(voronoi_data + i) = *(pin_coords_data + nr_voxels*t + i);
-                *(flood_step_data + i) = 1.;
-                *(flood_dist_data + i) = 1.;
-            } else {
-                *(voronoi_data + i) = 0;
-                *(flood_step_data + i) = 0.;
-                *(flood_dist_data + i) = 0.;
-            }
-        }
-
-        grow_step = 1;
-        voxel_counter = nr_voxels;
-
-        while (voxel_counter != 0) {
-            voxel_counter = 0;
-            for (uint32_t iii = 0; iii != nr_voi2; ++iii) {
-                i = *(voi_id2 + iii);
-                if (*(flood_step_data + i) == grow_step) {
-                    tie(ix, iy, iz) = ind2sub_3D(i, size_x, size_y);
-                    voxel_counter += 1;
-
-                    bool jump_lock = false;
-                    // --------------------------------------------------------
-                    // 1-jump neighbours
-                    // --------------------------------------------------------
-                    if (ix > 0) {
-                        j = sub2ind_3D(ix-1, iy, iz, size_x, size_y);
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-                    if (ix < end_x) {
-                        j = sub2ind_3D(ix+1, iy, iz, size_x, size_y);
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dX;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-                    if (iy > 0) {
-                        j = sub2ind_3D(ix, iy-1, iz, size_x, size_y);
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-                    if (iy < end_y) {
-                        j = sub2ind_3D(ix, iy+1, iz, size_x, size_y);
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dY;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-                    if (iz > 0) {
-                        j = sub2ind_3D(ix, iy, iz-1, size_x, size_y);
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-                    if (iz < end_z) {
-                        j = sub2ind_3D(ix, iy, iz+1, size_x, size_y);
-
-                        if (*(nii_rim_data + j) == 3) {
-                            d = *(flood_dist_data + i) + dZ;
-                            if (d < *(flood_dist_data + j)
-                                || *(flood_dist_data + j) == 0) {
-                                *(flood_dist_data + j) = d;
-                                *(flood_step_data + j) = grow_step + 1;
-                                *(voronoi_data + j) = *(voronoi_data + i);
-                            }
-                        } else if (*(nii_rim_data + j) != 0) {
-                            jump_lock = true;
-                        }
-                    }
-
-                    // --------------------------------------------------------
-                    // 2-jump neighbours
-                    // --------------------------------------------------------
-                    if (jump_lock == false) {
-
-                        if (ix > 0 && iy > 0) {
-                            j = sub2ind_3D(ix-1, iy-1, iz, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xy;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iy < end_y) {
-                            j = sub2ind_3D(ix-1, iy+1, iz, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xy;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy > 0) {
-                            j = sub2ind_3D(ix+1, iy-1, iz, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xy;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy < end_y) {
-                            j = sub2ind_3D(ix+1, iy+1, iz, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xy;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (iy > 0 && iz > 0) {
-                            j = sub2ind_3D(ix, iy-1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_yz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (iy > 0 && iz < end_z) {
-                            j = sub2ind_3D(ix, iy-1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_yz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (iy < end_y && iz > 0) {
-                            j = sub2ind_3D(ix, iy+1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_yz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (iy < end_y && iz < end_z) {
-                            j = sub2ind_3D(ix, iy+1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_yz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iz > 0) {
-                            j = sub2ind_3D(ix-1, iy, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iz > 0) {
-                            j = sub2ind_3D(ix+1, iy, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iz < end_z) {
-                            j = sub2ind_3D(ix-1, iy, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iz < end_z) {
-                            j = sub2ind_3D(ix+1, iy, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-
-                        // ----------------------------------------------------
-                        // 3-jump neighbours
-                        // ----------------------------------------------------
-                        if (ix > 0 && iy > 0 && iz > 0) {
-                            j = sub2ind_3D(ix-1, iy-1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iy > 0 && iz < end_z) {
-                            j = sub2ind_3D(ix-1, iy-1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iy < end_y && iz > 0) {
-                            j = sub2ind_3D(ix-1, iy+1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy > 0 && iz > 0) {
-                            j = sub2ind_3D(ix+1, iy-1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix > 0 && iy < end_y && iz < end_z) {
-                            j = sub2ind_3D(ix-1, iy+1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy > 0 && iz < end_z) {
-                            j = sub2ind_3D(ix+1, iy-1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy < end_y && iz > 0) {
-                            j = sub2ind_3D(ix+1, iy+1, iz-1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                        if (ix < end_x && iy < end_y && iz < end_z) {
-                            j = sub2ind_3D(ix+1, iy+1, iz+1, size_x, size_y);
-
-                            if (*(nii_rim_data + j) == 3) {
-                                d = *(flood_dist_data + i) + dia_xyz;
-                                if (d < *(flood_dist_data + j)
-                                    || *(flood_dist_data + j) == 0) {
-                                    *(flood_dist_data + j) = d;
-                                    *(flood_step_data + j) = grow_step + 1;
-                                    *(voronoi_data + j) = *(voronoi_data + i);
-                                }
-                            }
-                        }
-                    }
-                }
+                *(voronoi_data + nr_voxels*t + i) = *(pin_coords_data + nr_voxels*t + i);
+                voronoi_dist[nr_voxels*t + i] = 1.;
+                voronoi_frontiers[t].push_back(i);
             }
-            grow_step += 1;
         }
+    }
+    // Diagonal jumps are not taken next to a rim border voxel
+    flood_geodesic_26_channels(nb, voronoi_frontiers,
+                               [&](uint32_t j) { return *(nii_rim_data + j) == 3; },
+                               [&](uint32_t j) { return *(nii_rim_data + j) != 0; },
+                               voronoi_dist.data(), voronoi_data);
 
-        // Record into 4D nifti
+    // Record into 4D nifti
+    for (uint32_t t = 0; t != 2; ++t) {
         for (uint32_t iii = 0; iii != nr_voi2; ++iii) {
             i = *(voi_id2 + iii);  // Map subset to full set
-            *(pin_coords_data + nr_voxels * t + i) = *(voronoi_data + i);
+            *(pin_coords_data + nr_voxels * t + i) = *(voronoi_data + nr_voxels * t + i);
         }
     }
 
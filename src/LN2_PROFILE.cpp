@@ -1,6 +1,6 @@
 
 // WORK in PROGRESS
-// TODO(Renzo): Think about what to do with time series data.
+// NOTE: Time series are profiled one volume at a time (layers x time matrix).
 // E.g. carpet plot: https://github.com/layerfMRI/repository/tree/master/Layer_me
 
 #include <fstream>
@@ -10,13 +10,19 @@
 
 int show_help(void) {
     printf(
-    "LN2_PROFILE: Generates layer profiles from 3D nii file based on layer masks.\n"
+    "LN2_PROFILE: Generates layer profiles from 3D or 4D nii file based on layer masks.\n"
     "             It averages all the signal intensities of each layer and write it\n"
     "             out as a 2d-plot. The ouput is a text file (table).\n"
     "                 - Column 1 is the layer number.\n"
     "                 - Column 2 is the mean signal in this layer.\n"
     "                 - Column 3 is the STDEV of the signal variance across all voxels in this layer.\n"
     "                 - Column 4 is the number of voxels per layer.\n"
+    "                 - Column 5 is the median signal (only with -median).\n"
+    "             For 4D inputs, the table above describes the temporal mean\n"
+    "             and the layer time courses are written in addition:\n"
+    "                 - '_timecourse.txt': one row per layer, the layer number\n"
+    "                   followed by the mean signal at each time point.\n"
+    "                 - '_timecourse.nii.gz': the same layers x time matrix.\n"
     "\n"
     "Usage:\n"
     "    LN2_PROFILE -input activitymap.nii -layers layers.nii -plot \n"
@@ -31,11 +37,13 @@ int show_help(void) {
     "              It is assumes that superficial layers have large values.\n"
     "    -input  : Specify input dataset of to extract the signal from.\n"
     "              This is usually an activation map.\n"
-    "              This 3D nii file must have the same dimension as the layer file.\n"
+    "              This 3D or 4D nii file must have the same spatial dimensions\n"
+    "              as the layer file. 4D files are read one volume at a time.\n"
     "    -plot   : (Optional)\n"
     "              this option tries to plot the profile as ASKII art in the terminal \n"
     "              This option can be usefull if you do not have a graphical ploting profile ready\n"
     "              E.g. on a remore server without X11 forwarding.\n"
+    "    -median : (Optional) Add the median signal of each layer as 5th column.\n"
     "    -debug  : (Optional) Save extra intermediate outputs.\n"
     "    -output : (Optional) Output basename.\n"
     "              Default is adding '_padded' as suffix \n"
@@ -53,7 +61,7 @@ int main(int argc, char*  argv[]) {
     nifti_image *niil = NULL;
     char *fin = NULL, *finl = NULL;
     char const *fout = "profile.txt";
-    bool  mode_debug = false,  mode_plot = false;
+    bool  mode_debug = false,  mode_plot = false, mode_median = false;
     bool  use_outpath = false;
 
     // Process user options
@@ -83,6 +91,8 @@ int main(int argc, char*  argv[]) {
             fout = argv[ac];
         } else if (!strcmp(argv[ac], "-plot")) {
             mode_plot = true;
+        } else if (!strcmp(argv[ac], "-median")) {
+            mode_median = true;
         } else if (!strcmp(argv[ac], "-debug")) {
             mode_debug = true;
         } else {
@@ -101,7 +111,7 @@ int main(int argc, char*  argv[]) {
     }
 
     // Read input dataset, including data
-    nii1 = nifti_image_read(fin, 1);
+    nii1 = nifti_image_read_mmap(fin);
     if (!nii1) {
         fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin);
         return 2;
@@ -120,6 +130,7 @@ int main(int argc, char*  argv[]) {
     const uint32_t size_y = nii1->ny;
     const uint32_t size_z = nii1->nz;
     const uint32_t nr_voxels = size_z * size_y * size_x;
+    const int size_time = nii1->nt > 1 ? nii1->nt : 1;
 
     // ========================================================================
     // Load input
@@ -127,9 +138,6 @@ int main(int argc, char*  argv[]) {
     nifti_image* layers = copy_nifti_as_int16(niil);
     int16_t* layers_data = static_cast<int16_t*>(layers->data);
 
-    nifti_image* act = copy_nifti_as_float32(nii1);
-    float* act_data = static_cast<float*>(act->data);
-
     // ========================================================================
     // Make sure that there is nothing weird with the slope of the nii header
     // ========================================================================
@@ -138,11 +146,12 @@ int main(int argc, char*  argv[]) {
        cout << "   Act  file has slope  " << nii1->scl_slope  << endl;
     }
 
-    if (act->scl_slope == 0) {
+    float scl_slope = nii1->scl_slope;
+    if (scl_slope == 0) {
         cout << "   There is something weird with the slope of the act file " << endl;
         cout << "   it seems to be ZERO, this doesn't make sense " << endl;
         cout << "   I am setting it to 1 instead " << endl;
-        act->scl_slope = 1;
+        scl_slope = 1;
     }
     // ========================================================================
     // Look how many layers we have and allocating the arrays accordingly
@@ -155,54 +164,63 @@ int main(int argc, char*  argv[]) {
     }
     cout << "    There are " << nr_layers<< " layers. " << endl << endl;
 
-    double numb_voxels[nr_layers] ;
-    double mean_layers[nr_layers] ;
-    double std_layers [nr_layers] ;
-    for (int i = 0; i < nr_layers; i++) {
-        mean_layers[i] = 0.;
-        std_layers[i] = 0.;
-        numb_voxels[i] = 0.;
-    }
-
     // ========================================================================
-    // Look how many voxels we have per layer
+    // Group voxels by layer and compute statistics in one sweep
     // ========================================================================
-    for(int i = 0; i < nr_layers; i++) {
-        for (int j = 0; j != nr_voxels; ++j) {
-            if (*(layers_data + j) == i+1 ) {
-                numb_voxels[i] ++;
-            }
-        }
-    }
+    LabelIndex layer_index = label_index(nr_voxels, nr_layers,
+        [&](uint32_t i) { return *(layers_data + i); });
+
+    // ------------------------------------------------------------------------
+    // Read one volume at a time. For time series, every volume adds a column
+    // to the layer time courses and to the temporal mean.
+    // ------------------------------------------------------------------------
+    vector<float> act_data(nr_voxels);
+    vector<float> timecourse;  // Layer-major, nr_layers x size_time
+
+    if (size_time == 1) {
+        copy_volume_as_float32(nii1, 0, act_data.data());
+    } else {
+        cout << "    There are " << size_time << " time points. " << endl << endl;
+        vector<double> sum_data(nr_voxels, 0);
+        timecourse.assign(nr_layers * size_time, 0);
 
-    //-------------- finding layer with maximal number of voxels
-    int max_layer_number = 0 ;
-    int max_layer_number_layer = 0 ;
-        for(int i = 0; i < nr_layers; i++) {
-            if (numb_voxels[i] >= max_layer_number ){
-                max_layer_number =  numb_voxels[i];
-                max_layer_number_layer = i;
+        for (int t = 0; t < size_time; ++t) {
+            copy_volume_as_float32(nii1, t, act_data.data());
+
+            LabelStats vol_stats = label_stats(layer_index, act_data.data());
+            for (int i = 0; i < nr_layers; i++) {
+                timecourse[i * size_time + t] = vol_stats.mean[i] * scl_slope;
             }
+            for (uint32_t i = 0; i != nr_voxels; ++i) {
+                sum_data[i] += act_data[i];
+            }
+        }
+        // Temporal mean for the profile table
+        for (uint32_t i = 0; i != nr_voxels; ++i) {
+            act_data[i] = sum_data[i] / size_time;
         }
+    }
 
-    if(mode_debug) cout << "   Layer  " <<   max_layer_number_layer+1 << " has the most voxels: " <<  max_layer_number << endl;
+    LabelStats layer_stats = label_stats(layer_index, act_data.data(),
+                                         mode_median);
 
-    // ========================================================================
-    // Go through layers MAIN loop
-    // ========================================================================
-    double vec1[max_layer_number];
-    int dummy_index = 0;
+    vector<double> mean_layers(nr_layers), std_layers(nr_layers);
+    vector<uint32_t>& numb_voxels = layer_stats.count;
+    for (int i = 0; i < nr_layers; i++) {
+        mean_layers[i] = layer_stats.mean[i] * scl_slope;
+        std_layers[i] = layer_stats.stdev[i] * scl_slope;
+    }
 
-    for(int i = 0; i < nr_layers; i++) {
-        for (int j = 0; j != nr_voxels; ++j) {
-            if (*(layers_data + j) == i+1 ) {
-                vec1[dummy_index] = *(act_data + j) ;
-                dummy_index ++;
+    if (mode_debug) {
+        uint32_t max_layer_number = 0;
+        int max_layer_number_layer = 0;
+        for (int i = 0; i < nr_layers; i++) {
+            if (numb_voxels[i] >= max_layer_number) {
+                max_layer_number = numb_voxels[i];
+                max_layer_number_layer = i;
             }
         }
-        dummy_index = 0;
-        mean_layers[i] = ren_average(vec1, numb_voxels[i])*act->scl_slope;
-        std_layers[i]  = ren_stdev  (vec1, numb_voxels[i])*act->scl_slope;
+        cout << "   Layer  " <<   max_layer_number_layer+1 << " has the most voxels: " <<  max_layer_number << endl;
     }
 
     // ========================================================================
@@ -267,10 +285,60 @@ int main(int argc, char*  argv[]) {
 
     cout<<"    writing to disk "  << path_out<<endl;
     for(int i = 0; i < nr_layers; i++) {
-      outf << i+1 << "   "<<  mean_layers[i] <<  " " << std_layers[i] << "  " <<  numb_voxels[i] << endl;
+      outf << i+1 << "   "<<  mean_layers[i] <<  " " << std_layers[i] << "  " <<  numb_voxels[i];
+      if (mode_median) {
+          outf << "  " << layer_stats.median[i] * scl_slope;
+      }
+      outf << endl;
      }
     outf.close();
 
+    // ------------------------------------------------------------------------
+    // Layer time courses, as text and as a layers x time nii
+    // ------------------------------------------------------------------------
+    if (size_time > 1) {
+        string path_tc = output_path_txt(path_out, "timecourse");
+        ofstream outf_tc(path_tc);
+        if (!outf_tc) {
+            cout<<"error when opening the text file"<<endl;
+        }
+        cout<<"    writing to disk "  << path_tc<<endl;
+        for (int i = 0; i < nr_layers; i++) {
+            outf_tc << i+1;
+            for (int t = 0; t < size_time; ++t) {
+                outf_tc << " " << timecourse[i * size_time + t];
+            }
+            outf_tc << endl;
+        }
+        outf_tc.close();
+
+        nifti_image* nii_tc = nifti_copy_nim_info(nii1);
+        nii_tc->datatype = NIFTI_TYPE_FLOAT32;
+        nii_tc->nbyper = sizeof(float);
+        nii_tc->dim[0] = 4;
+        nii_tc->dim[1] = nr_layers;
+        nii_tc->dim[2] = 1;
+        nii_tc->dim[3] = 1;
+        nii_tc->dim[4] = size_time;
+        nii_tc->pixdim[1] = 1;
+        nii_tc->pixdim[2] = 1;
+        nii_tc->pixdim[3] = 1;
+        nifti_update_dims_from_array(nii_tc);
+        nii_tc->scl_slope = 1;
+        nii_tc->scl_inter = 0;
+        nii_tc->data = calloc(nii_tc->nvox, nii_tc->nbyper);
+        float* nii_tc_data = static_cast<float*>(nii_tc->data);
+
+        // NOTE: Layers run along x, time along t
+        for (int i = 0; i < nr_layers; i++) {
+            for (int t = 0; t < size_time; ++t) {
+                *(nii_tc_data + nr_layers * t + i) = timecourse[i * size_time + t];
+            }
+        }
+        string path_tc_nii = path_tc.substr(0, path_tc.size() - 4) + ".nii.gz";
+        save_output_nifti(path_tc_nii, "", nii_tc, true, true);
+    }
+
     // ========================================================================
     // Plot in terminal, use ASCII to avoid issues with terminal types
     // ========================================================================
@@ -26,6 +26,8 @@ int show_help(void) {
     "    -height : height/height of cylinder that will be passed over D (depth)\n"
     "                 coordinates. In units of normalized depth metric, which are often in\n"
     "                 0-1 range.\n"
+    "    -threads   : (Optional) Number of threads for parallel loops.\n"
+    "                 Default is 1.\n"
     "    -output    : (Optional) Output basename for all outputs.\n"
     "\n");
     return 0;
@@ -35,7 +37,7 @@ int main(int argc, char* argv[]) {
 
     nifti_image *nii1 = NULL, *nii2 = NULL, *nii3 = NULL, *nii4 = NULL;
     char *fin1 = NULL, *fout = NULL, *fin2=NULL, *fin3=NULL, *fin4=NULL;
-    int ac;
+    int ac, nr_threads = 1;
     float radius = 3, height = 0.25;
     bool mode_median = true, mode_min = false;
 
@@ -88,6 +90,12 @@ int main(int argc, char* argv[]) {
         } else if (!strcmp(argv[ac], "-min")) {
             mode_median = false;
             mode_min = true;
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -144,19 +152,24 @@ int main(int argc, char* argv[]) {
     log_nifti_descriptives(nii2);
     log_nifti_descriptives(nii3);
     log_nifti_descriptives(nii4);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     const int nr_voxels = nii1->nx * nii1->ny * nii1->nz;
 
     // ========================================================================
     // Fix input datatype issues
-    nifti_image* nii_input = copy_nifti_as_float32(nii1);
+    convert_nifti_to_float32(nii1);
+    nifti_image* nii_input = nii1;
     float* nii_input_data = static_cast<float*>(nii_input->data);
-    nifti_image* coords_uv = copy_nifti_as_float32(nii2);
+    convert_nifti_to_float32(nii2);
+    nifti_image* coords_uv = nii2;
     float* coords_uv_data = static_cast<float*>(coords_uv->data);
-    nifti_image* coords_d = copy_nifti_as_float32(nii3);
+    convert_nifti_to_float32(nii3);
+    nifti_image* coords_d = nii3;
     float* coords_d_data = static_cast<float*>(coords_d->data);
-    nifti_image* domain = copy_nifti_as_float32(nii4);
+    convert_nifti_to_float32(nii4);
+    nifti_image* domain = nii4;
     float* domain_data = static_cast<float*>(domain->data);
 
     // ========================================================================
@@ -188,77 +201,79 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // Index UVD coordinates so that each cylinder only visits nearby voxels
+    GridUVD grid = grid_uvd(vec_u, vec_v, vec_d, radius, height);
+
     // ========================================================================
     // Visit each voxel to check their coordinate
     // ========================================================================
-    float half_height = height / 2;
-    float radius_sqr = radius * radius;
-    for (int i = 0; i != nr_voi; ++i) {
-        cout << "\r    " << i * 100 / nr_voi << " %" << flush;
-        vector <float> temp_vec;
+    #pragma omp parallel
+    {
+        vector <uint32_t> found;  // Per thread
+        #pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i != nr_voi; ++i) {
+            if (is_main_thread()) {
+                cout << "\r    " << i * 100 / nr_voi << " %" << flush;
+            }
 
-        // --------------------------------------------------------------------
-        // Cylinder windowing in UVD space
-        // --------------------------------------------------------------------
-        for (int j = 0; j != nr_voi; ++j) {
-            // Compute distances relative to reference UVD
-            if (abs(vec_d[i] - vec_d[j]) < half_height) {  // Check height
-                float dist_uv = (vec_u[i] - vec_u[j])*(vec_u[i] - vec_u[j])
-                    + (vec_v[i] - vec_v[j])*(vec_v[i] - vec_v[j]);
-                if (dist_uv < radius_sqr) {  // Check Euclidean distance
-                    temp_vec.push_back(vec_val[j]);
-                }
+            // ----------------------------------------------------------------
+            // Cylinder windowing in UVD space
+            // ----------------------------------------------------------------
+            query_cylinder_uvd(grid, vec_u, vec_v, vec_d, i, radius, height, found);
+            vector <float> temp_vec(found.size());
+            for (size_t k = 0; k != found.size(); ++k) {
+                temp_vec[k] = vec_val[found[k]];
             }
-        }
 
-        int n = temp_vec.size();
-        float m;
+            int n = temp_vec.size();
+            float m;
 
-        // --------------------------------------------------------------------
-        // Find median
-        // --------------------------------------------------------------------
-        if (mode_median) {
-            if (n % 2 == 0) {  // even
-                std::nth_element(temp_vec.begin(),
-                temp_vec.begin() + n / 2,
-                temp_vec.end());
+            // ----------------------------------------------------------------
+            // Find median
+            // ----------------------------------------------------------------
+            if (mode_median) {
+                if (n % 2 == 0) {  // even
+                    std::nth_element(temp_vec.begin(),
+                    temp_vec.begin() + n / 2,
+                    temp_vec.end());
 
-                std::nth_element(temp_vec.begin(),
-                temp_vec.begin() + (n - 1) / 2,
-                temp_vec.end());
+                    std::nth_element(temp_vec.begin(),
+                    temp_vec.begin() + (n - 1) / 2,
+                    temp_vec.end());
 
-                m = (temp_vec[n / 2] + temp_vec[(n - 1) / 2]) / 2.0;
+                    m = (temp_vec[n / 2] + temp_vec[(n - 1) / 2]) / 2.0;
 
-            } else {  // odd
-                std::nth_element(temp_vec.begin(),
-                temp_vec.begin() + n / 2,
-                temp_vec.end());
+                } else {  // odd
+                    std::nth_element(temp_vec.begin(),
+                    temp_vec.begin() + n / 2,
+                    temp_vec.end());
 
-                m = temp_vec[n / 2];
-            }
+                    m = temp_vec[n / 2];
+                }
 
-            *(nii_output_data + vec_voi_id[i]) = m;
-        }
+                *(nii_output_data + vec_voi_id[i]) = m;
+            }
 
-        // --------------------------------------------------------------------
-        // Peak detect by minimum
-        // --------------------------------------------------------------------
-        if (mode_min) {
-            float temp_ref = vec_val[i];
-            float temp_min = vec_val[i];
-            for (int j = 0; j != n; ++j) {
-                if (temp_vec[j] < temp_min) {
-                    temp_min = temp_vec[j];
+            // ----------------------------------------------------------------
+            // Peak detect by minimum
+            // ----------------------------------------------------------------
+            if (mode_min) {
+                float temp_ref = vec_val[i];
+                float temp_min = vec_val[i];
+                for (int j = 0; j != n; ++j) {
+                    if (temp_vec[j] < temp_min) {
+                        temp_min = temp_vec[j];
+                    }
                 }
-            }
 
-            if (temp_min < temp_ref) {
-                *(nii_output_data + vec_voi_id[i]) = 0;
-            } else {
-                *(nii_output_data + vec_voi_id[i]) = 1;
+                if (temp_min < temp_ref) {
+                    *(nii_output_data + vec_voi_id[i]) = 0;
+                } else {
+                    *(nii_output_data + vec_voi_id[i]) = 1;
+                }
             }
+            // ----------------------------------------------------------------
         }
-        // --------------------------------------------------------------------
     }
     cout << endl;
 
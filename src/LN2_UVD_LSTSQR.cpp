@@ -148,11 +148,14 @@ int main(int argc, char* argv[]) {
 
     // ========================================================================
     // Fix input datatype issues
-    nifti_image* nii_input = copy_nifti_as_float32(nii1);
+    convert_nifti_to_float32(nii1);
+    nifti_image* nii_input = nii1;
     float* nii_input_data = static_cast<float*>(nii_input->data);
-    nifti_image* coords_uv = copy_nifti_as_float32(nii2);
+    convert_nifti_to_float32(nii2);
+    nifti_image* coords_uv = nii2;
     float* coords_uv_data = static_cast<float*>(coords_uv->data);
-    nifti_image* coords_d = copy_nifti_as_float32(nii3);
+    convert_nifti_to_float32(nii3);
+    nifti_image* coords_d = nii3;
     float* coords_d_data = static_cast<float*>(coords_d->data);
 
     // ========================================================================
@@ -197,34 +200,31 @@ int main(int argc, char* argv[]) {
     // ========================================================================
     cout << "  Fitting..." << endl;
 
-    float half_height = height / 2;
-    float radius_sqr = radius * radius;
+    // Index UVD coordinates so that each cylinder only visits nearby voxels
+    GridUVD grid = grid_uvd(vec_u, vec_v, vec_d, radius, height);
+    vector <uint32_t> found;
+
     for (int i = 0; i != nr_voi; ++i) {
+        cout << "\r    " << i << "/" << nr_voi << flush;
+
         // --------------------------------------------------------------------
         // Cylinder windowing in UVD space
         // --------------------------------------------------------------------
-        vector <float> vec_y;
-        for (int j = 0; j != nr_voi; ++j) {
-            cout << "\r    " << i << "/" << nr_voi << flush;
-
-            // Compute distances relative to reference UVD
-            if (abs(vec_d[i] - vec_d[j]) < half_height) {  // Check height
-                float dist_uv = (vec_u[i] - vec_u[j])*(vec_u[i] - vec_u[j])
-                    + (vec_v[i] - vec_v[j])*(vec_v[i] - vec_v[j]);
-                if (dist_uv < radius_sqr) {  // Check Euclidean distance
-                    vec_y.push_back(vec_val[j]);
-                }
-            }
+        query_cylinder_uvd(grid, vec_u, vec_v, vec_d, i, radius, height, found);
+        int n = found.size();
+        vector <float> vec_y(n), vec_y_d(n);
+        for (int k = 0; k != n; ++k) {
+            vec_y[k] = vec_val[found[k]];
+            vec_y_d[k] = vec_d[found[k]];
         }
 
-        int n = vec_y.size();
         if (n > 1) {
             // ----------------------------------------------------------------
             // Sort vector by depth
             // ----------------------------------------------------------------
             vector <float> vec_y_sorted(n);
             int k = 0;
-            for (auto j: sort_indexes(vec_d)) {
+            for (auto j: sort_indexes(vec_y_d)) {
               vec_y_sorted[k] = vec_y[j];
               k += 1;
             }
@@ -36,6 +36,8 @@ int show_help(void) {
     "        3dUpsample -overwrite -datum short -prefix Nulled_intemp.nii -n 2 -input Nulled.nii\n"
     "        3dUpsample -overwrite -datum short -prefix BOLD_intemp.nii -n 2 -input BOLD.nii\n"
     "    - It is assumed that they have the same spatiotemporal dimensions.\n"
+    "    - Uncompressed (.nii) inputs are read one volume at a time. Compressed\n"
+    "      (.nii.gz) inputs are decompressed into memory as a whole.\n"
     "\n");
     return 0;
 }
@@ -97,12 +99,12 @@ int main(int argc, char * argv[]) {
     }
 
     // Read input dataset
-    nifti_image* nii1 = nifti_image_read(fin_1, 1);
+    nifti_image* nii1 = nifti_image_read_mmap(fin_1);
     if (!nii1) {
         fprintf(stderr, "** failed to read NIfTI from '%s'.\n", fin_1);
         return 2;
     }
-    nifti_image* nii2 = nifti_image_read(fin_2, 1);
+    nifti_image* nii2 = nifti_image_read_mmap(fin_2);
     if (!nii2) {
         fprintf(stderr, "** failed to read NIfTI from '%s'.\n", fin_2);
         return 2;
@@ -117,65 +119,137 @@ int main(int argc, char * argv[]) {
     const int size_y = nii1->ny;
     const int size_z = nii1->nz;
     const int size_time = nii1->nt;
-    const int nx = nii1->nx;
-    const int nxy = nii1->nx * nii1->ny;
     const int nxyz = nii1->nx * nii1->ny * nii1->nz;
     const int nr_voxels = size_time * size_z * size_y * size_x;
 
     // ========================================================================
-    // Fix datatype issues
-    nifti_image *nii_nulled = copy_nifti_as_float32(nii1);
-    float *nii_nulled_data = static_cast<float*>(nii_nulled->data);
-    nifti_image *nii_bold = copy_nifti_as_float32(nii2);
-    float *nii_bold_data = static_cast<float*>(nii_bold->data);
-
-    // Allocate new nifti
-    nifti_image *nii_boco_vaso = copy_nifti_as_float32(nii1);
-    float *nii_boco_vaso_data = static_cast<float*>(nii_boco_vaso->data);
+    // NOTE: Volumes are converted, BOLD corrected and written one at a time.
+    // Only the shift analysis needs the whole time series in memory.
+    const int nr_buffer = (shift == 1) ? nr_voxels : nxyz;
+    float *nii_nulled_data = static_cast<float*>(malloc(nr_buffer * sizeof(float)));
+    float *nii_bold_data = static_cast<float*>(malloc(nr_buffer * sizeof(float)));
+    float *nii_boco_vaso_data = static_cast<float*>(malloc(nr_buffer * sizeof(float)));
+
+    // Allocate new nifti (header only, data is written volume by volume)
+    nifti_image *nii_boco_vaso = nifti_copy_nim_info(nii1);
+    nii_boco_vaso->datatype = NIFTI_TYPE_FLOAT32;
+    nii_boco_vaso->nbyper = sizeof(float);
 
     // ========================================================================
     // Handle scaling factor effects
     // TODO(Faruk): I am not sure we need this part anymore. Need to check.
-    float scl_slope1=nii_nulled->scl_slope, scl_slope2=nii_bold->scl_slope;
-    if (scl_slope1 != 0 || scl_slope2 != 0) {
-        for (int i = 0; i != nr_voxels; ++i) {
-            *(nii_nulled_data + i) *= scl_slope1;
-            *(nii_bold_data + i) *= scl_slope2;
-        }
-    } else {
+    float scl_slope1=nii1->scl_slope, scl_slope2=nii2->scl_slope;
+    if (scl_slope1 == 0 && scl_slope2 == 0) {
         cout << "    !!!Warning!!! Input nifti header contains scl_scale=0.\n"
              << "    Make sure to check the resulting output image.\n"<< endl;
     }
-    // We can set scaling factor to 1 because we have accounted for them above
-    nii_nulled->scl_slope = 1.;
-    nii_bold->scl_slope = 1.;
+    // We can set scaling factor to 1 because we have accounted for them below
     nii_boco_vaso->scl_slope = 1.;
 
+    // Trial average sums
+    int nr_trials = 0;
+    float *sum_nulled_data = NULL, *sum_bold_data = NULL;
+    if (trialdur != 0) {
+        nr_trials = size_time / trialdur;
+        sum_nulled_data = static_cast<float*>(calloc(nxyz * trialdur, sizeof(float)));
+        sum_bold_data = static_cast<float*>(calloc(nxyz * trialdur, sizeof(float)));
+    }
+
+    znzFile fp_boco_vaso = NULL;
+    if (shift != 1) {
+        if (use_outpath) {
+            fp_boco_vaso = open_output_nifti("VASO_LN", "", nii_boco_vaso, true, true);
+        } else {
+            fp_boco_vaso = open_output_nifti(fout, "VASO_LN", nii_boco_vaso, true);
+        }
+    }
+
     // ========================================================================
     // BOLD correction
     // ========================================================================
-    if (mode_alt) {
-        int nr_invalid_voxels = 0, nr_zero_voxels = 0;
-        for (int i = 0; i != nr_voxels; ++i) {
-            float nc = *(nii_nulled_data + i);  // Nulled condition
-            float nn = (*(nii_bold_data + i));  // Not nulled condition (a.k.a BOLD)
+    int nr_invalid_voxels = 0, nr_zero_voxels = 0;
+    for (int t = 0; t < size_time; ++t) {
+        const int offset = (shift == 1) ? nxyz * t : 0;
+        float *nulled_data = nii_nulled_data + offset;
+        float *bold_data = nii_bold_data + offset;
+        float *boco_vaso_data = nii_boco_vaso_data + offset;
+
+        // Fix datatype issues
+        copy_volume_as_float32(nii1, t, nulled_data);
+        copy_volume_as_float32(nii2, t, bold_data);
+        if (scl_slope1 != 0 || scl_slope2 != 0) {
+            for (int i = 0; i != nxyz; ++i) {
+                *(nulled_data + i) *= scl_slope1;
+                *(bold_data + i) *= scl_slope2;
+            }
+        }
+
+        if (mode_alt) {
+            for (int i = 0; i != nxyz; ++i) {
+                float nc = *(nulled_data + i);  // Nulled condition
+                float nn = (*(bold_data + i));  // Not nulled condition (a.k.a BOLD)
+
+                float S_ex = nc;  // Approximately extravascular signal
+                float S_in = nn - nc;  // Approximately intravascular signal
+
+                if (nc <= 0 || nn <= 0) {
+                    *(boco_vaso_data + i) = 0;
+                    nr_zero_voxels += 1;
+                }  else {
+                    if (S_in <= 0) {
+                        // VASO assumptions invalid S_in should not be negative.
+                        S_in *= -1;
+                        nr_invalid_voxels += 1;
+                    }
+                    // Compute relative contribution (always between -1 to 1)
+                    *(boco_vaso_data + i) =  S_ex / (S_ex + S_in);
+                }
+            }
+        } else {
+            for (int i = 0; i != nxyz; ++i) {
+                float nc = *(nulled_data + i);  // Nulled condition
+                float nn = *(bold_data + i);  // Not nulled condition (a.k.a BOLD)
+
+                if (nc <= 0 || nn <= 0) {  // Skip masked-out or invalid voxels
+                    *(boco_vaso_data + i) = 0;
+                }  else {  // BOLD correction is happening here
+                    *(boco_vaso_data + i) = nc / nn;
+                }
 
-            float S_ex = nc;  // Approximately extravascular signal
-            float S_in = nn - nc;  // Approximately intravascular signal
+                // Clip VASO values that are unrealistic
+                if (*(boco_vaso_data + i) <= 0) {
+                    *(boco_vaso_data + i) = 0;
+                }
+                if (*(boco_vaso_data + i) >= 5) {
+                    *(boco_vaso_data + i) = 5;
+                }
+            }
+        }
 
-            if (nc <= 0 || nn <= 0) {
-                *(nii_boco_vaso_data + i) = 0;
-                nr_zero_voxels += 1;
-            }  else {
-                if (S_in <= 0) {
-                    // VASO assumptions invalid S_in should not be negative.
-                    S_in *= -1;
-                    nr_invalid_voxels += 1;
+        // Trial average
+        if (trialdur != 0 && t < trialdur * nr_trials) {
+            float *sum_nulled_t = sum_nulled_data + nxyz * (t % trialdur);
+            float *sum_bold_t = sum_bold_data + nxyz * (t % trialdur);
+            for (int i = 0; i != nxyz; ++i) {
+                *(sum_nulled_t + i) += *(nulled_data + i) / nr_trials;
+                *(sum_bold_t + i) += *(bold_data + i) / nr_trials;
+            }
+        }
+
+        if (shift != 1) {
+            // Replace nans with zeros
+            for (int i = 0; i < nxyz; ++i) {
+                if (*(boco_vaso_data + i)!= *(boco_vaso_data + i)) {
+                   *(boco_vaso_data + i) = 0;
                 }
-                // Compute relative contribution (always between -1 to 1)
-                *(nii_boco_vaso_data + i) =  S_ex / (S_ex + S_in);
             }
+            write_output_volume(fp_boco_vaso, boco_vaso_data, nxyz);
         }
+    }
+    nifti_image_unload(nii1);
+    nifti_image_unload(nii2);
+
+    if (mode_alt) {
         float term1 = static_cast<float>(nr_invalid_voxels);
         float term2 = static_cast<float>(nr_voxels - nr_zero_voxels);
 
@@ -183,37 +257,15 @@ int main(int argc, char * argv[]) {
         cout << "    "
             << nr_invalid_voxels << "/" << nr_voxels - nr_zero_voxels
             << "\n    " << (term1 / term2) * 100 << "%\n" << endl;
-    } else {
-
-        for (int i = 0; i != nr_voxels; ++i) {
-            float nc = *(nii_nulled_data + i);  // Nulled condition
-            float nn = *(nii_bold_data + i);  // Not nulled condition (a.k.a BOLD)
-
-            if (nc <= 0 || nn <= 0) {  // Skip masked-out or invalid voxels
-                *(nii_boco_vaso_data + i) = 0;
-            }  else {  // BOLD correction is happening here
-                *(nii_boco_vaso_data + i) = nc / nn;
-            }
-        }
-
-        // Clip VASO values that are unrealistic
-        for (int i = 0; i != nr_voxels; ++i) {
-            if (*(nii_boco_vaso_data + i) <= 0) {
-                *(nii_boco_vaso_data + i) = 0;
-            }
-            if (*(nii_boco_vaso_data + i) >= 5) {
-                *(nii_boco_vaso_data + i) = 5;
-            }
-        }
     }
 
     // ========================================================================
     // Shift
     // ========================================================================
     if (shift == 1) {
-        nifti_image* correl_file  = nifti_copy_nim_info(nii_nulled);
+        nifti_image* correl_file  = nifti_copy_nim_info(nii_boco_vaso);
         correl_file->nt = 7;
-        correl_file->nvox = nii_nulled->nvox / size_time *7;
+        correl_file->nvox = nii_boco_vaso->nvox / size_time *7;
         correl_file->datatype = NIFTI_TYPE_FLOAT32;
         correl_file->nbyper = sizeof(float);
         correl_file->data = calloc(correl_file->nvox, correl_file->nbyper);
@@ -255,7 +307,7 @@ int main(int argc, char * argv[]) {
         }
 
             // Replace nans with zeros
-        for (int i = 0; i < nr_voxels; ++i) {
+        for (int i = 0; i < correl_file->nvox; ++i) {
             if (*(correl_file_data + i)!= *(correl_file_data + i)) {
                *(correl_file_data + i) = 0;
             }
@@ -273,7 +325,6 @@ int main(int argc, char * argv[]) {
              << ". This means there are " << (float)size_time / (float)trialdur
              <<  " trials recorded here." << endl;
 
-        int nr_trials = size_time / trialdur;
         // Trial averave file
         nifti_image *nii_avg1 = nifti_copy_nim_info(nii1);
         nii_avg1->nt = trialdur;
@@ -288,52 +339,18 @@ int main(int argc, char * argv[]) {
         nii_avg2->nvox = nii1->nvox / size_time * trialdur;
         nii_avg2->datatype = NIFTI_TYPE_FLOAT32;
         nii_avg2->nbyper = sizeof(float);
-        nii_avg2->data = calloc(nii_avg2->nvox, nii_avg2->nbyper);
+        nii_avg2->data = sum_bold_data;  // Averages were summed up above
         float  *nii_avg1_B_data  = static_cast<float*>(nii_avg2->data);
 
-        float avg_Nulled[trialdur];
-        float avg_BOLD[trialdur];
-
-        for (int iz = 0; iz < size_z; ++iz) {
-            for (int iy = 0; iy < size_y; ++iy) {
-                for (int ix = 0; ix < size_x; ++ix) {
-                    for (int it = 0; it < trialdur; ++it) {
-                        avg_Nulled[it] = 0;
-                        avg_BOLD[it] = 0;
-                    }
-                    for (int it = 0; it < trialdur * nr_trials; ++it) {
-                        int voxel_i = nxyz * it + nxy * iz + nx * iy + ix;
-                        avg_Nulled[it % trialdur] +=
-                            *(nii_nulled_data + voxel_i) / nr_trials;
-                        avg_BOLD[it % trialdur] +=
-                            *(nii_bold_data + voxel_i) / nr_trials;
-                    }
-
-                    for (int it = 0; it < trialdur; ++it) {
-                        int voxel_i = nxyz * it + nxy * iz + nx * iy + ix;
-                        *(nii_avg1_data + voxel_i) = avg_Nulled[it] / avg_BOLD[it];
-                        *(nii_avg1_B_data + voxel_i) = avg_BOLD[it];
+        for (int i = 0; i < nxyz * trialdur; ++i) {
+            *(nii_avg1_data + i) = *(sum_nulled_data + i) / *(nii_avg1_B_data + i);
 
-                    }
-                }
+            // Clean VASO values that are unrealistic
+            if (*(nii_avg1_data + i) <= 0) {
+                *(nii_avg1_data + i) = 0;
             }
-        }
-
-        // Clean VASO values that are unrealistic
-        for (int iz = 0; iz < size_z; ++iz) {
-            for (int iy = 0; iy < size_y; ++iy) {
-                for (int ix = 0; ix < size_x; ++ix) {
-                    for (int it = 0; it < trialdur; ++it) {
-                        int voxel_i = nxyz * it + nxy * iz + nx * iy + ix;
-
-                        if (*(nii_avg1_data + voxel_i) <= 0) {
-                            *(nii_avg1_data + voxel_i) = 0;
-                        }
-                        if (*(nii_avg1_data + voxel_i) >= 2) {
-                            *(nii_avg1_data + voxel_i) = 2;
-                        }
-                    }
-                }
+            if (*(nii_avg1_data + i) >= 2) {
+                *(nii_avg1_data + i) = 2;
             }
         }
         if (use_outpath) {
@@ -345,19 +362,21 @@ int main(int argc, char * argv[]) {
         }
     }
 
-
-    // Replace nans with zeros
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nii_boco_vaso_data + i)!= *(nii_boco_vaso_data + i)) {
-           *(nii_boco_vaso_data + i) = 0;
+    if (shift == 1) {
+        // Replace nans with zeros
+        for (int i = 0; i < nr_voxels; ++i) {
+            if (*(nii_boco_vaso_data + i)!= *(nii_boco_vaso_data + i)) {
+               *(nii_boco_vaso_data + i) = 0;
+            }
         }
+        if (use_outpath) {
+            fp_boco_vaso = open_output_nifti("VASO_LN", "", nii_boco_vaso, true, true);
+        } else {
+            fp_boco_vaso = open_output_nifti(fout, "VASO_LN", nii_boco_vaso, true);
+        }
+        write_output_volume(fp_boco_vaso, nii_boco_vaso_data, nr_voxels);
     }
-
-    if (use_outpath) {
-        save_output_nifti("VASO_LN", "", nii_boco_vaso, true, true);
-    } else {
-        save_output_nifti(fout, "VASO_LN", nii_boco_vaso, true);
-    }
+    close_output_nifti(fp_boco_vaso);
 
     cout << "  Finished." << endl;
     return 0;
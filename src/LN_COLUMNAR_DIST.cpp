@@ -184,7 +184,6 @@ int main(int argc, char *argv[]) {
     // Growing from Center cross columns
     // ========================================================================
     int jz_start, jy_start, jx_start, jz_stop, jy_stop, jx_stop;
-    int kz_start, ky_start, kx_start, kz_stop, ky_stop, kx_stop;
 
     cout << "  Growing from center..." << endl;
     for (int iz = 0; iz < size_z; ++iz) {
@@ -346,20 +345,18 @@ int main(int argc, char *argv[]) {
     nifti_image* hairy = copy_nifti_as_int32(nii_layers);
     int32_t* hairy_data = static_cast<int32_t*>(hairy->data);
 
-    for (int i = 0; i < nr_voxels; ++i) {
-        if (*(nim_layers_data + i) > 1) {
-            *(hairy_data + i) = 1;
-        } else {
-            *(hairy_data + i) = 0;
-        }
-    }
-
     // This is an upper limit of the cortical thickness
     dist_min2 = 10000.;
 
-    // This is step size that neigbouring GM voxels need to be to be classified
-    // as one side of the GM bank.
-    int vinc_steps = 1;
+    // Voxels of one side of the GM bank are face neighbours within the GM.
+    // Patches are searched with a bounded breadth-first search, instead of
+    // repeatedly sweeping the whole vicinity.
+    Neighbours26 nb = neighbours_26(size_x, size_y, size_z, dX, dY, dZ);
+    LocalPatch patch = local_patch(nr_voxels);
+    auto in_gm = [&](uint32_t j) {
+        return *(nim_layers_data + j) > 1
+               && *(nim_layers_data + j) < nr_layers - 1;
+    };
 
     int vinc_sm_g = 25;
     int pref_ratio = 0;
@@ -390,106 +387,29 @@ int main(int argc, char *argv[]) {
                     // --------------------------------------------------------
                     // Find area that is not from the other sulcus
                     // --------------------------------------------------------
-                    jz_start = max(0, iz - vinc_sm_g - vinc_steps);
-                    jy_start = max(0, iy - vinc_sm_g - vinc_steps);
-                    jx_start = max(0, ix - vinc_sm_g - vinc_steps);
-                    jz_stop = min(iz + vinc_sm_g + vinc_steps, size_z - 1);
-                    jy_stop = min(iy + vinc_sm_g + vinc_steps, size_y - 1);
-                    jx_stop = min(ix + vinc_sm_g + vinc_steps, size_x - 1);
-
-                    for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                        for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                            for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                int voxel_j = nxy * jz + nx * jy + jx;
-                                *(hairy_data + voxel_j) = 0;
-                            }
-                        }
-                    }
-                    min_val = 0;
+                    // Local patch of connected voxels, excluding voxels from
+                    // opposite GM bank.
+                    local_patch_grow(patch, nb, voxel_i, vinc_sm_g, 6, in_gm, vinc_sm_g);
 
-                    // Iteration loop that determines a local patch of connected
-                    // voxels, excluding voxels from opposite GM bank.
-                    // NOTE(Renzo): This loop takes forever
-                    *(hairy_data + voxel_i) = 1;
-                    for (int K_ = 0; K_ < vinc_sm_g; K_++) {
-
-                        jz_start = max(0, iz - vinc_sm_g);
-                        jy_start = max(0, iy - vinc_sm_g);
-                        jx_start = max(0, ix - vinc_sm_g);
-                        jz_stop = min(iz + vinc_sm_g, size_z - 1);
-                        jy_stop = min(iy + vinc_sm_g, size_x - 1);
-                        jx_stop = min(ix + vinc_sm_g, size_y - 1);
-
-                        for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                            for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                                for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                    int voxel_j = nxy * jz + nx * jy + jx;
-
-                                    if (*(hairy_data + voxel_j) == 1) {
-
-                                        kz_start = max(0, jz - vinc_steps);
-                                        ky_start = max(0, jy - vinc_steps);
-                                        kx_start = max(0, jx - vinc_steps);
-                                        kz_stop = min(jz + vinc_steps, size_z - 1);
-                                        ky_stop = min(jy + vinc_steps, size_y - 1);
-                                        kx_stop = min(jx + vinc_steps, size_x - 1);
-
-                                        for (int kz = kz_start; kz <= kz_stop; ++kz) {
-                                            for (int ky = ky_start; ky <= ky_stop; ++ky) {
-                                                for (int kx = kx_start; kx <= kx_stop; ++kx) {
-                                                    int voxel_k = nxy * kz + nx * ky + kx;
-
-                                                    float d = dist((float)jx, (float)jy, (float)jz,
-                                                                   (float)kx, (float)ky, (float)kz,
-                                                                   1, 1, 1);
-
-                                                    if (d <= 1
-                                                        && *(nim_layers_data + voxel_k) > 1
-                                                        && *(nim_layers_data + voxel_k) < nr_layers - 1) {
-                                                        *(hairy_data + voxel_k) = 1;
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
+                    // Closest voxel of the patch that is grown into. Ties go
+                    // to the lowest voxel index, like a scan of the vicinity.
                     dist_min2 = 10000.;
-                    x1g = 0;
-                    y1g = 0;
-                    z1g = 0;
-                    // Only grow into areas that are GM and that have not been
-                    // grown into, yet... and it should stop as soon as it hits
-                    // the border
-
-                    jz_start = max(0, iz - vinc_sm_g);
-                    jy_start = max(0, iy - vinc_sm_g);
-                    jx_start = max(0, ix - vinc_sm_g);
-                    jz_stop = min(iz + vinc_sm_g, size_z - 1);
-                    jy_stop = min(iy + vinc_sm_g, size_x - 1);
-                    jx_stop = min(ix + vinc_sm_g, size_y - 1);
-
-                    for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                        for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                            for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                int voxel_j = nxy * jz + nx * jy + jx;
-
-                                dist_i = dist((float)ix, (float)iy, (float)iz,
-                                              (float)jx, (float)jy, (float)jz,
-                                              dX, dY, dZ);
-
-                                if (*(hairy_data + voxel_j) == 1
-                                    && dist_i < dist_min2
-                                    && *(growfromCenter_data + voxel_j) > 0) {
-                                    dist_min2 = dist_i;
-                                    x1g = jx;
-                                    y1g = jy;
-                                    z1g = jz;
-                                    dist_p1 = dist_min2;
-                                    min_val = *(growfromCenter_data + voxel_j);
-                                }
+                    min_val = 0;
+                    uint32_t voxel_min = 0;
+                    for (size_t jj = 0; jj != patch.voxels.size(); ++jj) {
+                        uint32_t voxel_j = patch.voxels[jj];
+                        if (*(growfromCenter_data + voxel_j) > 0) {
+                            uint32_t jx, jy, jz;
+                            tie(jx, jy, jz) = ind2sub_3D(voxel_j, size_x, size_y);
+                            dist_i = dist((float)ix, (float)iy, (float)iz,
+                                          (float)jx, (float)jy, (float)jz,
+                                          dX, dY, dZ);
+
+                            if (dist_i < dist_min2
+                                || (dist_i == dist_min2 && voxel_j < voxel_min)) {
+                                dist_min2 = dist_i;
+                                voxel_min = voxel_j;
+                                min_val = *(growfromCenter_data + voxel_j);
                             }
                         }
                     }
@@ -537,67 +457,8 @@ int main(int argc, char *argv[]) {
                     // --------------------------------------------------------
                     // Find area that is not from the other sulcus
                     // --------------------------------------------------------
-                    // Preparation of dummy vicinity
-                    jz_start = max(0, iz - vinc_sm - vinc_steps);
-                    jy_start = max(0, iy - vinc_sm - vinc_steps);
-                    jx_start = max(0, ix - vinc_sm - vinc_steps);
-                    jz_stop = min(iz + vinc_sm + vinc_steps, size_z - 1);
-                    jy_stop = min(iy + vinc_sm + vinc_steps, size_y - 1);
-                    jx_stop = min(ix + vinc_sm + vinc_steps, size_x - 1);
-
-                    for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                        for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                            for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                int voxel_j = nxy * jz + nx * jy + jx;
-                                *(hairy_data + voxel_j) = 0;
-                            }
-                        }
-                    }
-                    *(hairy_data + voxel_i) = 1;
-                    for (int K_ = 0; K_ < vinc_sm; K_++) {
+                    local_patch_grow(patch, nb, voxel_i, vinc_sm, 6, in_gm, vinc_sm);
 
-                        jz_start = max(0, iz - vinc_sm);
-                        jy_start = max(0, iy - vinc_sm);
-                        jx_start = max(0, ix - vinc_sm);
-                        jz_stop = min(iz + vinc_sm, size_z - 1);
-                        jy_stop = min(iy + vinc_sm, size_y - 1);
-                        jx_stop = min(ix + vinc_sm, size_x - 1);
-
-                        for (int jz = jz_start; jz <= jz_stop; ++jz) {
-                            for (int jy = jy_start; jy <= jy_stop; ++jy) {
-                                for (int jx = jx_start; jx <= jx_stop; ++jx) {
-                                    int voxel_j = nxy * jz + nx * jy + jx;
-
-                                    if (*(hairy_data + voxel_j) == 1) {
-
-                                        int kz_start = max(0, jz - vinc_steps);
-                                        int ky_start = max(0, jy - vinc_steps);
-                                        int kx_start = max(0, jx - vinc_steps);
-                                        int kz_stop = min(jz + vinc_steps, size_z - 1);
-                                        int ky_stop = min(jy + vinc_steps, size_y - 1);
-                                        int kx_stop = min(jx + vinc_steps, size_x - 1);
-
-                                        for (int kz = kz_start; kz <= kz_stop; ++kz) {
-                                            for (int ky = ky_start; ky <= ky_stop; ++ky) {
-                                                for (int kx = kx_start; kx <= kx_stop; ++kx) {
-                                                    int voxel_k = nxy * kz + nx * ky + kx;
-
-                                                    float d = dist((float)jx, (float)jy, (float)jz,
-                                                                   (float)kx, (float)ky, (float)kz,
-                                                                   1, 1, 1);
-                                                    if (d <= 1
-                                                        && *(nim_layers_data + voxel_k) > 1
-                                                        && *(nim_layers_data + voxel_k) < nr_layers - 1) {
-                                                        *(hairy_data + voxel_k) = 1;
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
                     // Smoothing within each layer and within the local patch
                     int nr_layers_i = *(nim_layers_data + voxel_i);
 
@@ -613,7 +474,7 @@ int main(int argc, char *argv[]) {
                             for (int jx = jx_start; jx <= jx_stop; ++jx) {
                                 int voxel_j = nxy * jz + nx * jy + jx;
 
-                                if (*(hairy_data + voxel_j) == 1
+                                if (in_local_patch(patch, voxel_j)
                                     && abs((int) *(nim_layers_data + voxel_j) - nr_layers_i) < 2
                                     && *(growfromCenter_thick_data + voxel_j) > 0) {
                                     dist_i = dist((float)ix, (float)iy, (float)iz,
@@ -3,6 +3,31 @@
 
 #include "../dep/laynii_lib.h"
 
+template <typename T_acc>
+static void correlate_volumes(nifti_image* nii1, nifti_image* nii2,
+                              float* correl_data) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Single pass over both time series, one volume at a time. Only the
+    // running means, second moments and co-moment are kept per voxel.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nxyz = nii1->nx * nii1->ny * nii1->nz;
+    const int size_time = nii1->nt;
+
+    vector<float> vol1(nxyz), vol2(nxyz);
+    RunningComoments<T_acc> rc = running_comoments<T_acc>(nxyz);
+    for (int it = 0; it < size_time; ++it) {
+        copy_volume_as_float32(nii1, it, vol1.data());
+        copy_volume_as_float32(nii2, it, vol2.data());
+        running_comoments_add(rc, vol1.data(), vol2.data());
+    }
+
+    #pragma omp parallel for
+    for (int64_t voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+        *(correl_data + voxel_i) = static_cast<float>(rc.c_xy[voxel_i]
+            / sqrt(rc.m2_x[voxel_i] * rc.m2_y[voxel_i]));
+    }
+}
+
 int show_help(void) {
     printf(
     "LN_CORREL2FILES: Estimate the voxel wise correlation of two timeseries.\n"
@@ -12,12 +37,17 @@ int show_help(void) {
     "    ../LN_CORREL2FILES -file1 lo_Nulled_intemp.nii -file2 lo_BOLD_intemp.nii \n"
     "\n"
     "Options:\n"
-    "    -help   : Show this help.\n"
-    "    -file1  : First time series.\n"
-    "    -file2  : Second time series with should have the same dimensions \n"
-    "              as first time series.\n"
-    "    -output : (Optional) Output filename, including .nii or\n"
-    "              .nii.gz, and path if needed. Overwrites existing files.\n"
+    "    -help    : Show this help.\n"
+    "    -file1   : First time series.\n"
+    "    -file2   : Second time series with should have the same dimensions \n"
+    "               as first time series.\n"
+    "    -threads : (Optional) Number of threads for parallel loops.\n"
+    "               Default is 1.\n"
+    "    -float_acc: (Optional) Accumulate in single instead of double\n"
+    "               precision. Faster, but less accurate for long or\n"
+    "               high-intensity time series.\n"
+    "    -output  : (Optional) Output filename, including .nii or\n"
+    "               .nii.gz, and path if needed. Overwrites existing files.\n"
     "\n"
     "Notes:\n"
     "    - This program is motivated by Eli Merriam comparing in hunting down \n"
@@ -32,7 +62,8 @@ int main(int argc, char *argv[]) {
     bool use_outpath = false ;
     char  *fout = NULL ;
     char *fin_1 = NULL, *fin_2 = NULL;
-    int ac;
+    int ac, nr_threads = 1;
+    bool mode_float_acc = false;
     if (argc < 2) return show_help();
 
     // Process user options
@@ -52,6 +83,14 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             fin_2 = argv[ac];
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
+        } else if (!strcmp(argv[ac], "-float_acc")) {
+            mode_float_acc = true;
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -75,12 +114,12 @@ int main(int argc, char *argv[]) {
     }
 
     // Read input dataset
-    nifti_image* nii1 = nifti_image_read(fin_1, 1);
+    nifti_image* nii1 = nifti_image_read_mmap(fin_1);
     if (!nii1) {
         fprintf(stderr, "** failed to read NIfTI image from '%s'\n", fin_1);
         return 2;
     }
-    nifti_image*nii2 = nifti_image_read(fin_2, 1);
+    nifti_image*nii2 = nifti_image_read_mmap(fin_2);
     if (!nii2) {
         fprintf(stderr, "** failed to read NIfTI image from '%s'\n", fin_2);
         return 2;
@@ -89,46 +128,33 @@ int main(int argc, char *argv[]) {
     log_welcome("LN_CORREL2FILES");
     log_nifti_descriptives(nii1);
     log_nifti_descriptives(nii2);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     int size_z = nii1->nz;
     int size_x = nii1->nx;
     int size_y = nii1->ny;
-    int size_time = nii1->nt;
-    int nx = nii1->nx;
-    int nxy = nii1->nx * nii1->ny;
-    int nxyz = nii1->nx * nii1->ny * nii1->nz;
 
     // ========================================================================
-    // Fix datatype issues
-    nifti_image* nii1_temp = copy_nifti_as_float32(nii1);
-    float* nii1_temp_data = static_cast<float*>(nii1_temp->data);
-    nifti_image* nii2_temp = copy_nifti_as_float32(nii2);
-    float* nii2_temp_data = static_cast<float*>(nii2_temp->data);
-
     // Allocate new nifti
-    nifti_image *correl_file = nifti_copy_nim_info(nii1_temp);
+    // NOTE: Inputs are read one volume at a time, they are not converted as
+    // a whole.
+    nifti_image *correl_file = nifti_copy_nim_info(nii1);
     correl_file->nt = 1;
     correl_file->nvox = size_x * size_y * size_z;
+    correl_file->datatype = NIFTI_TYPE_FLOAT32;
+    correl_file->nbyper = sizeof(float);
     correl_file->data = calloc(correl_file->nvox, correl_file->nbyper);
     float *correl_file_data = static_cast<float*>(correl_file->data);
     // ========================================================================
 
-    double vec1[size_time], vec2[size_time];
-    for (int iz = 0; iz < size_z; ++iz) {
-        for (int iy = 0; iy < size_y; ++iy) {
-            for (int ix = 0; ix < size_x; ++ix) {
-                int voxel_i = nxy * iz + nx * iy + ix;
-                for (int it = 0; it < size_time; ++it) {
-                    int voxel_j = nxyz * it + nxy * iz + nx * iy + ix;
-                    vec1[it] = *(nii1_temp_data + voxel_j);
-                    vec2[it] = *(nii2_temp_data + voxel_j);
-                }
-                *(correl_file_data + voxel_i) =
-                    static_cast<float>(ren_correl(vec1, vec2, size_time));
-            }
-        }
+    if (mode_float_acc) {
+        correlate_volumes<float>(nii1, nii2, correl_file_data);
+    } else {
+        correlate_volumes<double>(nii1, nii2, correl_file_data);
     }
+    nifti_image_unload(nii1);
+    nifti_image_unload(nii2);
 
     if (!use_outpath) fout = fin_1;
     save_output_nifti(fout, "correlated", correl_file, true, use_outpath);
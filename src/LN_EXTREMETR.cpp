@@ -23,6 +23,10 @@ int show_help(void) {
     "    -output : (Optional) Output filename, including .nii or\n"
     "              .nii.gz, and path if needed. Overwrites existing files.\n"
     "              Note that the output name will always contain MaxTR/MinTR tags.\n"
+    "\n"
+    "Notes:\n"
+    "    Uncompressed (.nii) inputs are read one volume at a time. Compressed\n"
+    "    (.nii.gz) inputs are decompressed into memory as a whole.\n"
     "\n");
     return 0;
 }
@@ -58,7 +62,7 @@ int main(int argc, char * argv[]) {
         return 1;
     }
     // Read input dataset, including data
-    nifti_image* nii_in = nifti_image_read(fin_1, 1);
+    nifti_image* nii_in = nifti_image_read_mmap(fin_1);
     if (!nii_in) {
       fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin_1);
       return 2;
@@ -77,12 +81,8 @@ int main(int argc, char * argv[]) {
     const int nxyz = size_x * size_y * size_z;
 
     // ========================================================================
-    // Fix datatype issues
-    nifti_image* nii = copy_nifti_as_float32(nii_in);
-    float* nii_data = static_cast<float*>(nii->data);
-
     // Allocate new nifti images
-    nifti_image* nii_max = nifti_copy_nim_info(nii);
+    nifti_image* nii_max = nifti_copy_nim_info(nii_in);
     nii_max->nt = 1;
     nii_max->datatype = NIFTI_TYPE_FLOAT32;
     nii_max->nbyper = sizeof(float);
@@ -90,7 +90,7 @@ int main(int argc, char * argv[]) {
     nii_max->data = calloc(nii_max->nvox, nii_max->nbyper);
     float* nii_max_data = static_cast<float*>(nii_max->data);
 
-    nifti_image* nii_min = nifti_copy_nim_info(nii);
+    nifti_image* nii_min = nifti_copy_nim_info(nii_in);
     nii_min->nt = 1;
     nii_min->datatype = NIFTI_TYPE_FLOAT32;
     nii_min->nbyper = sizeof(float);
@@ -99,24 +99,46 @@ int main(int argc, char * argv[]) {
     float* nii_min_data = static_cast<float*>(nii_min->data);
 
     // ========================================================================
-    int TR_max = 0, TR_min = 0;
+    // NOTE: The time series is read one volume at a time (fix datatype
+    // issues per volume). Running extremes are updated per voxel. A TR of -1
+    // means that the voxel never exceeded the initial extreme values.
+    float* nii_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+    float* max_val_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+    float* min_val_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+    int* TR_max_data = static_cast<int*>(malloc(nxyz * sizeof(int)));
+    int* TR_min_data = static_cast<int*>(malloc(nxyz * sizeof(int)));
+    for (int voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+        *(max_val_data + voxel_i) = 0;
+        *(min_val_data + voxel_i) = std::numeric_limits<float>::max();
+        *(TR_max_data + voxel_i) = -1;
+        *(TR_min_data + voxel_i) = -1;
+    }
 
+    for (int it = 0; it < size_time; ++it) {
+        copy_volume_as_float32(nii_in, it, nii_data);
+        for (int voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+            if (*(nii_data + voxel_i) > *(max_val_data + voxel_i)) {
+                *(max_val_data + voxel_i) = *(nii_data + voxel_i);
+                *(TR_max_data + voxel_i) = it;
+            }
+            if (*(nii_data + voxel_i) < *(min_val_data + voxel_i)) {
+                *(min_val_data + voxel_i) = *(nii_data + voxel_i);
+                *(TR_min_data + voxel_i) = it;
+            }
+        }
+    }
+
+    // Voxels without an update keep the TR of the previous voxel
+    int TR_max = 0, TR_min = 0;
     for (int iz = 0; iz < size_z; ++iz) {
         for (int iy = 0; iy < size_y; ++iy) {
             for (int ix = 0; ix < size_x; ++ix) {
                 int voxel_i = nxy * iz + nx * iy + ix;
-                float max_val = 0;
-                float min_val = std::numeric_limits<float>::max();
-                for (int it = 0; it < size_time; ++it) {
-                    int voxel_j = nxyz * it + nxy * iz + nx * iy + ix;
-                    if (*(nii_data + voxel_j) > max_val) {
-                        max_val = *(nii_data + voxel_j);
-                        TR_max = it;
-                    }
-                    if (*(nii_data + voxel_j) < min_val) {
-                        min_val = *(nii_data + voxel_j);
-                        TR_min = it;
-                    }
+                if (*(TR_max_data + voxel_i) >= 0) {
+                    TR_max = *(TR_max_data + voxel_i);
+                }
+                if (*(TR_min_data + voxel_i) >= 0) {
+                    TR_min = *(TR_min_data + voxel_i);
                 }
                 *(nii_min_data + voxel_i) = TR_min;
                 *(nii_max_data + voxel_i) = TR_max;
@@ -64,24 +64,9 @@ int main(int argc, char *argv[]) {
     log_welcome("LN_FLOAT_ME");
     log_nifti_descriptives(nii);
 
-    // Get dimensions of input
-    const int size_x = nii->nx;
-    const int size_y = nii->ny;
-    const int size_z = nii->nz;
-    const int size_t = nii->nt;
-    const int nr_voxels = size_t * size_z * size_y * size_x;
-
-    // Cast input data to float
-    nifti_image *nii_new = copy_nifti_as_float32(nii);
-    float* nii_new_data = static_cast<float*>(nii_new->data);
-
-    // Handle nifti header scl_slope and scl_inter effects
-    float scl_slope = nii->scl_slope;
-    float scl_inter = nii->scl_inter;
-    for (int i = 0; i != nr_voxels; ++i) {
-        *(nii_new_data + i) *= scl_slope;
-        *(nii_new_data + i) += scl_inter;
-    }
+    // Cast input data to float, applying nifti header scl_slope and
+    // scl_inter effects
+    nifti_image *nii_new = copy_nifti_as_float32(nii, true);
     nii_new->scl_slope = 1.;
     nii_new->scl_inter = 0.;
 
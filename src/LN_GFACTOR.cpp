@@ -2,18 +2,6 @@
 
 #include "../dep/laynii_lib.h"
 
-int N_rand = 1000;
-double_t lower = -10;
-double_t upper = 10;
-
-double verteilung(double x);
-typedef double ( * Functions)(double);
-Functions pFunc = verteilung;
-
-double_t arb_pdf_num(int N_rand, double ( * pFunc)(double), double_t lower,
-                     double_t upper);
-double adjusted_rand_numbers(double mean, double stdev, double value);
-
 int show_help(void) {
     printf(
     "LN_GFACTOR: Simulating where the g-factor penalty would be largest.\n"
@@ -29,6 +17,9 @@ int show_help(void) {
     "    -direction : Phase encoding direction [0=x, 1=y, 2=z].\n"
     "    -grappa    : GRAPPA factor."
     "    -cutoff    : Value to seperate noise from signal.\n"
+    "    -seed      : (Optional) Seed of the random noise. Default is 0.\n"
+    "    -threads   : (Optional) Number of threads for parallel loops.\n"
+    "                 Default is 1.\n"
     "    -output    : (Optional) Output filename, including .nii or\n"
     "                 .nii.gz, and path if needed. Overwrites existing files.\n"
     "\n"
@@ -44,8 +35,11 @@ int main(int argc, char * argv[]) {
     char  *fout = NULL ;
     nifti_image* nii = NULL;
     char * fin = NULL;
-    int grappa_int, direction_int, ac;
-    float cutoff, variance_val;
+    int grappa_int = 0, direction_int = -1, ac;
+    float cutoff = 0, variance_val = 0;
+    bool has_cutoff = false;
+    uint64_t seed = 0;
+    int nr_threads = 1;
     if (argc < 2) return show_help();
 
     // Process user options
@@ -82,6 +76,19 @@ int main(int argc, char * argv[]) {
                 return 1;
             }
             cutoff = atof(argv[ac]);
+            has_cutoff = true;
+        } else if (!strcmp(argv[ac], "-seed")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -seed\n");
+                return 1;
+            }
+            seed = strtoull(argv[ac], NULL, 10);
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -99,6 +106,22 @@ int main(int argc, char * argv[]) {
         fprintf(stderr, "** missing option '-input'\n");
         return 1;
     }
+    if (variance_val <= 0) {
+        fprintf(stderr, "** missing option '-variance' (a positive value)\n");
+        return 1;
+    }
+    if (direction_int < 0 || direction_int > 2) {
+        fprintf(stderr, "** missing option '-direction' (0, 1 or 2)\n");
+        return 1;
+    }
+    if (grappa_int < 1) {
+        fprintf(stderr, "** missing option '-grappa' (1 or more)\n");
+        return 1;
+    }
+    if (!has_cutoff) {
+        fprintf(stderr, "** missing option '-cutoff'\n");
+        return 1;
+    }
 
     // Read input dataset
     nii = nifti_image_read(fin, 1);
@@ -109,6 +132,7 @@ int main(int argc, char * argv[]) {
 
     log_welcome("LN_GFACTOR");
     log_nifti_descriptives(nii);
+    set_nr_threads(nr_threads);
 
     cout << "  Variance  = " << variance_val << endl;
     cout << "  Direction = " << direction_int << endl;
@@ -278,11 +302,14 @@ int main(int argc, char * argv[]) {
             }
         }
     }
+    // NOTE: Noise of each voxel only depends on the seed and voxel index
+    #pragma omp parallel for collapse(2)
     for (int it = 0; it < size_time; ++it) {
         for (int iz = 0; iz < size_z; ++iz) {
             for (int iy = 0; iy < size_x; ++iy) {
                 for (int ix = 0; ix < size_y; ++ix) {
-                    *(nii_noise_data + nxyz * it + nxy * iz + nx * ix + iy) = *(nii_input_data + nxyz * it + nxy * iz + nx * ix + iy) + *(nii_gfactormap_data + nxyz * it + nxy * iz + nx * ix + iy) * cutoff * adjusted_rand_numbers(0, variance_val, arb_pdf_num(N_rand, pFunc, lower, upper));
+                    int64_t i = nxyz * it + nxy * iz + nx * ix + iy;
+                    *(nii_noise_data + i) = *(nii_input_data + i) + *(nii_gfactormap_data + i) * cutoff * variance_val * random_normal(seed, i);
                     // cout << adjusted_rand_numbers(0, variance_val, arb_pdf_num(N_rand, pFunc, lower, upper)) << " noise    " << endl;
                 }
             }
@@ -296,29 +323,3 @@ int main(int argc, char * argv[]) {
     cout << "  Finished." << endl;
     return 0;
 }
-
-// Gauss lower = -5, upper = 5
-double verteilung(double z) {
-    return exp(-z * z / (2.)) * 1. / sqrt(2. * 3.141592653);
-}
-
-double_t arb_pdf_num(int N_rand, double ( * pFunc)(double), double_t lower,
-                     double_t upper) {
-    double_t binwidth = (upper - lower)/(double_t)N_rand;
-    double_t integral = 0.0;
-    double_t rand_num = rand() / (double_t)RAND_MAX;
-    int i;
-
-    for (i = 0; integral < rand_num; i++) {
-        integral += pFunc(lower + (double_t) i * binwidth) * binwidth;
-        if ((lower + (double_t) i * binwidth) > upper) {
-            cout << "  Upper limit, vielleicht sollte da limit angepasst werden." << i << endl;
-            return lower + (double_t) i * binwidth;
-        }
-    }
-    return lower + (double_t) i * binwidth;
-}
-
-double adjusted_rand_numbers(double mean, double stdev, double value) {
-    return value * stdev + mean;
-}
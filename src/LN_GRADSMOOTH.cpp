@@ -1,5 +1,38 @@
 #include "../dep/laynii_lib.h"
 
+// Sum over the (2 * r + 1)^3 box around every voxel, clipped at the image
+// borders. The box is separable, therefore it is summed along x, y and z in
+// turn, each time with a prefix sum over one line of voxels.
+static void box_sum_3D(vector<double>& data, const int size_x, const int size_y,
+                       const int size_z, const int r) {
+    const int64_t sizes[3] = {size_x, size_y, size_z};
+    const int64_t strides[3] = {1, size_x, (int64_t)size_x * size_y};
+    const int64_t nr_voxels = strides[2] * size_z;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        const int64_t n = sizes[axis];
+        const int64_t stride = strides[axis];
+        const int64_t nr_lines = nr_voxels / n;
+
+        #pragma omp parallel
+        {
+            vector<double> prefix(n + 1);
+            #pragma omp for
+            for (int64_t l = 0; l < nr_lines; ++l) {
+                // First voxel of line l (lines run along the current axis)
+                int64_t start = (l / stride) * stride * n + l % stride;
+                prefix[0] = 0;
+                for (int64_t k = 0; k < n; ++k) {
+                    prefix[k + 1] = prefix[k] + data[start + k * stride];
+                }
+                for (int64_t k = 0; k < n; ++k) {
+                    data[start + k * stride] = prefix[min(k + r, n - 1) + 1]
+                                               - prefix[max(k - r, (int64_t)0)];
+                }
+            }
+        }
+    }
+}
 
 int show_help(void){
     printf(
@@ -31,6 +64,8 @@ int show_help(void){
     "    -acros       : (Optional) Determines that smoothing should happen \n"
     "                   across different values, not within similar values.\n"
     "                   NOTE: This option is not working yet.\n"
+    "    -threads     : (Optional) Number of threads for parallel loops.\n"
+    "                   Default is 1.\n"
     "    -output      : (Optional) Output filename, including .nii or\n"
     "                   .nii.gz, and path if needed. Overwrites existing files.\n"
     "\n"
@@ -52,7 +87,7 @@ int main(int argc, char * argv[])
     bool use_outpath = false, keep_masked_voxels = false;
     char *fout = NULL;
     char *fgradi=NULL, *finfi=NULL, *fmaski=NULL;
-    int ac, twodim=0, do_masking=0, within = 0, across = 0;
+    int ac, twodim=0, do_masking=0, within = 0, across = 0, nr_threads = 1;
     float FWHM_val=0, selectivity=0.1;
     if( argc < 3 ) return show_help();
 
@@ -111,6 +146,12 @@ int main(int argc, char * argv[])
                 return 1;
             }
             selectivity = atof(argv[ac]);
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -149,6 +190,7 @@ int main(int argc, char * argv[])
     log_welcome("LN_GRADSMOOTH");
     log_nifti_descriptives(nim_inputfi);
     log_nifti_descriptives(nim_gradi);
+    set_nr_threads(nr_threads);
 
     if (across + within !=1) {
         cout << " Please select either -within or -across" << endl;
@@ -246,24 +288,13 @@ int main(int argc, char * argv[])
     cout << "  Time dimension of smoothed output file:  " << smoothed->nt << endl;
 
     int vic = max(1.,2. * FWHM_val/dX );  // ignore if voxel is too far away
-    float dist_i = 0.;
     cout << "  vic: " << vic <<  endl;
     cout << "  FWHM_val: " <<  FWHM_val<<  endl;
 
-    float temp_wight_factor = 0;  // to store temp values, so I don't make the same computations over and over again.
-
     // ========================================================================
     // Finding the range of gradient values
     // ========================================================================
 
-    // Values that I need to characterize the local signals in the vicinity.
-    float local_val = 0;
-    int NvoxInVinc = (2*vic+1)*(2*vic+1)*(2*vic+1);
-    double vec1[NvoxInVinc];
-    for(int it = 0; it < NvoxInVinc; it++) vec1[it] = 0;
-    float grad_stdev = 0;
-    float value_dist = 0;
-
     // For estimation and output of program process and how much longer it will take.
     int nvoxels_to_go_across = size_z * size_x * size_y;
     int running_index = 0;
@@ -289,71 +320,125 @@ int main(int argc, char * argv[])
     cout << "  The number of voxels to go across = "<< nvoxels_to_go_across << endl;
 
     // ========================================================================
-    // Smoothing loop
+    // Local standard deviation of gradient file
     // ========================================================================
+    // NOTE: Sums of values and squared values over each neighbourhood are
+    // taken from box sums instead of collecting the neighbourhood of every
+    // voxel. Values are centered on the global mean to keep the sums small.
+    vector<float> grad_stdev_data(nxyz, 0);
+    {
+        double grad_mean = 0;
+        for (int i = 0; i < nxyz; ++i) {
+            grad_mean += *(nim_grad_data + i);
+        }
+        grad_mean /= nxyz;
 
-    cout << "  Big smoothing loop is being done now..." << endl;
-
-    for(int iz=0; iz<size_z; ++iz) {
-        for(int iy=0; iy<size_x; ++iy) {
-            for(int ix=0; ix<size_y; ++ix) {
-
-                if ( !( !(*(nim_roi_data + nxy*iz + nx*ix + iy ) > 0) && (do_masking == 1)  ) ) {
+        vector<double> sum1(nxyz), sum2(nxyz);
+        for (int i = 0; i < nxyz; ++i) {
+            double val = *(nim_grad_data + i) - grad_mean;
+            sum1[i] = val;
+            sum2[i] = val * val;
+        }
+        box_sum_3D(sum1, size_x, size_y, size_z, vic);
+        box_sum_3D(sum2, size_x, size_y, size_z, vic);
+
+        for (int iz = 0; iz < size_z; ++iz) {
+            int nz_box = min(iz + vic, size_z - 1) - max(0, iz - vic) + 1;
+            for (int iy = 0; iy < size_y; ++iy) {
+                int ny_box = min(iy + vic, size_y - 1) - max(0, iy - vic) + 1;
+                for (int ix = 0; ix < size_x; ++ix) {
+                    int nx_box = min(ix + vic, size_x - 1) - max(0, ix - vic) + 1;
+                    int i = nxy * iz + nx * iy + ix;
+                    double n = nz_box * ny_box * nx_box;
+                    double var = (sum2[i] - sum1[i] * sum1[i] / n) / (n - 1);
+                    grad_stdev_data[i] = (float) sqrt(max(var, 0.));
+                }
+            }
+        }
+    }
 
-                    // This is to write out how many more voxels I have to go through.
-                    running_index++;
-                    if ((running_index * 100) / nvoxels_to_go_across != pref_ratio ) {
-                        cout << "\r    "<<(running_index * 100) / nvoxels_to_go_across << "% is done." << flush;
-                        pref_ratio = (running_index * 100) / nvoxels_to_go_across;
-                    }
+    // Spatial weights only depend on the offset to the neighbour. Indexed
+    // like the smoothing loop below, where ix runs along y (and iy along x).
+    const int size_vic = 2 * vic + 1;
+    vector<float> spatial_weight(size_vic * size_vic * size_vic);
+    for (int dz = -vic; dz <= vic; ++dz) {
+        for (int dy = -vic; dy <= vic; ++dy) {
+            for (int dx = -vic; dx <= vic; ++dx) {
+                float dist_i = dist((float)dx, (float)dy, (float)dz, 0, 0, 0, dX, dY, dZ);
+                spatial_weight[(dz + vic) * size_vic * size_vic + (dx + vic) * size_vic + (dy + vic)] = gaus(dist_i, FWHM_val);
+            }
+        }
+    }
 
-                    // I am cooking in a clean kitchen.
-                    *(gausweight_data + nxy * iz + nx * ix + iy)  = 0;
-                    *(smoothed_data + nxy * iz + nx * ix + iy)  = 0;
-                    NvoxInVinc = 0;
-                    local_val = *(nim_grad_data + nxy * iz + nx * ix + iy);
-
-                    // Examining the environment and determining what
-                    // the signal intensities are and what its distribution are
-                    for (int iz_i=max(0, iz-vic); iz_i<=min(iz+vic, size_z-1); ++iz_i) {
-                        for (int iy_i=max(0, iy-vic); iy_i<=min(iy+vic, size_x-1); ++iy_i) {
-                            for (int ix_i=max(0, ix-vic); ix_i<=min(ix+vic, size_y-1); ++ix_i) {
-                                vec1[NvoxInVinc] = (double)*(nim_grad_data + nxy * iz_i + nx * ix_i + iy_i);
-                                NvoxInVinc++;
-                            }
-                        }
-                    }
+    // Voxel-major input, so that each neighbour weight is applied to a
+    // contiguous time series
+    vector<float> input_ts(nxyz * size_t);
+    transpose_blocked(nim_inputf_data, input_ts.data(), size_t, nxyz);
 
-                    // The standard deviation of the signal valued in the
-                    // vicinity. This is necessary to normalize how many voxels
-                    // are contributing to the local smoothing.
-                    // grad_stdev = (float)gsl_stats_sd(vec1, 1, NvoxInVinc);
-                    grad_stdev = (float ) ren_stdev (vec1, NvoxInVinc);
+    // ========================================================================
+    // Smoothing loop
+    // ========================================================================
 
-                    for(int iz_i=max(0, iz-vic); iz_i<=min(iz+vic, size_z-1); ++iz_i) {
-                        for(int iy_i=max(0, iy-vic); iy_i<=min(iy+vic, size_x-1); ++iy_i) {
-                            for(int ix_i=max(0, ix-vic); ix_i<=min(ix+vic, size_y-1); ++ix_i) {
-                                dist_i = dist((float)ix, (float)iy, (float)iz, (float)ix_i, (float)iy_i, (float)iz_i,dX,dY,dZ);
-                                value_dist = fabs(local_val - *(nim_grad_data + nxy * iz_i + nx * ix_i + iy_i));
+    cout << "  Big smoothing loop is being done now..." << endl;
 
-                                temp_wight_factor = gaus(dist_i,FWHM_val ) * gaus(value_dist, grad_stdev * selectivity) / gaus(0, grad_stdev * selectivity);
+    #pragma omp parallel
+    {
+        vector<float> smoothed_ts(size_t);  // Per thread
 
-                                // The gaus data are important to avoid local scaling differences, when the kernel size changes. E.g. at edge of images.
-                                // this is a geometric parameter and only need to be calculated for one time point.
-                                // this might be avoidable, if the gaus fucnction is better normaliced.
-                                *(gausweight_data + nxy * iz + nx * ix + iy) += temp_wight_factor;
+        #pragma omp for collapse(2) schedule(dynamic, 64)
+        for(int iz=0; iz<size_z; ++iz) {
+            for(int iy=0; iy<size_x; ++iy) {
+                for(int ix=0; ix<size_y; ++ix) {
+
+                    if ( !( !(*(nim_roi_data + nxy*iz + nx*ix + iy ) > 0) && (do_masking == 1)  ) ) {
+
+                        // This is to write out how many more voxels I have to go through.
+                        int voxel_count;
+                        #pragma omp atomic capture
+                        voxel_count = ++running_index;
+                        if (is_main_thread() && (voxel_count * 100) / nvoxels_to_go_across != pref_ratio ) {
+                            cout << "\r    "<<(voxel_count * 100) / nvoxels_to_go_across << "% is done." << flush;
+                            pref_ratio = (voxel_count * 100) / nvoxels_to_go_across;
+                        }
 
-                                for(int it=0; it<size_t; ++it) {  // loop across lall time steps
-                                    *(smoothed_data + nxyz * it + nxy * iz + nx * ix + iy) += *(nim_inputf_data + nxyz * it + nxy * iz_i + nx * ix_i + iy_i) * temp_wight_factor;
+                        // I am cooking in a clean kitchen.
+                        float weight_sum = 0;
+                        fill(smoothed_ts.begin(), smoothed_ts.end(), 0);
+                        float local_val = *(nim_grad_data + nxy * iz + nx * ix + iy);
+
+                        // The standard deviation of the signal valued in the
+                        // vicinity. This is necessary to normalize how many voxels
+                        // are contributing to the local smoothing.
+                        float grad_stdev = grad_stdev_data[nxy * iz + nx * ix + iy];
+                        float gaus_zero = gaus(0, grad_stdev * selectivity);
+
+                        for(int iz_i=max(0, iz-vic); iz_i<=min(iz+vic, size_z-1); ++iz_i) {
+                            for(int iy_i=max(0, iy-vic); iy_i<=min(iy+vic, size_x-1); ++iy_i) {
+                                for(int ix_i=max(0, ix-vic); ix_i<=min(ix+vic, size_y-1); ++ix_i) {
+                                    int k = (iz - iz_i + vic) * size_vic * size_vic + (ix - ix_i + vic) * size_vic + (iy - iy_i + vic);
+                                    float value_dist = fabs(local_val - *(nim_grad_data + nxy * iz_i + nx * ix_i + iy_i));
+
+                                    float temp_wight_factor = spatial_weight[k] * gaus(value_dist, grad_stdev * selectivity) / gaus_zero;
+
+                                    // The gaus data are important to avoid local scaling differences, when the kernel size changes. E.g. at edge of images.
+                                    // this is a geometric parameter and only need to be calculated for one time point.
+                                    weight_sum += temp_wight_factor;
+
+                                    const float* neighbour_ts = &input_ts[(int64_t)(nxy * iz_i + nx * ix_i + iy_i) * size_t];
+                                    for(int it=0; it<size_t; ++it) {  // loop across lall time steps
+                                        smoothed_ts[it] += neighbour_ts[it] * temp_wight_factor;
+                                    }
                                 }
                             }
                         }
-                    }
+                        *(gausweight_data + nxy * iz + nx * ix + iy) = weight_sum;
 
-                    // Scaling the signal intensity with the overall gaus leakage
-                    if (*(gausweight_data  + nxy*iz + nx*ix  + iy  ) > 0 ) {
+                        // Scaling the signal intensity with the overall gaus leakage
                         for(int it=0; it<size_t; ++it) {
-                            *(smoothed_data + nxyz * it + nxy * iz + nx * ix + iy) /= *(gausweight_data + nxy * iz + nx * ix + iy);
+                            if (weight_sum > 0) {
+                                smoothed_ts[it] /= weight_sum;
+                            }
+                            *(smoothed_data + nxyz * it + nxy * iz + nx * ix + iy) = smoothed_ts[it];
                         }
                     }
                 }
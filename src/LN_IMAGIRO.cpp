@@ -110,10 +110,7 @@ int main(int argc, char * argv[]) {
 
     // Get dimensions of input
     int size_z = nim_layers_r->nz;
-    int size_x = nim_layers_r->nx;
-    int size_y = nim_layers_r->ny;
     int size_time = nim_data_r->nt;
-    int nx = nim_layers_r->nx;
     int nxy = nim_layers_r->nx * nim_layers_r->ny;
     int nxyz = nim_layers_r->nx * nim_layers_r->ny * nim_layers_r->nz;
     int nr_voxels = nim_layers_r->nvox;
@@ -226,49 +223,37 @@ int main(int argc, char * argv[]) {
     // Calculating the number of voxels per layer/column //
     ///////////////////////////////////////////////////////
     cout << "  Calculating the number of voxels per layer column..." << endl;
-    int lay = 0, col = 0, dep = 0;
-
-    for (int iz = 0; iz < size_z; ++iz) {
-        for (int iy = 0; iy < size_y; ++iy) {
-            for (int ix = 0; ix < size_x; ++ix) {
-                int voxel_i = nxy * iz + nx * iy + ix;
-
-                if (*(nim_layers_data + voxel_i) > 0
-                    && *(nim_columns_data + voxel_i) > 0) {
-                    lay = *(nim_layers_data + voxel_i) - 1;
-                    col = *(nim_columns_data + voxel_i) - 1;
-                    dep = iz;
-                    *(imagiro_vnr_data + nxy_imagiro * lay + nx_imagiro * dep + col) += 1;
-                }
-            }
-        }
+    // NOTE: Group label is the imagiro voxel index + 1 of each input voxel
+    const uint32_t nr_groups = nxyz_imagiro;
+    LabelIndex group_index = label_index(nr_voxels, nr_groups,
+        [&](uint32_t voxel_i) {
+            int lay = *(nim_layers_data + voxel_i) - 1;
+            int col = *(nim_columns_data + voxel_i) - 1;
+            if (lay < 0 || col < 0) return 0;
+            int dep = voxel_i / nxy;
+            return nxy_imagiro * lay + nx_imagiro * dep + col + 1;
+        });
+
+    for (uint32_t voxel_j = 0; voxel_j != nr_groups; ++voxel_j) {
+        *(imagiro_vnr_data + voxel_j) =
+            group_index.start[voxel_j + 1] - group_index.start[voxel_j];
     }
 
     //////////////////////////////////////////
     // Averaging all voxels in layer\column //
     //////////////////////////////////////////
     cout << "  Averaging all voxels in layer column..." << endl;
-    for (int it = 0; it < size_time; ++it) {
-        for (int iz = 0; iz < size_z; ++iz) {
-            for (int iy = 0; iy < size_y; ++iy) {
-                for (int ix = 0; ix < size_x; ++ix) {
-                    int voxel_i = nxy * iz + nx * iy + ix;
-
-                    if (*(nim_layers_data + voxel_i) > 0
-                        && *(nim_columns_data + voxel_i) > 0) {
-                        lay = *(nim_layers_data + voxel_i) - 1;
-                        col = *(nim_columns_data + voxel_i) - 1;
-                        dep = iz;
-                        int voxel_j = nxy_imagiro * lay + nx_imagiro * dep + col;
-
-                        value_ofinput_data =
-                            *(nim_data_data + nxyz * it + voxel_i)
-                            / *(imagiro_vnr_data + voxel_j);
-                        *(imagiro_data + nxyz_imagiro * it + voxel_j) += value_ofinput_data;
-                    }
-
-
-                }
+    for (uint32_t voxel_j = 0; voxel_j != nr_groups; ++voxel_j) {
+        const uint32_t g_start = group_index.start[voxel_j];
+        const uint32_t g_end = group_index.start[voxel_j + 1];
+        if (g_start == g_end) continue;
+        for (int it = 0; it < size_time; ++it) {
+            float* out = imagiro_data + nxyz_imagiro * it + voxel_j;
+            for (uint32_t k = g_start; k != g_end; ++k) {
+                value_ofinput_data =
+                    *(nim_data_data + nxyz * it + group_index.ids[k])
+                    / *(imagiro_vnr_data + voxel_j);
+                *out += value_ofinput_data;
             }
         }
     }
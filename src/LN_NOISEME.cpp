@@ -1,18 +1,6 @@
 
 #include "../dep/laynii_lib.h"
 
-int N_rand = 1000;
-double_t lower = -10;
-double_t upper = 10;
-
-double verteilung(double x);
-typedef double (*Functions)(double);
-Functions pFunc = verteilung;
-
-double_t arb_pdf_num(int N_rand, double (*pFunc)(double),
-                     double_t lower, double_t upper);
-double adjusted_rand_numbers(double mean, double stdev, double value);
-
 int show_help(void) {
     printf(
     "LN_NOISEME: Adds noise to image.\n"
@@ -25,6 +13,10 @@ int show_help(void) {
     "    -help   : Show this help.\n"
     "    -input  : Specify input dataset.\n"
     "    -std    : Noise standard deviance.\n"
+    "    -seed   : (Optional) Seed of the random noise. Default is 0. The\n"
+    "              same seed always gives the same noise.\n"
+    "    -threads: (Optional) Number of threads for parallel loops.\n"
+    "              Default is 1.\n"
     "    -output : (Optional) Output filename, including .nii or\n"
     "              .nii.gz, and path if needed. Overwrites existing files.\n"
     "              If not given, the prefix 'noised' is added.\n"
@@ -39,8 +31,9 @@ int main(int argc, char * argv[]) {
     char *fout = NULL ;
     char *fin = NULL;
     int ac;
-    float std_val;
-
+    float std_val = 0;
+    uint64_t seed = 0;
+    int nr_threads = 1;
 
 
     // Process user options
@@ -61,6 +54,18 @@ int main(int argc, char * argv[]) {
                 return 1;
             }
             std_val = atof(argv[ac]);
+        } else if (!strcmp(argv[ac], "-seed")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -seed\n");
+                return 1;
+            }
+            seed = strtoull(argv[ac], NULL, 10);
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -77,6 +82,10 @@ int main(int argc, char * argv[]) {
         fprintf(stderr, "** missing option '-input'\n");
         return 1;
     }
+    if (std_val <= 0) {
+        fprintf(stderr, "** missing option '-std' (a positive value)\n");
+        return 1;
+    }
     // Read input dataset, including data
     nifti_image* nii_input = nifti_image_read(fin, 1);
     if (!nii_input) {
@@ -86,6 +95,7 @@ int main(int argc, char * argv[]) {
 
     log_welcome("LN_NOISEME");
     log_nifti_descriptives(nii_input);
+    set_nr_threads(nr_threads);
     cout << "  Varience chosen to " << std_val << endl;
 
     // ========================================================================
@@ -94,11 +104,11 @@ int main(int argc, char * argv[]) {
     float* nii_new_data = static_cast<float*>(nii_new->data);
     // ========================================================================
 
-    int nr_voxels = nii_input->nvox;
-    for (int i = 0; i < nr_voxels; ++i) {
-        *(nii_new_data + i) +=
-            adjusted_rand_numbers(0, std_val,
-                                  arb_pdf_num(N_rand, pFunc, lower, upper));
+    // NOTE: Noise of each voxel only depends on the seed and voxel index
+    int64_t nr_voxels = nii_input->nvox;
+    #pragma omp parallel for
+    for (int64_t i = 0; i < nr_voxels; ++i) {
+        *(nii_new_data + i) += std_val * random_normal(seed, i);
     }
 
 
@@ -108,33 +118,3 @@ int main(int argc, char * argv[]) {
     cout << "  Finished." << endl;
     return 0;
 }
-
-// Gauss lower = -5 , upper = 5
-double verteilung(double z) {
-    return exp(-z * z / (2.)) * 1. / sqrt(2. * 3.141592653);
-}
-
-double_t arb_pdf_num(int N_rand, double (*pFunc)(double), double_t lower,
-                     double_t upper) {
-    double_t binwidth = (upper - lower)/(double_t)N_rand;
-    double_t integral = 0.0;
-    double_t rand_num = rand() / (double_t)RAND_MAX;
-    // rand_num = rand()/(double_t)RAND_MAX;
-    // rand_num = rand()/(double_t)RAND_MAX;
-    int i;
-
-    for (i = 0; integral < rand_num; i++) {
-        integral += pFunc(lower + (double_t)i * binwidth) * binwidth;
-
-        if ((lower + (double_t)i * binwidth) > upper) {
-            cout << "  Upper limit, maybe there should be adjusted limit "
-                 << i << endl;
-            return lower + (double_t) i *binwidth;
-        }
-    }
-    return lower + (double_t)i * binwidth;
-}
-
-double adjusted_rand_numbers(double mean, double stdev, double value) {
-    return value * stdev + mean;
-}
@@ -1,5 +1,88 @@
 #include "../dep/laynii_lib.h"
 
+static void correlation_kernel_zscore(const float* ts_data, const int size_x,
+                                      const int size_y, const int size_z,
+                                      const int size_time, const int kernel_size,
+                                      double* kernel_sum, double* kernel_count) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Every time series is centered and scaled to unit norm once, so that a
+    // correlation is a single dot product. The kernel is computed one
+    // offset at a time over all voxels: corr(v, v + o) = corr(v + o, v), so
+    // offset -o sees exactly the same voxel pairs as o and only half of the
+    // offsets are computed. Kernel entries are in x, y, z order.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nxyz = static_cast<int64_t>(size_x) * size_y * size_z;
+    const int64_t nx = size_x, nxy = static_cast<int64_t>(size_x) * size_y;
+    const int kernel_half = kernel_size / 2;
+    const int kernel_vol = kernel_size * kernel_size * kernel_size;
+
+    vector<float> zs(nxyz * size_time);
+    vector<char> valid(nxyz, 0);  // False for constant time series
+
+    #pragma omp parallel for
+    for (int64_t v = 0; v < nxyz; ++v) {
+        const float* ts = ts_data + size_time * v;
+        float* z = &zs[size_time * v];
+        double mean = 0, ss = 0;
+        for (int it = 0; it < size_time; ++it) {
+            mean += *(ts + it);
+        }
+        mean /= size_time;
+        for (int it = 0; it < size_time; ++it) {
+            ss += (*(ts + it) - mean) * (*(ts + it) - mean);
+        }
+        if (ss > 0 && isfinite(ss)) {
+            double norm = 1. / sqrt(ss);
+            for (int it = 0; it < size_time; ++it) {
+                *(z + it) = (*(ts + it) - mean) * norm;
+            }
+            valid[v] = 1;
+        }
+    }
+
+    // Offsets up to and including the center, the rest are mirrored
+    const int nr_half = kernel_vol / 2 + 1;
+    int nr_done = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < nr_half; ++k) {
+        const int dx = k % kernel_size - kernel_half;
+        const int dy = (k / kernel_size) % kernel_size - kernel_half;
+        const int dz = k / (kernel_size * kernel_size) - kernel_half;
+        const int64_t offset = nxy * dz + nx * dy + dx;
+
+        double sum = 0, count = 0;
+        for (int iz = max(0, -dz); iz < min(size_z, size_z - dz); ++iz) {
+            for (int iy = max(0, -dy); iy < min(size_y, size_y - dy); ++iy) {
+                for (int ix = max(0, -dx); ix < min(size_x, size_x - dx); ++ix) {
+                    int64_t v = nxy * iz + nx * iy + ix;
+                    if (!valid[v] || !valid[v + offset]) continue;
+
+                    const float* z1 = &zs[size_time * v];
+                    const float* z2 = &zs[size_time * (v + offset)];
+                    float dot = 0;
+                    #pragma omp simd reduction(+:dot)
+                    for (int it = 0; it < size_time; ++it) {
+                        dot += *(z1 + it) * *(z2 + it);
+                    }
+                    if (dot != 0) {
+                        sum += dot;
+                        count++;
+                    }
+                }
+            }
+        }
+        kernel_sum[k] = kernel_sum[kernel_vol - 1 - k] = sum;
+        kernel_count[k] = kernel_count[kernel_vol - 1 - k] = count;
+
+        #pragma omp atomic
+        nr_done++;
+        if (is_main_thread()) {
+            cout << "\r" << nr_done * 100 / nr_half << "    % done " << flush;
+        }
+    }
+}
+
 
 int show_help(void) {
     printf(
@@ -16,6 +99,12 @@ int show_help(void) {
     "    -help        : Show this help.\n"
     "    -input       : Nifti (.nii) time series.\n"
     "    -kernel_size : (Optional) Use an odd positive integer (default 11).\n"
+    "    -zscore      : (Optional) Z-score every time series once and compute\n"
+    "                   the correlations as dot products, each pair of\n"
+    "                   opposite kernel offsets only once. Much faster for\n"
+    "                   large kernels, equal up to float rounding.\n"
+    "    -threads     : (Optional) Number of threads for parallel loops.\n"
+    "                   Default is 1.\n"
     "    -output      : (Optional) Output filename, including .nii or\n"
     "                   .nii.gz, and path if needed. Overwrites existing files.\n"
     "                   If not given, the prefix 'fPSF' is added.\n"
@@ -31,7 +120,8 @@ int main(int argc, char * argv[]) {
     bool use_outpath = false ;
     char  *fout = NULL ;
     char *fin = NULL;
-    int ac;
+    int ac, nr_threads = 1;
+    bool mode_zscore = false;
     int kernel_size = 11; // This is the maximal number of layers. I don't know how to allocate it dynamically. this should be an odd number. That is smaller than half of the shortest matrix size to make sense
     if (argc < 2) return show_help();
 
@@ -45,12 +135,20 @@ int main(int argc, char * argv[]) {
                 return 1;
             }
             kernel_size = atoi(argv[ac]);  // No string copy, pointer assignment
+        } else if (!strcmp(argv[ac], "-zscore")) {
+            mode_zscore = true;
         } else if (!strcmp(argv[ac], "-input")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -input\n");
                 return 1;
             }
             fin = argv[ac];
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -68,7 +166,7 @@ int main(int argc, char * argv[]) {
 
 
     // Read input dataset
-    nifti_image * nii_input = nifti_image_read(fin, 1);
+    nifti_image * nii_input = nifti_image_read_mmap(fin);
     if (!nii_input) {
         fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin);
         return 2;
@@ -76,6 +174,7 @@ int main(int argc, char * argv[]) {
 
     log_welcome("LN_NOISE_KERNEL");
     log_nifti_descriptives(nii_input);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     int size_x = nii_input->nx;
@@ -88,8 +187,12 @@ int main(int argc, char * argv[]) {
 
     // ========================================================================
     // Fix data type issues
-    nifti_image* nii = copy_nifti_as_float32(nii_input);
-    float* nii_data = static_cast<float*>(nii->data);
+    // NOTE: Time series are read voxel-major (ts_data + size_time * voxel),
+    // so that every voxel's time series is contiguous in memory.
+    vector<float> ts(static_cast<size_t>(nxyz) * size_time);
+    copy_voxels_as_float32(nii_input, 0, nxyz, ts.data());
+    nifti_image_unload(nii_input);
+    const float* ts_data = ts.data();
 
 
 if (kernel_size%2==0) {
@@ -107,16 +210,6 @@ if (kernel_size%2==0) {
 ////////allokate and se zero ////
 /////////////////////////////////
 
-double vec1[size_time] ;
-double vec2[size_time] ;
-double dummy = 0;
-
-    for(int timestep = 0; timestep < size_time ; timestep++) {
-        vec1[timestep] = 0;
-        vec2[timestep] = 0;
-    }
-
-
 for(int i = 0; i < kernel_size; i++) {
     for(int j = 0; j < kernel_size ; j++) {
         for(int k = 0; k < kernel_size ; k++) {
@@ -128,7 +221,7 @@ for(int i = 0; i < kernel_size; i++) {
 
 
     // Allocate new nifti
-    nifti_image* nii_kernel = nifti_copy_nim_info(nii);
+    nifti_image* nii_kernel = nifti_copy_nim_info(nii_input);
     nii_kernel->nt = 1;
     nii_kernel->nx = kernel_size;
     nii_kernel->ny = kernel_size;
@@ -159,66 +252,86 @@ if ( size_x < kernel_size*2 || size_y < kernel_size*2 || size_z < kernel_size*2)
     cout << "####################################################" << endl;
 }
 
-int vinc_x = 0 , vinc_y = 0 , vinc_z = 0;
-int kern_ix, kern_iy, kern_iz ;
-
-
-// four time estimate
-int all_loops = size_y * size_x ;
-int loop_counter = 0;
-
-for(int iy=0; iy<size_y; ++iy){
-    for(int ix=0; ix<size_x; ++ix){
-       cout << "\r"<<  loop_counter*100/all_loops  << "    % done "  << flush ;
-       loop_counter++ ;
-       for(int iz=0; iz<size_z; ++iz){
-
-          for(int it = 0 ; it < size_time  ; it++) {
-               //cout  << "  it=" << it << "   ix="  <<ix << "   iy="  <<iy << "   iz="  <<iz<<   endl;
-               vec1[it] =  (double)*(nii_data  + nxyz *it +  nxy*iz + nx*iy + ix) ;
-
-
-          }
-
-          // going trhough vincinity of every voxel
-        for(int kernely= -1*kernel_size/2; kernely<=kernel_size/2; ++kernely){
-             for(int kernelx= -1*kernel_size/2; kernelx<=kernel_size/2; ++kernelx){
-                 for(int kernelz= -1*kernel_size/2; kernelz<=kernel_size/2; ++kernelz){
-
-                    vinc_x = ix + kernelx ;
-                    vinc_y = iy + kernely ;
-                    vinc_z = iz + kernelz ;
-                    kern_ix = kernelx+kernel_size/2;
-                    kern_iy = kernely+kernel_size/2;
-                    kern_iz = kernelz+kernel_size/2;
-
-                    if (vinc_x >= 0 && vinc_x < size_x && vinc_y >= 0 && vinc_y < size_y && vinc_z >= 0 && vinc_z < size_z) {
+const int kernel_half = kernel_size / 2;
+if (mode_zscore) {
+    vector<double> kernel_sum(kernel_vol), kernel_count(kernel_vol);
+    correlation_kernel_zscore(ts_data, size_x, size_y, size_z, size_time,
+                              kernel_size, kernel_sum.data(), kernel_count.data());
+    for (int k = 0; k < kernel_vol; ++k) {
+        int kern_ix = k % kernel_size;
+        int kern_iy = (k / kernel_size) % kernel_size;
+        int kern_iz = k / (kernel_size * kernel_size);
+        Nkernel[kern_iz][kern_iy][kern_ix] = kernel_sum[k];
+        Number_AVERAG[kern_iz][kern_iy][kern_ix] = kernel_count[k];
+    }
+} else {
+    // NOTE: Correlations are computed in parallel for a block of voxels. They
+    // are summed up afterwards in the same voxel order as a single thread would
+    // do, which keeps the kernel identical for any number of threads.
+    const int all_loops = size_y * size_x * size_z;
+    const int block_size = 1024;
+    vector<double> block_correl(static_cast<size_t>(block_size) * kernel_vol);
+
+    for (int block_start = 0; block_start < all_loops; block_start += block_size) {
+        cout << "\r"<<  static_cast<long>(block_start) * 100 / all_loops  << "    % done "  << flush ;
+        int block_stop = min(block_start + block_size, all_loops);
+
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int n = block_start; n < block_stop; ++n) {
+            // Same voxel order as looping over y, x and z
+            int iy = n / (size_x * size_z);
+            int ix = (n / size_z) % size_x;
+            int iz = n % size_z;
+            double* correl = &block_correl[static_cast<size_t>(n - block_start) * kernel_vol];
+            vector<double> vec1(size_time), vec2(size_time);
+
+            const float* ts1 = ts_data + static_cast<size_t>(size_time) * (nxy*iz + nx*iy + ix);
+            for(int it = 0 ; it < size_time  ; it++) {
+                vec1[it] =  (double)*(ts1 + it) ;
+            }
 
-                        for(int it = 0 ; it < size_time  ; it++) {
-                           vec2[it] = (double) *(nii_data  + nxyz *it +  nxy*vinc_z + nx*vinc_y + vinc_x) ;
+            // going trhough vincinity of every voxel
+            int kern_i = 0;
+            for(int kernely= -1*kernel_half; kernely<=kernel_half; ++kernely){
+                for(int kernelx= -1*kernel_half; kernelx<=kernel_half; ++kernelx){
+                    for(int kernelz= -1*kernel_half; kernelz<=kernel_half; ++kernelz){
+                        int vinc_x = ix + kernelx ;
+                        int vinc_y = iy + kernely ;
+                        int vinc_z = iz + kernelz ;
+
+                        correl[kern_i] = 0;
+                        if (vinc_x >= 0 && vinc_x < size_x && vinc_y >= 0 && vinc_y < size_y && vinc_z >= 0 && vinc_z < size_z) {
+                            const float* ts2 = ts_data + static_cast<size_t>(size_time) * (nxy*vinc_z + nx*vinc_y + vinc_x);
+                            for(int it = 0 ; it < size_time  ; it++) {
+                               vec2[it] = (double) *(ts2 + it) ;
+                            }
+                            correl[kern_i] = ren_correl(vec1.data(), vec2.data(), size_time) ;
                         }
-                        dummy  = ren_correl(vec1, vec2, size_time) ;
+                        kern_i++;
+                    }
+                }
+            }
+        }
 
-                        //dummy = kernely ;
+        for (int n = block_start; n < block_stop; ++n) {
+            double* correl = &block_correl[static_cast<size_t>(n - block_start) * kernel_vol];
+            int kern_i = 0;
+            for(int kern_iy = 0; kern_iy < kernel_size; ++kern_iy){
+                for(int kern_ix = 0; kern_ix < kernel_size; ++kern_ix){
+                    for(int kern_iz = 0; kern_iz < kernel_size; ++kern_iz){
+                        double dummy = correl[kern_i];
                         if (isfinite(dummy) && dummy != 0 ) {
-                          //*(nii_kernel_data + knxy*kern_iz + knx*kern_iy + kern_ix) += dummy;
-                           Nkernel[kern_iz][kern_iy][kern_ix] = Nkernel[kern_iz][kern_iy][kern_ix] +  dummy ;
-                           Number_AVERAG[kern_iz][kern_iy][kern_ix]++ ;
-
+                            Nkernel[kern_iz][kern_iy][kern_ix] = Nkernel[kern_iz][kern_iy][kern_ix] +  dummy ;
+                            Number_AVERAG[kern_iz][kern_iy][kern_ix]++ ;
                         }
+                        kern_i++;
                     }
-
-                 }
-              }
-          }
-
-
-
-       }
+                }
+            }
+        }
     }
 }
 
-
 cout << endl;
 
 
@@ -2,6 +2,94 @@
 
 #include "../dep/laynii_lib.h"
 
+template <typename T_acc>
+static void skew_moments(nifti_image* nii_input, float* skew_data,
+                         float* kurt_data, float* autocorr_data,
+                         float* mean_data, float* stdev_data, float* tSNR_data,
+                         float* conc_data, float* noise_data) {
+    ///////////////////////////////////////////////////////////////////////////
+    // All voxel statistics in a single pass over the time series, one volume
+    // at a time. Central moments are running (Welford) moments, the
+    // correlation with the mean time course is a running co-moment and the
+    // lag-1 autocovariance is accumulated relative to the first time point
+    // and centered at the end.
+    ///////////////////////////////////////////////////////////////////////////
+    const int64_t nxyz = nii_input->nx * nii_input->ny * nii_input->nz;
+    const int size_time = nii_input->nt;
+    const int size_noise = size_time - size_time % 2;
+
+    vector<float> vol(nxyz);
+    RunningMoments<T_acc> rm = running_moments<T_acc>(nxyz);
+    vector<T_acc> cov(nxyz, 0), lag(nxyz, 0), first(nxyz, 0), prev(nxyz, 0);
+    T_acc* cov_data = cov.data();
+    T_acc* lag_data = lag.data();
+    T_acc* first_data = first.data();
+    T_acc* prev_data = prev.data();
+    double g_mean = 0, g_m2 = 0;  // Mean time course of everything
+
+    for (int it = 0; it < size_time; ++it) {
+        copy_volume_as_float32(nii_input, it, vol.data());
+        const float* vol_data = vol.data();
+
+        double g = 0;
+        for (int64_t voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+            g += static_cast<double>(*(vol_data + voxel_i) / nxyz);
+        }
+        double dg = g - g_mean;
+        g_mean += dg / (it + 1);
+        g_m2 += dg * (g - g_mean);
+        const T_acc dg_new = static_cast<T_acc>(g - g_mean);
+        const T_acc* mean = rm.mean.data();
+
+        #pragma omp parallel for simd
+        for (int64_t voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+            T_acc x = static_cast<T_acc>(*(vol_data + voxel_i));
+            if (it == 0) first_data[voxel_i] = x;
+            T_acc y = x - first_data[voxel_i];
+            lag_data[voxel_i] += y * prev_data[voxel_i];  // Zero at it = 0
+            prev_data[voxel_i] = y;
+            cov_data[voxel_i] += (x - mean[voxel_i]) * dg_new;
+        }
+        running_moments_add(rm, vol_data);
+
+        if (it < size_noise) {  // Difference of consecutive time points
+            #pragma omp parallel for
+            for (int64_t voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+                if (it % 2 == 0) {
+                    *(noise_data + voxel_i) +=
+                        static_cast<double>(*(vol_data + voxel_i));
+                } else {
+                    *(noise_data + voxel_i) -=
+                        static_cast<double>(*(vol_data + voxel_i));
+                }
+            }
+        }
+    }
+
+    const double n = size_time;
+    #pragma omp parallel for
+    for (int64_t voxel_i = 0; voxel_i < nxyz; ++voxel_i) {
+        double mean = rm.mean[voxel_i];
+        double m2 = rm.m2[voxel_i];
+        double k2 = m2 / n;
+        double stdev = sqrt(m2 / (n - 1));
+
+        // Lag-1 autocovariance around the final mean
+        double mu = mean - first_data[voxel_i];
+        double lag_c = lag_data[voxel_i] - mu * (2 * n * mu - prev_data[voxel_i])
+                       + (n - 1) * mu * mu;
+
+        *(skew_data + voxel_i) =
+            ((1 / n * rm.m3[voxel_i]) / (pow(1 / (n - 1) * m2, 1.5)));
+        *(kurt_data + voxel_i) = rm.m4[voxel_i] / n / (k2 * k2) - 3;
+        *(autocorr_data + voxel_i) = lag_c / m2;
+        *(mean_data + voxel_i) = mean;
+        *(stdev_data + voxel_i) = stdev;
+        *(tSNR_data + voxel_i) = mean / stdev;
+        *(conc_data + voxel_i) = cov_data[voxel_i] / sqrt(g_m2 * m2);
+    }
+}
+
 int show_help(void) {
     printf(
     "LN_SKEW: Calculates mean, standard deviation, tSNR, skew, kurtosis, \n"
@@ -18,14 +106,21 @@ int show_help(void) {
     "    ../LN_SKEW -input lo_BOLD_intemp.nii \n" 
     "\n"
     "Options:\n"
-    "    -help   : Show this help.\n"
-    "    -input  : Nifti (.nii or nii.gz) time series.\n"
-    "    -output : (Optional) Output filename, including .nii or\n"
-    "              .nii.gz, and path if needed. Overwrites existing files.\n"    
+    "    -help    : Show this help.\n"
+    "    -input   : Nifti (.nii or nii.gz) time series.\n"
+    "    -threads : (Optional) Number of threads for parallel loops.\n"
+    "               Default is 1.\n"
+    "    -float_acc: (Optional) Accumulate in single instead of double\n"
+    "               precision. Faster, but less accurate for long or\n"
+    "               high-intensity time series.\n"
+    "    -output  : (Optional) Output filename, including .nii or\n"
+    "               .nii.gz, and path if needed. Overwrites existing files.\n"    
     "\n"
     "Notes:\n"
     "    Applications of this program are described in this blog post: \n"
     "    <http://layerfmri.com/QA>\n"
+    "    Uncompressed (.nii) inputs are read one volume at a time. Compressed\n"
+    "    (.nii.gz) inputs are decompressed into memory as a whole.\n"
     "\n");
     return 0;
 }
@@ -34,7 +129,8 @@ int main(int argc, char * argv[]) {
     bool use_outpath = false ;
     char  *fout = NULL ;
     char *fin = NULL;
-    int ac;
+    int ac, nr_threads = 1;
+    bool mode_float_acc = false;
     if (argc < 2) return show_help();
 
     // Process user options
@@ -47,6 +143,14 @@ int main(int argc, char * argv[]) {
                 return 1;
             }
             fin = argv[ac];
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
+        } else if (!strcmp(argv[ac], "-float_acc")) {
+            mode_float_acc = true;
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -66,7 +170,7 @@ int main(int argc, char * argv[]) {
     }
 
     // Read input dataset
-    nifti_image * nii_input = nifti_image_read(fin, 1);
+    nifti_image * nii_input = nifti_image_read_mmap(fin);
     if (!nii_input) {
         fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin);
         return 2;
@@ -74,6 +178,7 @@ int main(int argc, char * argv[]) {
 
     log_welcome("LN_SKEW");
     log_nifti_descriptives(nii_input);
+    set_nr_threads(nr_threads);
 
     // Get dimensions of input
     int size_x = nii_input->nx;
@@ -85,14 +190,10 @@ int main(int argc, char * argv[]) {
     int nxyz = nii_input->nx * nii_input->ny * nii_input->nz;
 
     // ========================================================================
-    // Fix data type issues
-    nifti_image* nii = copy_nifti_as_float32(nii_input);
-    float* nii_data = static_cast<float*>(nii->data);
-
     // Allocate new nifti
-    nifti_image* nii_skew = nifti_copy_nim_info(nii);
+    nifti_image* nii_skew = nifti_copy_nim_info(nii_input);
     nii_skew->nt = 1;
-    nii_skew->nvox = nii->nvox / size_time;
+    nii_skew->nvox = nii_input->nvox / size_time;
     nii_skew->datatype = NIFTI_TYPE_FLOAT32;
     nii_skew->nbyper = sizeof(float);
     nii_skew->data = calloc(nii_skew->nvox, nii_skew->nbyper);
@@ -125,30 +226,20 @@ int main(int argc, char * argv[]) {
     nifti_image* nii_NOISESTDEV = copy_nifti_as_float32(nii_skew);
     float* nii_NOISESTDEV_data = static_cast<float*>(nii_NOISESTDEV->data);
 
-    // ========================================================================
-    cout << "  Calculating skew, kurtosis, and autocorrelation..." << endl;
-
-    double vec1[size_time];
-    double vec2[size_time];
-    int voxel_i = 0; 
+    // Even number of time points for the image SNR
+    int size_noise = size_time - size_time % 2;
 
-    for (int iz = 0; iz < size_z; ++iz) {
-        for (int iy = 0; iy < size_y; ++iy) {
-            for (int ix = 0; ix < size_x; ++ix) {
-                voxel_i = nxy * iz + nx * iy + ix;
-                for (int it = 0; it < size_time; ++it) {
-                    vec1[it] =
-                        static_cast<double>(*(nii_data + nxyz * it + voxel_i));
-                }
-                *(nii_skew_data + voxel_i) = ren_skew(vec1, size_time);
-                *(nii_kurt_data + voxel_i) = ren_kurt(vec1, size_time);
-                *(nii_autocorr_data + voxel_i) = ren_autocor(vec1, size_time);
-                *(nii_mean_data + voxel_i) =  ren_average(vec1, size_time);
-                *(nii_stdev_data + voxel_i) = ren_stdev(vec1, size_time);
-                *(nii_tSNR_data + voxel_i) = ren_average(vec1, size_time)/ren_stdev(vec1, size_time);
-            }
-        }
+    cout << "  Calculating skew, kurtosis, and autocorrelation..." << endl;
+    if (mode_float_acc) {
+        skew_moments<float>(nii_input, nii_skew_data, nii_kurt_data,
+                            nii_autocorr_data, nii_mean_data, nii_stdev_data,
+                            nii_tSNR_data, nii_conc_data, nii_NOISE_data);
+    } else {
+        skew_moments<double>(nii_input, nii_skew_data, nii_kurt_data,
+                             nii_autocorr_data, nii_mean_data, nii_stdev_data,
+                             nii_tSNR_data, nii_conc_data, nii_NOISE_data);
     }
+    nifti_image_unload(nii_input);
 
     for (int voxel_i = 0; voxel_i < nxyz ; voxel_i++) {
       if ((nii_tSNR->scl_slope) != 0)  *(nii_tSNR_data + voxel_i) /=  (nii_tSNR->scl_slope) ; 
@@ -164,39 +255,6 @@ int main(int argc, char * argv[]) {
     save_output_nifti(fout, "tSNR", nii_tSNR, true);
     // ========================================================================
     cout << "  Calculating correlation with everything..." << endl;
-
-    for (int it = 0; it < size_time; ++it) {
-        vec1[it] = 0;
-        vec2[it] = 0;
-    }
-
-    // Mean time course of everything
-    for (int iz = 0; iz < size_z; ++iz) {
-        for (int iy = 0; iy < size_y; ++iy) {
-            for (int ix = 0; ix < size_x; ++ix) {
-                voxel_i = nxy * iz + nx * iy + ix;
-                for (int it = 0; it < size_time; ++it) {
-                    vec1[it] +=
-                        static_cast<double>(*(nii_data + nxyz * it + voxel_i)
-                                            / nxyz);
-                }
-            }
-        }
-    }
-
-    // Voxel-wise corelation to mean of everything
-    for (int iz = 0; iz < size_z; ++iz) {
-        for (int iy = 0; iy < size_y; ++iy) {
-            for (int ix = 0; ix <size_x; ++ix) {
-                voxel_i = nxy * iz + nx * iy + ix;
-                for (int it = 0; it < size_time; ++it)   {
-                    vec2[it] =
-                        static_cast<double>(*(nii_data + nxyz * it + voxel_i));
-                }
-                *(nii_conc_data + voxel_i) = ren_correl(vec1, vec2, size_time);
-            }
-        }
-    }
     save_output_nifti(fout, "overall_correl", nii_conc, true);
     
     
@@ -204,19 +262,10 @@ int main(int argc, char * argv[]) {
     
     // ========================================================================
     cout << "  Calculating image SNR ..." << endl;
-    //size_time = 20;
-    if (size_time%2 == 1) size_time = size_time -1  ;  // make sure its and odd number of time points 
-    
-    for (int it = 0; it < size_time-1 ; it = it + 2 )   {
-        for (int voxel_i = 0; voxel_i < nxyz ; voxel_i++) {
-                    //vec2[it] =  static_cast<double>(*(nii_data + nxyz * it + voxel_i));
-                *(nii_NOISE_data + voxel_i) += static_cast<double>(*(nii_data + nxyz * it     + voxel_i)) ;
-                *(nii_NOISE_data + voxel_i) -= static_cast<double>(*(nii_data + nxyz * (it+1) + voxel_i)) ;
-        }
-    }
-  
+    size_time = size_noise;  // make sure its and odd number of time points 
   
   // normalicing to time course duration
+    #pragma omp parallel for
     for (int voxel_i = 0; voxel_i < nxyz ; voxel_i++) {
                 *(nii_NOISE_data + voxel_i) = *(nii_NOISE_data + voxel_i) / sqrt((double) (size_time)/2 ) ;
     }
@@ -227,15 +276,15 @@ int main(int argc, char * argv[]) {
 //-------------------------------------
     // estimating local gradient of mean  
     
-    int vinc_counter = 0 ;
-    int vinc_x = 0 , vinc_y = 0 , vinc_z = 0;
     int vic = 1 ; // this will result in 26 neighbors (27 voxels) and is sufficient for decent STDEV estimation
     
      
+    #pragma omp parallel for collapse(2)
     for (int iz = 0; iz < size_z; ++iz) {
         for (int iy = 0; iy < size_y; ++iy) {
             for (int ix = 0; ix <size_x; ++ix) {
-                vinc_counter = 0; 
+                double vec1[27];
+                int vinc_counter = 0; 
                 
                 for (int iz_i=max(0, iz-vic); iz_i<=min(iz+vic, size_z-1); ++iz_i) {
                     for (int iy_i=max(0, iy-vic); iy_i<=min(iy+vic, size_y-1); ++iy_i) {
@@ -255,10 +304,12 @@ int main(int argc, char * argv[]) {
     // estimateing local image SNR  
 
 
+    #pragma omp parallel for collapse(2)
     for (int iz = 0; iz < size_z; ++iz) {
         for (int iy = 0; iy < size_y; ++iy) {
             for (int ix = 0; ix <size_x; ++ix) {
-                vinc_counter = 0; 
+                double vec1[27];
+                int vinc_counter = 0; 
                 
                 for (int iz_i=max(0, iz-vic); iz_i<=min(iz+vic, size_z-1); ++iz_i) {
                     for (int iy_i=max(0, iy-vic); iy_i<=min(iy+vic, size_y-1); ++iy_i) {
@@ -1,7 +1,74 @@
 
 
+#include <complex>
 #include "../dep/laynii_lib.h"
 
+// Windows wider than this many time points use the FFT for -gaus
+static const int FFT_MIN_WINDOW = 33;
+
+static void fft_radix2(vector<complex<double> >& a, bool inverse) {
+    // In place iterative Cooley-Tukey FFT, a.size() must be a power of two.
+    // The inverse is not scaled by 1/N.
+    const size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double ang = 2 * M_PI / len * (inverse ? 1 : -1);
+        complex<double> wlen(cos(ang), sin(ang));
+        for (size_t i = 0; i < n; i += len) {
+            complex<double> w(1);
+            for (size_t k = 0; k < len / 2; ++k) {
+                complex<double> u = a[i + k], v = a[i + k + len / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+                w *= wlen;
+            }
+        }
+    }
+}
+
+static void recursive_gaussian(const double* x, double* y, int n, int pad,
+                               double sigma) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Young and van Vliet (1995) recursive Gaussian: a causal and an
+    // anti-causal third order pass, whose cost does not depend on sigma.
+    // x and y hold n + pad values, the last pad values of x must be zero so
+    // that the anti-causal pass starts after the tail of the causal one.
+    ///////////////////////////////////////////////////////////////////////////
+    double q;
+    if (sigma >= 2.5) {
+        q = 0.98711 * sigma - 0.96330;
+    } else {
+        q = 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+    }
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q
+                      + 0.422205 * q * q * q;
+    const double b1 = (2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0;
+    const double b2 = -(1.4281 * q * q + 1.26661 * q * q * q) / b0;
+    const double b3 = (0.422205 * q * q * q) / b0;
+    const double B = 1 - (b1 + b2 + b3);
+
+    const int m = n + pad;
+    for (int i = 0; i < m; ++i) {
+        double w1 = i > 0 ? y[i - 1] : 0;
+        double w2 = i > 1 ? y[i - 2] : 0;
+        double w3 = i > 2 ? y[i - 3] : 0;
+        y[i] = B * x[i] + b1 * w1 + b2 * w2 + b3 * w3;
+    }
+    double y1 = 0, y2 = 0, y3 = 0;
+    for (int i = m - 1; i >= 0; --i) {
+        double v = B * y[i] + b1 * y1 + b2 * y2 + b3 * y3;
+        y3 = y2;
+        y2 = y1;
+        y1 = v;
+        y[i] = v;
+    }
+}
+
 int show_help(void) {
     printf(
     "LN_TEMPSMOOTH : Smooths data within the time domain. It removes high\n"
@@ -14,21 +81,34 @@ int show_help(void) {
     "    ../LN_TEMPSMOOTH -input lo_BOLD_intemp.nii -gaus 1 \n" 
     "\n"
     "Options:\n"
-    "    -help   : Show this help.\n"
-    "    -input  : Nifti (.nii) file with time series data that will be \n"
-    "              nii_smooth. Only the first time point is used. \n"
-    "    -gaus   : Doing the smoothing with a Gaussian weight function. \n"
-    "              A travelling window of averaging. Specify the value \n"
-    "              of the Gaussian size (float values) in units of TR. \n"
-    "    -box    : Doing the smoothing with a box-var. Specify the value \n"
-    "              of the box sice (integer value). This is like a \n"
-    "              running average sliding window.\n"
-    "    -output : (Optional) Output filename, including .nii or\n"
-    "              .nii.gz, and path if needed. Overwrites existing files.\n"    
+    "    -help    : Show this help.\n"
+    "    -input   : Nifti (.nii) file with time series data that will be \n"
+    "               nii_smooth. Only the first time point is used. \n"
+    "    -gaus    : Doing the smoothing with a Gaussian weight function. \n"
+    "               A travelling window of averaging. Specify the value \n"
+    "               of the Gaussian size (float values) in units of TR. \n"
+    "               Windows wider than 32 time points are convolved with\n"
+    "               the FFT (same filter, cost independent of the size).\n"
+    "               This is the case from a Gaussian size of 8 onwards.\n"
+    "    -recursive: (Optional) With -gaus, use a recursive Gaussian filter\n"
+    "               (Young and van Vliet), which is not truncated and\n"
+    "               costs the same for any Gaussian size.\n"
+    "    -box     : Doing the smoothing with a box-var. Specify the value \n"
+    "               of the box sice (integer value). This is like a \n"
+    "               running average sliding window (computed as a running\n"
+    "               sum, so the cost does not depend on the box size).\n"
+    "    -threads : (Optional) Number of threads for parallel loops.\n"
+    "               Default is 1.\n"
+    "    -output  : (Optional) Output filename, including .nii or\n"
+    "               .nii.gz, and path if needed. Overwrites existing files.\n"    
     "\n"
     "Notes:\n"
-    "    An application of this program is described on this blog post:\n"
-    "    <https://layerfmri.com/anatomically-informed-spatial-smoothing> \n"
+    "    - Box and narrow Gaussian smoothing read and write one volume at\n"
+    "      a time. The FFT and the recursive filter need whole time series\n"
+    "      and keep the full output time series in memory (as float32)\n"
+    "      before it is written.\n"
+    "    - An application of this program is described on this blog post:\n"
+    "      <https://layerfmri.com/anatomically-informed-spatial-smoothing> \n"
     "\n");
     return 0;
 }
@@ -37,7 +117,8 @@ int main(int argc, char * argv[]) {
     bool use_outpath = false ;
     char  *fout = NULL ;
     char* fin = NULL;
-    int ac, do_gaus = 0, do_box = 0, bFWHM_val = 0;
+    int ac, do_gaus = 0, do_box = 0, bFWHM_val = 0, nr_threads = 1;
+    bool mode_recursive = false;
     float gFWHM_val = 0.0;
     if (argc  <  3) return show_help();
 
@@ -59,12 +140,20 @@ int main(int argc, char * argv[]) {
             }
             bFWHM_val = atoi(argv[ac]);
             do_box = 1;
+        } else if (!strcmp(argv[ac], "-recursive")) {
+            mode_recursive = true;
         } else if (!strcmp(argv[ac], "-input")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -input\n");
                 return 1;
             }
             fin = argv[ac];
+        } else if (!strcmp(argv[ac], "-threads")) {
+            if (++ac >= argc) {
+                fprintf(stderr, "** missing argument for -threads\n");
+                return 1;
+            }
+            nr_threads = atoi(argv[ac]);
         } else if (!strcmp(argv[ac], "-output")) {
             if (++ac >= argc) {
                 fprintf(stderr, "** missing argument for -output\n");
@@ -84,7 +173,7 @@ int main(int argc, char * argv[]) {
     }
 
     // Read input dataset
-    nifti_image * nii_input = nifti_image_read(fin, 1);
+    nifti_image * nii_input = nifti_image_read_mmap(fin);
     if (!nii_input) {
         fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin);
         return 2;
@@ -96,6 +185,7 @@ int main(int argc, char * argv[]) {
 
     log_welcome("LN_TEMPSMOOTH");
     log_nifti_descriptives(nii_input);
+    set_nr_threads(nr_threads);
     if (do_gaus) {
         cout << "Selected temporal smoothing: Gaussian" << endl;
     } else if (do_box) {
@@ -110,26 +200,11 @@ int main(int argc, char * argv[]) {
     int nr_voxels = size_x * size_y * size_z;
     // int nx = nii_input->nx;
     // int nxy = nii_input->nx * nii_input->ny;
-    int nxyz = nii_input->nx * nii_input->ny * nii_input->nz;
+    // NOTE: 64 bit, so that offsets of volumes in the buffers do not overflow
+    const int64_t nxyz = static_cast<int64_t>(nii_input->nx) * nii_input->ny
+                         * nii_input->nz;
     float dT = 1;
 
-    // ========================================================================
-    // Fixing potential problems with different input datatypes
-    nifti_image* nii = copy_nifti_as_float32(nii_input);
-    float* nii_data = static_cast<float*>(nii->data);
-
-    // Allocating necessary files
-    nifti_image* nii_smooth = copy_nifti_as_float32(nii);
-    float* nii_smooth_data = static_cast<float*>(nii_smooth->data);
-
-    nifti_image* nii_weight = nifti_copy_nim_info(nii);
-    nii_weight->nt = 1;
-    nii_weight->datatype = NIFTI_TYPE_FLOAT32;
-    nii_weight->nbyper = sizeof(float);
-    nii_weight->nvox = size_x * size_y * size_z;
-    nii_weight->data = calloc(nii_weight->nvox, nii_weight->nbyper);
-    float* nii_weight_data = static_cast<float*>(nii_weight->data);
-
     // ========================================================================
     // Smoothing loop
     // ========================================================================
@@ -142,42 +217,219 @@ int main(int argc, char * argv[]) {
     cout << "    vic " << vic << endl;
     cout << "    FWHM_val " << gFWHM_val << endl;
 
-    for (int i = 0; i < nr_voxels; ++i) {
-        *(nii_weight_data + i) = 0;
-        if (*(nii_data + i) != 0) {
+    // Output header. Same as a float32 copy of the input.
+    nifti_image* nii_smooth = nifti_copy_nim_info(nii_input);
+    nii_smooth->datatype = NIFTI_TYPE_FLOAT32;
+    nii_smooth->nbyper = sizeof(float);
+    if (!use_outpath) fout = fin;
+    znzFile fp_smooth = open_output_nifti(fout, "tempsmooth", nii_smooth, true,
+                                          use_outpath);
+
+    // Voxels that are zero in the first time point are not smoothed
+    float* first_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+    float* smooth_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+    copy_volume_as_float32(nii_input, 0, first_data);
+
+    // Temporal weights only depend on the distance in TRs
+    vector<float> weights(max(vic, 0) + 1);
+    for (int d = 0; d <= vic; ++d) {
+        if (do_gaus) {
+            float dist = d;
+            weights[d] = gaus(dist, gFWHM_val);
+        } else if (do_box) {
+            weights[d] = 1;
+        }
+    }
+
+    bool mode_fft = do_gaus && !mode_recursive && 2 * vic + 1 >= FFT_MIN_WINDOW;
+    if (do_gaus && mode_recursive && gFWHM_val < 0.5) {
+        cout << "    Gaussian too small for the recursive filter, using the "
+             << "travelling window instead." << endl;
+        mode_recursive = false;
+    }
+
+    if (do_box) {
+        // ====================================================================
+        // NOTE: Running sum of the box. For every time point the volume
+        // entering and the volume leaving the window are read, so the cost
+        // does not depend on the box size. Sums are kept in double. The
+        // current volume is read as well, it is copied to the output where
+        // the first time point is zero.
+        // ====================================================================
+        vector<double> run_sum(nxyz, 0);
+        float* vol_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
+        for (int jt = 0; jt < min(vic, size_time); ++jt) {
+            copy_volume_as_float32(nii_input, jt, vol_data);
+            #pragma omp parallel for
+            for (int i = 0; i < nr_voxels; ++i) {
+                run_sum[i] += *(vol_data + i);
+            }
+        }
+
+        for (int it = 0; it < size_time; ++it) {
+            int jt_start = max(0, it - vic);
+            int jt_stop = min(it + vic + 1, size_time);
+            int jt_in = it + vic, jt_out = it - vic - 1;
+
+            if (jt_in < size_time) {
+                copy_volume_as_float32(nii_input, jt_in, vol_data);
+                #pragma omp parallel for
+                for (int i = 0; i < nr_voxels; ++i) {
+                    run_sum[i] += *(vol_data + i);
+                }
+            }
+            if (jt_out >= 0) {
+                copy_volume_as_float32(nii_input, jt_out, vol_data);
+                #pragma omp parallel for
+                for (int i = 0; i < nr_voxels; ++i) {
+                    run_sum[i] -= *(vol_data + i);
+                }
+            }
+
+            copy_volume_as_float32(nii_input, it, vol_data);
+            const double weight = jt_stop - jt_start;
+            #pragma omp parallel for
+            for (int i = 0; i < nr_voxels; ++i) {
+                if (*(first_data + i) != 0) {
+                    *(smooth_data + i) = run_sum[i] / weight;
+                } else {
+                    *(smooth_data + i) = *(vol_data + i);
+                }
+            }
+            write_output_volume(fp_smooth, smooth_data, nr_voxels);
+        }
+        free(vol_data);
+
+    } else if (mode_fft || mode_recursive) {
+        // ====================================================================
+        // NOTE: Wide Gaussians filter whole time series, read voxel-major for
+        // blocks of voxels: either as an FFT convolution with the same
+        // truncated weights as the travelling window, or recursively. Both
+        // divide by the same filter applied to the available time points,
+        // like the travelling window does at the edges. The output is held
+        // in memory and written volume by volume afterwards.
+        // ====================================================================
+        cout << "    Using the " << (mode_fft ? "FFT" : "recursive filter")
+             << ", the output time series is held in memory." << endl;
+        const int block_size = 256;
+        vector<float> out_data(static_cast<size_t>(nxyz) * size_time);
+
+        // Edge normalization of the truncated weights
+        vector<double> norm(size_time, 0);
+        int nr_fft = 1, nr_pad = 0;
+        vector<complex<double> > kernel_fft;
+        if (mode_fft) {
             for (int it = 0; it < size_time; ++it) {
-                int j = nxyz * it + i;
-                *(nii_smooth_data + j) = 0;
+                for (int jt = max(0, it - vic); jt < min(it + vic + 1, size_time); ++jt) {
+                    norm[it] += weights[abs(it - jt)];
+                }
+            }
+            while (nr_fft < size_time + vic) nr_fft <<= 1;
+            kernel_fft.assign(nr_fft, 0);
+            for (int d = -vic; d <= vic; ++d) {
+                kernel_fft[(d + nr_fft) % nr_fft] = weights[abs(d)];
+            }
+            fft_radix2(kernel_fft, false);
+        } else {
+            nr_pad = static_cast<int>(ceil(4 * gFWHM_val)) + 3;
+            vector<double> ones(size_time + nr_pad, 0);
+            fill(ones.begin(), ones.begin() + size_time, 1.);
+            vector<double> ones_smooth(size_time + nr_pad);
+            recursive_gaussian(ones.data(), ones_smooth.data(), size_time,
+                               nr_pad, gFWHM_val);
+            copy(ones_smooth.begin(), ones_smooth.begin() + size_time,
+                 norm.begin());
+        }
 
-                if (do_gaus) {
-                    float weight = 0;
-                    int jt_start = max(0, it - vic);
-                    int jt_stop = min(it + vic + 1, size_time);
-                    for (int jt = jt_start; jt < jt_stop; ++jt) {
-                        int k = nxyz * jt + i;
-                        float dist = abs(it - jt);
-                        float g = gaus(dist, gFWHM_val);
-                        *(nii_smooth_data + j) += (*(nii_data + k) * g);
-                        weight += g;
+        vector<float> block_data(static_cast<size_t>(block_size) * size_time);
+        vector<float> block_out(static_cast<size_t>(block_size) * size_time);
+        for (int64_t v0 = 0; v0 < nxyz; v0 += block_size) {
+            const int nv = static_cast<int>(min<int64_t>(block_size, nxyz - v0));
+            copy_voxels_as_float32(nii_input, v0, nv, block_data.data());
+
+            #pragma omp parallel
+            {
+                vector<complex<double> > a(nr_fft);
+                vector<double> x(size_time + nr_pad), y(size_time + nr_pad);
+                #pragma omp for
+                for (int v = 0; v < nv; ++v) {
+                    float* ts = &block_data[static_cast<size_t>(v) * size_time];
+                    if (*(first_data + v0 + v) == 0) continue;
+                    if (mode_fft) {
+                        fill(a.begin(), a.end(), complex<double>(0));
+                        for (int it = 0; it < size_time; ++it) a[it] = *(ts + it);
+                        fft_radix2(a, false);
+                        for (int k = 0; k < nr_fft; ++k) a[k] *= kernel_fft[k];
+                        fft_radix2(a, true);
+                        for (int it = 0; it < size_time; ++it) {
+                            *(ts + it) = a[it].real() / nr_fft / norm[it];
+                        }
+                    } else {
+                        fill(x.begin(), x.end(), 0.);
+                        for (int it = 0; it < size_time; ++it) x[it] = *(ts + it);
+                        recursive_gaussian(x.data(), y.data(), size_time, nr_pad,
+                                           gFWHM_val);
+                        for (int it = 0; it < size_time; ++it) {
+                            *(ts + it) = y[it] / norm[it];
+                        }
                     }
-                    *(nii_smooth_data + j) /= weight;
-                } else if (do_box) {
+                }
+            }
+            transpose_blocked(block_data.data(), block_out.data(), nv, size_time);
+            for (int it = 0; it < size_time; ++it) {
+                copy(&block_out[static_cast<size_t>(it) * nv],
+                     &block_out[static_cast<size_t>(it + 1) * nv],
+                     &out_data[static_cast<size_t>(it) * nxyz + v0]);
+            }
+        }
+        for (int it = 0; it < size_time; ++it) {
+            write_output_volume(fp_smooth, &out_data[static_cast<size_t>(it) * nxyz],
+                                nr_voxels);
+        }
+
+    } else {
+        // ====================================================================
+        // NOTE: Volumes are read and written one at a time. Only the 2*vic+1
+        // volumes of the travelling window are kept in memory (ring buffer),
+        // instead of float copies of the whole input and output time series.
+        // ====================================================================
+        int nr_ring = max(1, min(2 * vic + 1, size_time));
+        float* ring_data = static_cast<float*>(
+            malloc(static_cast<size_t>(nr_ring) * nxyz * sizeof(float)));
+
+        int nr_read = 0;
+        for (int it = 0; it < size_time; ++it) {
+            int jt_start = max(0, it - vic);
+            int jt_stop = min(it + vic + 1, size_time);
+
+            // Read volumes that entered the window
+            for (; nr_read < jt_stop; ++nr_read) {
+                copy_volume_as_float32(nii_input, nr_read,
+                                       ring_data + (nr_read % nr_ring) * nxyz);
+            }
+            float* nii_data = ring_data + (it % nr_ring) * nxyz;
+
+            #pragma omp parallel for schedule(dynamic, 256)
+            for (int i = 0; i < nr_voxels; ++i) {
+                if (*(first_data + i) != 0) {
+                    float sum = 0;
                     float weight = 0;
-                    int jt_start = max(0, it - vic);
-                    int jt_stop = min(it + vic + 1, size_time);
                     for (int jt = jt_start; jt < jt_stop; ++jt) {
-                        int k = nxyz * jt + i;
-                        *(nii_smooth_data + j) += *(nii_data + k);
-                        weight += 1;
+                        float* jt_data = ring_data + (jt % nr_ring) * nxyz;
+                        float g = weights[abs(it - jt)];
+                        sum += (*(jt_data + i) * g);
+                        weight += g;
                     }
-                    *(nii_smooth_data + j) /= weight;
+                    *(smooth_data + i) = sum / weight;
+                } else {
+                    *(smooth_data + i) = *(nii_data + i);
                 }
             }
+            write_output_volume(fp_smooth, smooth_data, nr_voxels);
         }
+        free(ring_data);
     }
-
-    if (!use_outpath) fout = fin;
-    save_output_nifti(fout, "tempsmooth", nii_smooth, true, use_outpath);
+    close_output_nifti(fp_smooth);
 
     cout << "  Finished." << endl;
     return 0;
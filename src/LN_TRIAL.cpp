@@ -17,6 +17,10 @@ int show_help(void) {
     "    -trial_dur : Duration of activity-rest trial in TRs.\n"
     "    -output    : (Optional) Output filename, including .nii or\n"
     "                 .nii.gz, and path if needed. Overwrites existing files.\n"    
+    "\n"
+    "Notes:\n"
+    "    Uncompressed (.nii) inputs are read one volume at a time. Compressed\n"
+    "    (.nii.gz) inputs are decompressed into memory as a whole.\n"
     "\n");
     return 0;
 }
@@ -64,7 +68,7 @@ int main(int argc, char * argv[]) {
     }
 
     // Read input dataset
-    nifti_image *nii_input = nifti_image_read(fin, 1);
+    nifti_image *nii_input = nifti_image_read_mmap(fin);
     if (!nii_input) {
         fprintf(stderr, "** failed to read NIfTI from '%s'\n", fin);
         return 2;
@@ -88,26 +92,28 @@ int main(int argc, char * argv[]) {
          << nr_trials << " trials recorded here." << endl;
 
     // ========================================================================
-    // Fix data type issues
-    nifti_image* nii = copy_nifti_as_float32(nii_input);
-    float* nii_data = static_cast<float*>(nii->data);
-
     // Allocate trial average file
-    nifti_image* nii_trials = nifti_copy_nim_info(nii);
+    nifti_image* nii_trials = nifti_copy_nim_info(nii_input);
     nii_trials->nt = trial_dur;
-    nii_trials->nvox = nii->nvox / nr_trials;
+    nii_trials->nvox = nxyz * trial_dur;
+    nii_trials->datatype = NIFTI_TYPE_FLOAT32;
+    nii_trials->nbyper = sizeof(float);
     nii_trials->data = calloc(nii_trials->nvox, nii_trials->nbyper);
     float* nii_trials_data = static_cast<float*>(nii_trials->data);
 
     // ========================================================================
+    // NOTE: Volumes are converted to float one at a time (fix data type
+    // issues) and added to the average of their trial time point.
+    float* nii_data = static_cast<float*>(malloc(nxyz * sizeof(float)));
 
     for (int it = 0; it < (trial_dur * nr_trials); ++it) {
+        copy_volume_as_float32(nii_input, it, nii_data);
         for (int iz = 0; iz < size_z; ++iz) {
             for (int iy = 0; iy < size_y; ++iy) {
                 for (int ix = 0; ix < size_x; ++ix) {
                     int voxel_i = nxy * iz + nx * iy + ix;
                     *(nii_trials_data + nxyz * (it % trial_dur) + voxel_i) +=
-                        (*(nii_data + nxyz * it + voxel_i)) / nr_trials;
+                        (*(nii_data + voxel_i)) / nr_trials;
                 }
             }
         }